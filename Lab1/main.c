@@ -1,8 +1,15 @@
 #include "return_codes.h"
 
+#include <fenv.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 #define ZERO 0
 #define OK 1
@@ -14,37 +21,189 @@
 #define TOWARD_POS_INF 2
 #define TOWARD_NEG_INF 3
 
+// IEEE 754 exceptions an operation raises, or-ed into its flags.
+#define EXCEPTION_INVALID 1
+#define EXCEPTION_DIVIDE_BY_ZERO 2
+#define EXCEPTION_OVERFLOW 4
+#define EXCEPTION_UNDERFLOW 8
+#define EXCEPTION_INEXACT 16
+
+#if defined(__GNUC__) || defined(__clang__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#define COLD __attribute__((cold, noinline))
+#else
+#define ALWAYS_INLINE inline
+#define COLD
+#endif
+
+// Operations beyond the four arithmetic ones, which are their own characters.
+#define OPERATION_FMA 'f'
+#define OPERATION_SQRT 's'
+
+// Most operands any operation takes.
+#define MAX_OPERANDS 3
+
+#define FORMAT_SINGLE 0
+#define FORMAT_HALF 1
+#define FORMAT_BFLOAT16 2
+#define FORMAT_DOUBLE 3
+#define FORMAT_E4M3 4
+#define FORMAT_E5M2 5
+
+// Every supported format: id, command line name, exponent bits, mantissa bits and whether it has infinities. E4M3
+// (OCP FP8) has none: its all-ones exponent still holds normal numbers and only S.1111.111 is NaN, so results that
+// would be infinite become NaN.
+#define FORMATS(X)                          \
+    X(FORMAT_SINGLE, "f", 8, 23, true)      \
+    X(FORMAT_HALF, "h", 5, 10, true)        \
+    X(FORMAT_BFLOAT16, "b", 8, 7, true)     \
+    X(FORMAT_DOUBLE, "d", 11, 52, true)     \
+    X(FORMAT_E4M3, "e4m3", 4, 3, false)     \
+    X(FORMAT_E5M2, "e5m2", 5, 2, true)
+
+typedef struct {
+    const char *name;
+    uint8_t exp_size;
+    uint8_t mant_size;
+    bool has_inf;
+    uint16_t exp_mask;
+    uint16_t exp_offset;
+    uint64_t mant_mask;
+    uint64_t abs_mask;
+    uint64_t inf_bits;
+    uint64_t nan_bits;
+    uint64_t quiet_nan_bits;
+} FormatTraits;
+
+// Everything else is derived here, at compile time. Formats without infinities get an infinity magnitude no value
+// can have, and their NaN is the all-ones magnitude.
+#define FORMAT_ABS_MASK(exp, mant) ((UINT64_C(1) << ((exp) + (mant))) - 1)
+#define FORMAT_INF_BITS(exp, mant, inf) \
+    ((inf) ? ((UINT64_C(1) << (exp)) - 1) << (mant) : FORMAT_ABS_MASK(exp, mant) + 1)
+#define FORMAT_TRAITS_ENTRY(id, name, exp, mant, inf)                                                          \
+    [id] = {name, exp, mant, inf, (1u << (exp)) - 1, ((1u << (exp)) - 1) >> 1, (UINT64_C(1) << (mant)) - 1,  \
+            FORMAT_ABS_MASK(exp, mant), FORMAT_INF_BITS(exp, mant, inf),                                      \
+            (inf) ? FORMAT_INF_BITS(exp, mant, inf) + 1 : FORMAT_ABS_MASK(exp, mant),                         \
+            (inf) ? FORMAT_INF_BITS(exp, mant, inf) | UINT64_C(1) << ((mant) - 1) : FORMAT_ABS_MASK(exp, mant)},
+static const FormatTraits FORMAT_TRAITS[] = {FORMATS(FORMAT_TRAITS_ENTRY)};
+#undef FORMAT_TRAITS_ENTRY
+#undef FORMAT_INF_BITS
+#undef FORMAT_ABS_MASK
+
+#define FORMAT_COUNT (sizeof(FORMAT_TRAITS) / sizeof(FORMAT_TRAITS[0]))
+
+// Format parameters are single loads from the constant table: wherever the format is a compile-time constant, as in
+// the kernels instantiated per format by evaluate_batch, they fold away completely.
+static ALWAYS_INLINE uint8_t exp_size(uint8_t format) {
+    return FORMAT_TRAITS[format].exp_size;
+}
+
+static ALWAYS_INLINE uint8_t mant_size(uint8_t format) {
+    return FORMAT_TRAITS[format].mant_size;
+}
+
+static ALWAYS_INLINE bool has_inf(uint8_t format) {
+    return FORMAT_TRAITS[format].has_inf;
+}
+
+static ALWAYS_INLINE uint16_t exp_mask(uint8_t format) {
+    return FORMAT_TRAITS[format].exp_mask;
+}
+
+static ALWAYS_INLINE uint64_t mant_mask(uint8_t format) {
+    return FORMAT_TRAITS[format].mant_mask;
+}
+
+static ALWAYS_INLINE uint16_t exp_offset(uint8_t format) {
+    return FORMAT_TRAITS[format].exp_offset;
+}
+
+static ALWAYS_INLINE uint64_t implicit_bit(uint8_t format) {
+    return FORMAT_TRAITS[format].mant_mask + 1;
+}
+
+static ALWAYS_INLINE uint8_t sign_shift(uint8_t format) {
+    return FORMAT_TRAITS[format].exp_size + FORMAT_TRAITS[format].mant_size;
+}
+
+// Bytes of one value in binary streams.
+static ALWAYS_INLINE uint8_t format_width(uint8_t format) {
+    return (sign_shift(format) + 1) / 8;
+}
+
+static ALWAYS_INLINE uint64_t abs_mask(uint8_t format) {
+    return FORMAT_TRAITS[format].abs_mask;
+}
+
+// All bits of a value; wider operands are rejected.
+static ALWAYS_INLINE uint64_t value_mask(uint8_t format) {
+    return FORMAT_TRAITS[format].abs_mask << 1 | 1;
+}
+
+static ALWAYS_INLINE uint64_t inf_bits(uint8_t format) {
+    return FORMAT_TRAITS[format].inf_bits;
+}
+
+// Smallest NaN magnitude; every magnitude from it up is NaN.
+static ALWAYS_INLINE uint64_t nan_bits(uint8_t format) {
+    return FORMAT_TRAITS[format].nan_bits;
+}
+
+static ALWAYS_INLINE uint64_t quiet_nan_bits(uint8_t format) {
+    return FORMAT_TRAITS[format].quiet_nan_bits;
+}
+
+// Smallest magnitude that is out of range: rounding to it or beyond overflows.
+static ALWAYS_INLINE uint64_t overflow_bits(uint8_t format) {
+    return FORMAT_TRAITS[format].has_inf ? FORMAT_TRAITS[format].inf_bits : FORMAT_TRAITS[format].nan_bits;
+}
+
+static ALWAYS_INLINE uint8_t digits_to_print(uint8_t format) {
+    return (FORMAT_TRAITS[format].mant_size + 3) / 4;
+}
+
+static ALWAYS_INLINE uint8_t mant_gap_to_print(uint8_t format) {
+    return 4 * digits_to_print(format) - mant_size(format);
+}
+
+// Operands an operation takes: sqrt one, fma three (a * b + c), the others two.
+static ALWAYS_INLINE uint8_t operand_count(char operation) {
+    return operation == OPERATION_SQRT ? 1 : operation == OPERATION_FMA ? 3 : 2;
+}
+
 typedef struct {
     uint8_t format;
     uint8_t type;
     bool sign;
+    // exceptions raised by the operation that gave this number; none for operands
+    uint8_t flags;
     int16_t exponent;
     uint64_t mantissa;
 } Number;
 
-Number to_IEEE754_standard(char, uint32_t);
-
-uint8_t sign(uint8_t, uint32_t);
-
-uint8_t exponent(uint8_t, uint32_t);
-
-uint32_t mantissa(uint8_t, uint32_t);
-
-uint8_t exp_size(uint8_t);
-
-uint8_t mant_size(uint8_t);
+// An instruction of a --trace, decoded: operand i is a register number where bit i of registers is set and a value of
+// the format otherwise. kind numbers the operation, format and rounding mode together.
+typedef struct {
+    char operation;
+    uint8_t format;
+    uint8_t rounding;
+    uint8_t registers;
+    uint8_t kind;
+    uint32_t destination;
+    uint64_t operands[MAX_OPERANDS];
+} TraceInstruction;
 
-uint8_t exp_mask(uint8_t);
+Number to_IEEE754_standard(uint8_t, uint64_t);
 
-uint32_t mant_mask(uint8_t);
+uint8_t sign(uint8_t, uint64_t);
 
-uint8_t exp_offset(uint8_t);
+uint16_t exponent(uint8_t, uint64_t);
 
-uint64_t implicit_bit(uint8_t);
+uint64_t mantissa(uint8_t, uint64_t);
 
-uint8_t mant_gap_to_print(uint8_t);
+bool parse_format(const char *, uint8_t *);
 
-uint8_t digits_to_print(uint8_t);
+bool parse_operation(const char *, char *);
 
 Number add(uint8_t, Number, Number);
 
@@ -54,370 +213,2509 @@ Number multiply(uint8_t, Number, Number);
 
 Number divide(uint8_t, Number, Number);
 
-uint8_t normalize(uint8_t, Number *);
+Number fused_multiply_add(uint8_t, Number, Number, Number);
+
+Number square_root(uint8_t, Number);
+
+Number apply_operation(uint8_t, char, const Number *);
+
+void normalize(Number *);
 
 void round_number(uint8_t rounding, Number *num);
 
-uint8_t most_significant_bit(uint64_t);
+uint64_t shift_right_sticky(uint64_t, int32_t);
 
-void shift_to_right(uint64_t *);
+void shift_right_sticky_wide(uint64_t *, uint64_t *, int32_t);
 
 void print_result(Number);
 
-Number to_IEEE754_standard(char format, uint32_t number) {
+uint64_t pack_number(Number);
+
+uint8_t count_leading_zeros(uint64_t);
+
+uint64_t multiply_wide(uint64_t, uint64_t, uint64_t *);
+
+uint64_t divide_wide(uint64_t, uint64_t, uint64_t, uint64_t *);
+
+uint64_t isqrt(uint64_t, uint64_t *);
+
+uint64_t isqrt_wide(uint64_t, uint64_t, uint64_t *);
+
+void evaluate_formats(uint8_t, uint8_t, char, bool, const uint64_t *, uint64_t *, uint8_t *, int64_t);
+
+void evaluate_batch(uint8_t, uint8_t, char, const uint64_t *, uint64_t *, int64_t);
+
+uint8_t evaluate_batch_flags(uint8_t, uint8_t, char, const uint64_t *, uint64_t *, uint8_t *, int64_t);
+
+void build_half_tables(void);
+
+void evaluate_half_table(uint8_t, char, const uint64_t *, uint64_t *, int64_t);
+
+void convert(uint8_t, uint8_t, uint8_t, const uint64_t *, uint64_t *, int64_t);
+
+size_t format_hex(const uint64_t *, int64_t, uint8_t, char *);
+
+bool read_hex_operand(FILE *, uint64_t *);
+
+int64_t read_operands(FILE *, bool, uint8_t, uint8_t, unsigned char *, uint64_t *, int64_t, int *);
+
+void write_results(FILE *, bool, uint8_t, const uint64_t *, const uint8_t *, unsigned char *, int64_t);
+
+void print_flags(FILE *, uint8_t);
+
+int run_batch(uint8_t, uint8_t, char, bool, bool, bool, FILE *, FILE *);
+
+int parse_mode_arguments(char *[], uint8_t *, uint8_t *, char *);
+
+int batch_main(int, char *[]);
+
+int run_convert(uint8_t, uint8_t, uint8_t, bool, FILE *, FILE *);
+
+int convert_main(int, char *[]);
+
+int64_t read_trace(FILE *, unsigned char *, size_t *, TraceInstruction *, int64_t, int *);
+
+int run_trace(bool, FILE *, FILE *, FILE *);
+
+int trace_main(int, char *[]);
+
+int run_bench(uint8_t, uint8_t, char);
+
+int bench_main(int, char *[]);
+
+int run_table_bench(uint8_t, char);
+
+int table_bench_main(int, char *[]);
+
+int run_split_bench(uint8_t, uint8_t, char);
+
+int split_bench_main(int, char *[]);
+
+int run_flags_bench(uint8_t, uint8_t, char);
+
+int flags_bench_main(int, char *[]);
+
+int run_exhaustive(uint8_t, char);
+
+int exhaustive_main(int, char *[]);
+
+Number to_IEEE754_standard(uint8_t format, uint64_t number) {
     Number num = {
-            .format = format == 'h',
-            .sign = sign(format == 'h', number),
-            .exponent = exponent(format == 'h', number),
-            .mantissa = mantissa(format == 'h', number),
+            .format = format,
+            .sign = sign(format, number),
+            .exponent = (int16_t) exponent(format, number),
+            .mantissa = mantissa(format, number),
             .type = ZERO
     };
-    num.type = normalize(mant_size(num.format), &num);
+    uint64_t magnitude = number & abs_mask(format);
+    if (magnitude >= nan_bits(format)) {
+        num.type = NAN;
+    } else if (magnitude == inf_bits(format)) {
+        num.type = INF;
+    } else if (magnitude) {
+        num.type = OK;
+        if (!num.exponent) {
+            // subnormal: one shift brings the leading one to the implicit bit
+            uint8_t shift = count_leading_zeros(num.mantissa) - (63 - mant_size(format));
+            num.mantissa = (num.mantissa << shift) & mant_mask(format);
+            num.exponent = (int16_t) (1 - shift);
+        }
+    }
     return num;
 }
 
-uint8_t sign(uint8_t format, uint32_t number) {
-    return number >> (exp_size(format) + mant_size(format));
+uint8_t sign(uint8_t format, uint64_t number) {
+    return (number >> sign_shift(format)) & 1;
 }
 
-uint8_t exponent(uint8_t format, uint32_t number) {
+uint16_t exponent(uint8_t format, uint64_t number) {
     return (number >> mant_size(format)) & exp_mask(format);
 }
 
-uint32_t mantissa(uint8_t format, uint32_t number) {
+uint64_t mantissa(uint8_t format, uint64_t number) {
     return number & mant_mask(format);
 }
 
-uint8_t exp_size(uint8_t format) {
-    return format ? 5 : 8;
-}
-
-uint8_t mant_size(uint8_t format) {
-    return format ? 10 : 23;
-}
-
-uint8_t exp_mask(uint8_t format) {
-    return format ? 0x1F : 0xFF;
+bool parse_format(const char *name, uint8_t *format) {
+    for (uint8_t id = 0; id < FORMAT_COUNT; ++id) {
+        if (strcmp(name, FORMAT_TRAITS[id].name) == 0) {
+            *format = id;
+            return true;
+        }
+    }
+    return false;
 }
 
-uint32_t mant_mask(uint8_t format) {
-    return format ? 0x3FF : 0x7FFFFF;
+bool parse_operation(const char *name, char *operation) {
+    if (strcmp(name, "fma") == 0) {
+        *operation = OPERATION_FMA;
+    } else if (strcmp(name, "sqrt") == 0) {
+        *operation = OPERATION_SQRT;
+    } else if (strlen(name) == 1 && strchr("+-*/", name[0])) {
+        *operation = name[0];
+    } else {
+        return false;
+    }
+    return true;
 }
 
-uint8_t exp_offset(uint8_t format) {
-    return format ? 15 : 127;
-}
+// Reciprocals of 1 + (i + 1) / 256 in units of 2^-16, rounded down: for every d in [1 + i / 256, 1 + (i + 1) / 256)
+// entry i is at most 2^16 / d and within 2^-8 of it. They seed the Newton iterations of the division. The entries
+// are 64-bit so that vectorized loops can gather them.
+#define RECIPROCAL_ENTRY(i) ((UINT64_C(1) << 24) / (0x100 + (i) + 1))
+#define RECIPROCAL_ENTRIES_4(i) RECIPROCAL_ENTRY(i), RECIPROCAL_ENTRY(i + 1), RECIPROCAL_ENTRY(i + 2), RECIPROCAL_ENTRY(i + 3)
+#define RECIPROCAL_ENTRIES_16(i) \
+    RECIPROCAL_ENTRIES_4(i), RECIPROCAL_ENTRIES_4(i + 4), RECIPROCAL_ENTRIES_4(i + 8), RECIPROCAL_ENTRIES_4(i + 12)
+#define RECIPROCAL_ENTRIES_64(i) \
+    RECIPROCAL_ENTRIES_16(i), RECIPROCAL_ENTRIES_16(i + 16), RECIPROCAL_ENTRIES_16(i + 32), RECIPROCAL_ENTRIES_16(i + 48)
+static const uint64_t RECIPROCAL_TABLE[0x100] = {RECIPROCAL_ENTRIES_64(0), RECIPROCAL_ENTRIES_64(64),
+                                                 RECIPROCAL_ENTRIES_64(128), RECIPROCAL_ENTRIES_64(192)};
+#undef RECIPROCAL_ENTRIES_64
+#undef RECIPROCAL_ENTRIES_16
+#undef RECIPROCAL_ENTRIES_4
+#undef RECIPROCAL_ENTRY
 
-uint64_t implicit_bit(uint8_t format) {
-    return format ? 0x400 : 0x800000;
+// 2^63 / divisor for 2^31 <= divisor < 2^32 from below. Each Newton step y + y * (1 - d * y) squares the relative
+// error of the table entry and never overshoots, so that the result stays a lower bound through the truncations: one
+// step leaves it within about 2^-16, two within about 2^-30.
+static ALWAYS_INLINE uint64_t reciprocal_bits(uint64_t divisor, int steps) {
+    uint64_t reciprocal = RECIPROCAL_TABLE[divisor >> 23 & 0xFF] << 16;
+    for (int step = 0; step < steps; ++step) {
+        uint64_t error = (UINT64_C(1) << 63) - divisor * reciprocal;
+        reciprocal += reciprocal * (error >> 31) >> 32;
+    }
+    return reciprocal;
 }
 
-uint8_t mant_gap_to_print(uint8_t format) {
-    return format ? 2 : 1;
+// Quotient of significands with their leading ones at bit mant, as dividend * 2^(mant + 3) / divisor truncated to its
+// leading one at bit mant + 2 or mant + 3, with the exact remainder folded into bit 0 as the sticky bit. No integer
+// division, so that loops over it vectorize: the quotient comes from the divisor's reciprocal, a lower bound, and is
+// at most two short; the remainder then both corrects it and gives the sticky bit. The quotient has mant + 4 bits at
+// most, which one Newton step covers up to mant = 10 and two up to mant = 23. Wider formats keep the 128-bit
+// division, which is no slower than the multiplications that would replace it and does not vectorize either.
+static ALWAYS_INLINE uint64_t divide_significands(uint32_t mant, uint64_t dividend, uint64_t divisor) {
+    if (mant > 23) {
+        uint64_t remainder;
+        uint64_t quotient = divide_wide(dividend >> (61 - mant), dividend << (mant + 3), divisor, &remainder);
+        return quotient | (remainder != 0);
+    }
+    uint64_t quotient = dividend * reciprocal_bits(divisor << (31 - mant), mant <= 10 ? 1 : 2) >> 29;
+    uint64_t remainder = (dividend << (mant + 3)) - quotient * divisor;
+    for (int step = 0; step < 2; ++step) {
+        uint64_t short_by_one = remainder >= divisor;
+        quotient += short_by_one;
+        remainder -= divisor & -short_by_one;
+    }
+    return quotient | (remainder != 0);
 }
 
-uint8_t digits_to_print(uint8_t format) {
-    return format ? 3 : 6;
+// A signaling NaN operand raises invalid. Its quiet bit, the top one of the fraction, is clear; formats without
+// infinities have a single NaN, which counts as quiet.
+static ALWAYS_INLINE uint8_t signaling_flags(Number num) {
+    return num.type == NAN && !(num.mantissa & implicit_bit(num.format) >> 1) ? EXCEPTION_INVALID : 0;
 }
 
-Number add(uint8_t rounding, Number num1, Number num2) {
+// add, multiply and divide test once for two finite non-zero operands, subnormal ones included since unpacking
+// normalizes them, and leave zeros, infinities and NaNs to these out of line.
+static COLD Number add_special(uint8_t rounding, Number num1, Number num2) {
     Number result;
     result.format = num1.format;
-    result.type = OK;
+    result.sign = num1.sign;
+    result.flags = signaling_flags(num1) | signaling_flags(num2);
     if (num1.type == NAN || num2.type == NAN) {
         result.type = NAN;
     } else if (num1.type == INF || num2.type == INF) {
         if (num1.type == INF && num2.type == INF && num1.sign != num2.sign) {
             result.type = NAN;
+            result.flags = EXCEPTION_INVALID;
         } else {
             result.type = INF;
             result.sign = num1.type == INF ? num1.sign : num2.sign;
         }
-    } else if (num1.type == ZERO || num2.type == ZERO) {
-        result = num1.type == ZERO ? num2 : num1;
-    } else if (num1.exponent == num2.exponent && num1.mantissa == num2.mantissa && num1.sign != num2.sign) {
+    } else if (num1.type == ZERO && num2.type == ZERO) {
         result.type = ZERO;
+        result.sign = num1.sign == num2.sign ? num1.sign : rounding == TOWARD_NEG_INF;
     } else {
-        num1.mantissa += implicit_bit(result.format);
-        num2.mantissa += implicit_bit(result.format);
-        if (num1.exponent < num2.exponent) {
-            Number tmp = num1;
-            num1 = num2;
-            num2 = tmp;
-        }
-        result.sign = num1.sign;
-        result.exponent = num1.exponent;
-        while (num1.exponent > num2.exponent) {
-            num1.mantissa <<= 1;
-            ++num2.exponent;
-        }
-        result.mantissa = num1.sign ^ num2.sign ? num1.mantissa - num2.mantissa : num1.mantissa + num2.mantissa;
-        normalize(most_significant_bit(num1.mantissa), &result);
+        // the other operand, exactly
+        result = num1.type == ZERO ? num2 : num1;
+        result.flags = 0;
+        return result;
     }
     round_number(rounding, &result);
     return result;
 }
 
-Number subtract(uint8_t rounding, Number num1, Number num2) {
+static COLD Number multiply_special(uint8_t rounding, Number num1, Number num2) {
     Number result;
     result.format = num1.format;
-    result.type = OK;
+    result.sign = num1.sign ^ num2.sign;
+    result.flags = signaling_flags(num1) | signaling_flags(num2);
     if (num1.type == NAN || num2.type == NAN) {
         result.type = NAN;
     } else if (num1.type == INF || num2.type == INF) {
-        if (num1.type == INF && num2.type == INF && num1.sign == num2.sign) {
-            result.type = NAN;
-        } else {
-            result.type = INF;
-            result.sign = num1.type == INF ? num1.sign : !num2.sign;
-        }
-    } else if (num1.type == ZERO || num2.type == ZERO) {
-        result = num1.type == ZERO ? num2 : num1;
-    } else if (num1.exponent == num2.exponent && num1.mantissa == num2.mantissa && num1.sign == num2.sign) {
-        result.type = ZERO;
+        result.type = num1.type == ZERO || num2.type == ZERO ? NAN : INF;
+        result.flags = result.type == NAN ? EXCEPTION_INVALID : 0;
     } else {
-        num1.mantissa += implicit_bit(result.format);
-        num2.mantissa += implicit_bit(result.format);
-        if (num1.exponent < num2.exponent) {
-            Number tmp = num1;
-            num1 = num2;
-            num2 = tmp;
-        }
-        result.exponent = num1.exponent;
-        while (num1.exponent > num2.exponent) {
-            num1.mantissa <<= 1;
-            ++num2.exponent;
-        }
-        result.mantissa = num1.sign ^ num2.sign ? num1.mantissa + num2.mantissa : num1.mantissa - num2.mantissa;
-        normalize(most_significant_bit(num1.mantissa), &result);
+        result.type = ZERO;
     }
     round_number(rounding, &result);
     return result;
 }
 
-Number multiply(uint8_t rounding, Number num1, Number num2) {
+static COLD Number divide_special(uint8_t rounding, Number num1, Number num2) {
     Number result;
     result.format = num1.format;
-    result.type = OK;
     result.sign = num1.sign ^ num2.sign;
+    result.flags = signaling_flags(num1) | signaling_flags(num2);
     if (num1.type == NAN || num2.type == NAN) {
         result.type = NAN;
     } else if (num1.type == INF || num2.type == INF) {
-        if (num1.type == ZERO || num2.type == ZERO) {
+        if ((num1.type == INF) && (num2.type == INF)) {
             result.type = NAN;
+            result.flags = EXCEPTION_INVALID;
         } else {
-            result.type = INF;
+            result.type = num1.type == INF ? INF : ZERO;
         }
-    } else if (num1.type == ZERO || num2.type == ZERO) {
+    } else if (num1.type == ZERO && num2.type == ZERO) {
+        result.type = NAN;
+        result.flags = EXCEPTION_INVALID;
+    } else {
+        result.type = num1.type == ZERO ? ZERO : INF;
+        result.flags = num1.type == ZERO ? 0 : EXCEPTION_DIVIDE_BY_ZERO;
+    }
+    round_number(rounding, &result);
+    return result;
+}
+
+// The operations below keep the significand with its leading one at bit 62 until round_number; bits shifted out
+// while aligning are folded into bit 0 so that rounding still sees them.
+Number add(uint8_t rounding, Number num1, Number num2) {
+    if (num1.type != OK || num2.type != OK) {
+        return add_special(rounding, num1, num2);
+    }
+    Number result;
+    result.format = num1.format;
+    result.type = OK;
+    result.flags = 0;
+    uint8_t mant = mant_size(result.format);
+    // one bit of headroom below bit 62 for the carry of the sum
+    uint64_t mantissa1 = (num1.mantissa | implicit_bit(result.format)) << (61 - mant);
+    uint64_t mantissa2 = (num2.mantissa | implicit_bit(result.format)) << (61 - mant);
+    if (num1.exponent < num2.exponent || (num1.exponent == num2.exponent && mantissa1 < mantissa2)) {
+        Number tmp = num1;
+        num1 = num2;
+        num2 = tmp;
+        uint64_t tmp_mantissa = mantissa1;
+        mantissa1 = mantissa2;
+        mantissa2 = tmp_mantissa;
+    }
+    result.sign = num1.sign;
+    result.exponent = num1.exponent + 1;
+    mantissa2 = shift_right_sticky(mantissa2, num1.exponent - num2.exponent);
+    result.mantissa = num1.sign ^ num2.sign ? mantissa1 - mantissa2 : mantissa1 + mantissa2;
+    if (!result.mantissa) {
         result.type = ZERO;
+        result.sign = rounding == TOWARD_NEG_INF;
+        return result;
+    }
+    normalize(&result);
+    round_number(rounding, &result);
+    return result;
+}
+
+Number subtract(uint8_t rounding, Number num1, Number num2) {
+    num2.sign = !num2.sign;
+    return add(rounding, num1, num2);
+}
+
+Number multiply(uint8_t rounding, Number num1, Number num2) {
+    if (num1.type != OK || num2.type != OK) {
+        return multiply_special(rounding, num1, num2);
+    }
+    Number result;
+    result.format = num1.format;
+    result.type = OK;
+    result.flags = 0;
+    result.sign = num1.sign ^ num2.sign;
+    uint8_t mant = mant_size(result.format);
+    uint64_t mantissa1 = num1.mantissa | implicit_bit(result.format);
+    uint64_t mantissa2 = num2.mantissa | implicit_bit(result.format);
+    if (mant <= 30) {
+        // at most 2 * (mant + 1) bits, so the product is exact
+        result.mantissa = mantissa1 * mantissa2;
+        result.exponent = num1.exponent + num2.exponent - exp_offset(result.format) - 2 * mant + 62;
     } else {
-        num1.mantissa += implicit_bit(result.format);
-        num2.mantissa += implicit_bit(result.format);
-        shift_to_right(&num1.mantissa);
-        shift_to_right(&num2.mantissa);
-        result.exponent = num1.exponent + num2.exponent - exp_offset(result.format);
-        result.mantissa = num1.mantissa * num2.mantissa;
-        normalize(most_significant_bit(num1.mantissa) + most_significant_bit(num2.mantissa) - 1, &result);
+        // leading ones at bits 63 and 62 put the product's at bit 61 or 62 of the high half; the low half is sticky
+        uint64_t low;
+        result.mantissa = multiply_wide(mantissa1 << (63 - mant), mantissa2 << (62 - mant), &low) | (low != 0);
+        result.exponent = num1.exponent + num2.exponent - exp_offset(result.format) + 1;
     }
+    normalize(&result);
     round_number(rounding, &result);
     return result;
 }
 
 Number divide(uint8_t rounding, Number num1, Number num2) {
+    if (num1.type != OK || num2.type != OK) {
+        return divide_special(rounding, num1, num2);
+    }
     Number result;
     result.format = num1.format;
     result.type = OK;
+    result.flags = 0;
     result.sign = num1.sign ^ num2.sign;
-    if (num1.type == NAN || num2.type == NAN) {
+    uint8_t mant = mant_size(result.format);
+    result.mantissa = divide_significands(mant, num1.mantissa | implicit_bit(result.format),
+                                          num2.mantissa | implicit_bit(result.format));
+    result.exponent = num1.exponent - num2.exponent + exp_offset(result.format) + 59 - mant;
+    normalize(&result);
+    round_number(rounding, &result);
+    return result;
+}
+
+// a * b + c with a single rounding. The product is exact in 128 bits, and so is the addend aligned to it unless it
+// is far enough below that only its sticky bit matters.
+Number fused_multiply_add(uint8_t rounding, Number num1, Number num2, Number num3) {
+    Number result;
+    result.format = num1.format;
+    result.type = OK;
+    bool product_sign = num1.sign ^ num2.sign;
+    result.sign = product_sign;
+    result.flags = signaling_flags(num1) | signaling_flags(num2) | signaling_flags(num3);
+    bool product_inf = num1.type == INF || num2.type == INF;
+    bool product_zero = num1.type == ZERO || num2.type == ZERO;
+    if (num1.type == NAN || num2.type == NAN || num3.type == NAN || (product_inf && product_zero)) {
         result.type = NAN;
-    } else if (num1.type == INF || num2.type == INF) {
-        if ((num1.type == INF) && (num2.type == INF)) {
-            result.type = NAN;
+        // whether inf * 0 with a quiet NaN addend is invalid is left to implementations; on x86 it is not
+        result.flags |= product_inf && product_zero && num3.type != NAN ? EXCEPTION_INVALID : 0;
+    } else if (product_inf) {
+        result.type = num3.type == INF && num3.sign != product_sign ? NAN : INF;
+        result.flags = result.type == NAN ? EXCEPTION_INVALID : 0;
+    } else if (num3.type == INF || (product_zero && num3.type != ZERO)) {
+        num3.flags = 0;
+        return num3;
+    } else if (product_zero) {
+        result.type = ZERO;
+        result.sign = product_sign == num3.sign ? product_sign : rounding == TOWARD_NEG_INF;
+    } else if (num3.type == ZERO) {
+        return multiply(rounding, num1, num2);
+    } else {
+        uint8_t mant = mant_size(result.format);
+        // both have their leading ones at bit 124 or 125 of 128, leaving room for the carry of the sum
+        uint64_t product_low, addend_low = 0;
+        uint64_t product_high = multiply_wide((num1.mantissa | implicit_bit(result.format)) << (62 - mant),
+                                              (num2.mantissa | implicit_bit(result.format)) << (62 - mant), &product_low);
+        uint64_t addend_high = (num3.mantissa | implicit_bit(result.format)) << (60 - mant);
+        int32_t product_exponent = num1.exponent + num2.exponent - exp_offset(result.format);
+        int32_t exponent;
+        if (product_exponent >= num3.exponent) {
+            exponent = product_exponent;
+            shift_right_sticky_wide(&addend_high, &addend_low, product_exponent - num3.exponent);
         } else {
-            result.type = num1.type == INF ? INF : ZERO;
+            exponent = num3.exponent;
+            shift_right_sticky_wide(&product_high, &product_low, num3.exponent - product_exponent);
         }
-    } else if (num1.type == ZERO || num2.type == ZERO) {
-        if (num1.type == ZERO && num2.type == ZERO) {
-            result.type = NAN;
+        uint64_t high, low;
+        if (product_sign == num3.sign) {
+            low = product_low + addend_low;
+            high = product_high + addend_high + (low < product_low);
         } else {
-            result.type = num1.type == ZERO ? ZERO : 2;
+            low = product_low - addend_low;
+            high = product_high - addend_high - (product_low < addend_low);
+            if (high >> 63) {
+                // the addend was larger: both were exact then, so negating is too
+                low = -low;
+                high = ~high + (low == 0);
+                result.sign = num3.sign;
+            }
         }
-    } else {
-        num1.mantissa += implicit_bit(result.format);
-        num2.mantissa += implicit_bit(result.format);
-        shift_to_right(&num1.mantissa);
-        shift_to_right(&num2.mantissa);
-        result.exponent = num1.exponent - num2.exponent + exp_offset(result.format);
-        result.mantissa = num1.mantissa / num2.mantissa;
-        result.mantissa <<= mant_size(result.format) - most_significant_bit(result.mantissa) + 1;
+        if (!(high | low)) {
+            result.type = ZERO;
+            result.sign = rounding == TOWARD_NEG_INF;
+            return result;
+        }
+        // bring the leading one to bit 62 of the high word; below it the low word only adds its sticky bit
+        int32_t shift = (high ? count_leading_zeros(high) : 64 + count_leading_zeros(low)) - 1;
+        if (shift >= 64) {
+            high = low << (shift - 64);
+            low = 0;
+        } else if (shift > 0) {
+            high = high << shift | low >> (64 - shift);
+            low <<= shift;
+        }
+        result.mantissa = high | (low != 0);
+        result.exponent = (int16_t) (exponent - shift + 2);
     }
     round_number(rounding, &result);
     return result;
 }
 
-uint8_t normalize(uint8_t mantissa, Number *num) {
-    if (num->mantissa) {
-        while (most_significant_bit(num->mantissa) > mantissa) {
-            ++num->exponent;
-            num->mantissa >>= 1;
-        }
-        if (!num->exponent && num->mantissa) {
-            while (!(num->mantissa & (implicit_bit(num->format))) && (num->mantissa & mant_mask(num->format))) {
-                --num->exponent;
-                num->mantissa <<= 1;
-            }
-            num->mantissa &= mant_mask(num->format);
-            ++num->exponent;
+Number square_root(uint8_t rounding, Number num) {
+    Number result = num;
+    result.flags = signaling_flags(num);
+    if (num.type == NAN || (num.sign && num.type != ZERO)) {
+        result.type = NAN;
+        result.flags |= num.type != NAN ? EXCEPTION_INVALID : 0;
+    } else if (num.type == OK) {
+        uint8_t mant = mant_size(num.format);
+        int32_t exponent = num.exponent - exp_offset(num.format);
+        // an odd exponent leaves a factor of two for the significand, so that the rest halves exactly
+        bool odd = exponent & 1;
+        uint64_t significand = num.mantissa | implicit_bit(num.format);
+        uint64_t remainder;
+        if (mant <= 30) {
+            // a radicand of 2 * mant + 3 or 4 bits gives a guard bit below the significand; the remainder is sticky
+            result.mantissa = isqrt(significand << (mant + 2 + odd), &remainder) << (61 - mant);
+        } else {
+            // radicand in [2^124, 2^126): the root has its leading one at bit 62
+            result.mantissa = isqrt_wide(significand << (60 - mant + odd), 0, &remainder);
         }
+        result.mantissa |= remainder != 0;
+        result.exponent = (int16_t) ((exponent - odd) / 2 + exp_offset(num.format));
+        round_number(rounding, &result);
     }
-    if (!(num->exponent ^ exp_mask(num->format))) {
-        return num->mantissa ? 3 : 2;
+    return result;
+}
+
+Number apply_operation(uint8_t rounding, char operation, const Number *operands) {
+    switch (operation) {
+        case '+':
+            return add(rounding, operands[0], operands[1]);
+        case '-':
+            return subtract(rounding, operands[0], operands[1]);
+        case '*':
+            return multiply(rounding, operands[0], operands[1]);
+        case OPERATION_FMA:
+            return fused_multiply_add(rounding, operands[0], operands[1], operands[2]);
+        case OPERATION_SQRT:
+            return square_root(rounding, operands[0]);
+        default:
+            return divide(rounding, operands[0], operands[1]);
     }
-    return num->exponent ? 1 : 0;
 }
 
-void round_number(uint8_t rounding, Number *num) {
-    if (num->type == 0 && rounding == TOWARD_NEG_INF) {
-        *num = to_IEEE754_standard(num->format, 0);
-        num->sign = 1;
-    }
-    uint64_t GSR;
-    uint64_t shift = most_significant_bit(num->mantissa) - mant_size(num->format);
-    uint64_t gen_inf_shift =
-            num->mantissa << (sizeof(num->mantissa) * 8 - most_significant_bit(num->mantissa) + mant_size(num->format));
-    if (num->type == 1) {
-        switch (rounding) {
-            case TOWARD_ZERO:     // К нулю
-                num->mantissa >>= shift - 1;
-                break;
-            case TOWARD_NEAREST_EVEN:     // К ближайшему чётному
-                GSR = num->mantissa & (~(mant_mask(num->format) << (shift)));
-                if ((GSR & (1 << (shift - 2))) && ((GSR & (1 << (shift - 1))) || (GSR & (~(3 << (shift - 2)))))) {
-                    num->mantissa >>= shift - 1;
-                    ++num->mantissa;
-                    normalize(mant_mask(num->format), num);
-                } else {
-                    num->mantissa >>= shift - 1;
-                }
-                break;
-            case TOWARD_POS_INF:    // К +бесконечности
-                if (gen_inf_shift + 1) {
-                    num->mantissa >>= shift - 1;
-                    if (!num->sign) {
-                        ++num->mantissa;
-                        normalize(mant_mask(num->format), num);
-                    }
-                }
-                break;
-            case TOWARD_NEG_INF:    // К -бесконечности
-                if (gen_inf_shift + 1) {
-                    num->mantissa >>= shift - 1;
-                    if (num->sign) {
-                        ++num->mantissa;
-                        normalize(mant_mask(num->format), num);
-                    }
-                }
-                break;
-            default:
-                break;
-        }
-        num->mantissa -= implicit_bit(num->format);
+void normalize(Number *num) {
+    uint8_t shift = count_leading_zeros(num->mantissa) - 1;
+    num->mantissa <<= shift;
+    num->exponent -= shift;
+}
+
+// Whether rounding away the bits rest below kept, where half is the weight of the highest of them, increments kept.
+static ALWAYS_INLINE bool rounds_up(uint8_t rounding, bool sign, uint64_t kept, uint64_t rest, uint64_t half) {
+    switch (rounding) {
+        case TOWARD_ZERO:     // К нулю
+            return false;
+        case TOWARD_NEAREST_EVEN:     // К ближайшему чётному
+            return rest > half || (rest == half && (kept & 1));
+        case TOWARD_POS_INF:    // К +бесконечности
+            return rest && !sign;
+        case TOWARD_NEG_INF:    // К -бесконечности
+            return rest && sign;
+        default:
+            return false;
     }
 }
 
-uint8_t most_significant_bit(uint64_t value) {
-    uint8_t bit = 1;
-    while (value >>= 1)
-        ++bit;
-    return bit;
+// Rounds a number from the operations above and adds the exceptions rounding raises to its flags: inexact, overflow,
+// and underflow for inexact results that are tiny. Tininess is detected after rounding, as on x86: a value just below
+// the smallest normal number is not tiny if rounding it to full precision would reach that number.
+void round_number(uint8_t rounding, Number *num) {
+    if (num->type == INF && !has_inf(num->format)) {
+        num->type = NAN;
+    }
+    if (num->type != OK) {
+        return;
+    }
+    uint8_t mant = mant_size(num->format);
+    // below the smallest exponent the value is subnormal and loses low bits before rounding
+    int32_t denormal_shift = num->exponent < 1 ? 1 - num->exponent : 0;
+    uint64_t mantissa = shift_right_sticky(num->mantissa, denormal_shift);
+    int32_t exp = num->exponent + denormal_shift;
+    uint8_t drop = 62 - mant;
+    uint64_t rest = mantissa & ((UINT64_C(1) << drop) - 1);
+    uint64_t half = UINT64_C(1) << (drop - 1);
+    mantissa >>= drop;
+    bool tiny = num->exponent < 1;
+    if (num->exponent == 0) {
+        uint64_t full = num->mantissa >> drop;
+        tiny = full != (implicit_bit(num->format) << 1) - 1 ||
+               !rounds_up(rounding, num->sign, full, num->mantissa & ((UINT64_C(1) << drop) - 1), half);
+    }
+    if (rest) {
+        num->flags |= tiny ? EXCEPTION_INEXACT | EXCEPTION_UNDERFLOW : EXCEPTION_INEXACT;
+    }
+    mantissa += rounds_up(rounding, num->sign, mantissa, rest, half);
+    // a carry out of the significand is a power of two, so the shift back loses nothing
+    if (mantissa >> (mant + 1)) {
+        mantissa >>= 1;
+        ++exp;
+    }
+    uint64_t max_finite = overflow_bits(num->format) - 1;
+    int32_t max_exp = (int32_t) (max_finite >> mant);
+    uint64_t max_fraction = max_finite & mant_mask(num->format);
+    if (exp > max_exp || (exp == max_exp && (mantissa & mant_mask(num->format)) > max_fraction)) {
+        bool to_inf = rounding == TOWARD_NEAREST_EVEN || (rounding == TOWARD_POS_INF && !num->sign) ||
+                      (rounding == TOWARD_NEG_INF && num->sign);
+        num->flags |= EXCEPTION_OVERFLOW | EXCEPTION_INEXACT;
+        if (to_inf) {
+            num->type = has_inf(num->format) ? INF : NAN;
+            return;
+        }
+        exp = max_exp;
+        mantissa = implicit_bit(num->format) | max_fraction;
+    }
+    if (!mantissa) {
+        num->type = ZERO;
+        return;
+    }
+    // subnormal results are printed normalized as well
+    uint8_t shift = count_leading_zeros(mantissa) - (63 - mant);
+    num->mantissa = (mantissa << shift) & mant_mask(num->format);
+    num->exponent = (int16_t) (exp - shift);
 }
 
-void shift_to_right(uint64_t *mantissa) {
-    while (!(*mantissa & 1) && *mantissa) {
-        *mantissa >>= 1;
+uint64_t shift_right_sticky(uint64_t value, int32_t shift) {
+    if (shift > 63) {
+        shift = 63;
     }
+    return value >> shift | ((value & ((UINT64_C(1) << shift) - 1)) != 0);
 }
 
-void print_result(Number num) {
-    if (num.type != NAN && num.sign) {
-        printf("-");
+// shift_right_sticky for the 128-bit value high:low.
+void shift_right_sticky_wide(uint64_t *high, uint64_t *low, int32_t shift) {
+    if (shift > 127) {
+        shift = 127;
     }
-    switch (num.type) {
-        case ZERO:
-            printf("0x0.%0*dp+0\n", digits_to_print(num.format), 0);
-            break;
-        case OK:
-            printf("0x1.%0*" PRIx64 "p%+" PRIi16 "\n",
-                   digits_to_print(num.format),
-                   num.mantissa << mant_gap_to_print(num.format),
-                   num.exponent - exp_offset(num.format));
-            break;
-        case INF:
-            printf("inf\n");
-            break;
-        case NAN:
-            printf("nan\n");
-            break;
-        default:
-            break;
+    if (shift >= 64) {
+        uint64_t sticky = *low != 0 || (*high & ((UINT64_C(1) << (shift - 64)) - 1)) != 0;
+        *low = *high >> (shift - 64) | sticky;
+        *high = 0;
+    } else if (shift > 0) {
+        uint64_t sticky = (*low & ((UINT64_C(1) << shift) - 1)) != 0;
+        *low = (*low >> shift | *high << (64 - shift)) | sticky;
+        *high >>= shift;
     }
 }
 
-int main(int argc, char *argv[]) {
-    char format = '\0', operation = '\0';
-    uint8_t rounding = TOWARD_ZERO;
-    uint32_t number1 = 0, number2 = 0;
+uint8_t count_leading_zeros(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (uint8_t) __builtin_clzll(value);
+#elif defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return (uint8_t) (63 - index);
+#else
+    uint8_t zeros = 0;
+    for (uint64_t bit = UINT64_C(1) << 63; !(value & bit); bit >>= 1)
+        ++zeros;
+    return zeros;
+#endif
+}
 
-    switch (argc) {
-        case 6:
-            if (sscanf(argv[4], "%c", &operation) + sscanf(argv[5], "%" SCNx32, &number2) < 2) {
-                fprintf(stderr, "Error: invalid input format\n");
-                return ERROR_DATA_INVALID;
-            }
-            if (operation != '+' && operation != '-' && operation != '*' && operation != '/') {
-                fprintf(stderr, "Error: Unsupported operation: %c\n", operation);
-                return ERROR_ARGUMENTS_INVALID;
-            }
-        case 4:
-            if (sscanf(argv[1], "%c", &format) + sscanf(argv[2], "%hhu", &rounding) +
-                sscanf(argv[3], "%" SCNx32, &number1) < 3) {
-                fprintf(stderr, "Error: invalid datatype\n");
-                return ERROR_DATA_INVALID;
-            }
-            if (format != 'h' && format != 'f') {
-                fprintf(stderr, "Error: Unsupported data format: %c\n", format);
-                return ERROR_ARGUMENTS_INVALID;
-            }
-            if (rounding > TOWARD_NEG_INF) {
-                fprintf(stderr, "Error: Unsupported rounding type: %hhd\n", rounding);
-                return ERROR_ARGUMENTS_INVALID;
-            }
-            break;
-        default:
-            fprintf(stderr, "Error: Invalid input format\n");
-            return ERROR_ARGUMENTS_INVALID;
+uint64_t multiply_wide(uint64_t a, uint64_t b, uint64_t *low) {
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 product = (unsigned __int128) a * b;
+    *low = (uint64_t) product;
+    return (uint64_t) (product >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    uint64_t high;
+    *low = _umul128(a, b, &high);
+    return high;
+#else
+    uint64_t a_low = a & UINT32_MAX, a_high = a >> 32, b_low = b & UINT32_MAX, b_high = b >> 32;
+    uint64_t cross1 = a_high * b_low, cross2 = a_low * b_high, bottom = a_low * b_low;
+    uint64_t middle = (bottom >> 32) + (cross1 & UINT32_MAX) + (cross2 & UINT32_MAX);
+    *low = (middle << 32) | (bottom & UINT32_MAX);
+    return a_high * b_high + (cross1 >> 32) + (cross2 >> 32) + (middle >> 32);
+#endif
+}
+
+// Divides the 128-bit value high:low by divisor; high < divisor, so the quotient fits 64 bits.
+uint64_t divide_wide(uint64_t high, uint64_t low, uint64_t divisor, uint64_t *remainder) {
+#if defined(__SIZEOF_INT128__)
+    uint64_t quotient = (uint64_t) (((unsigned __int128) high << 64 | low) / divisor);
+    *remainder = low - quotient * divisor;
+    return quotient;
+#elif defined(_MSC_VER) && defined(_M_X64) && _MSC_VER >= 1920
+    return _udiv128(high, low, divisor, remainder);
+#else
+    uint64_t quotient = 0;
+    for (int bit = 0; bit < 64; ++bit) {
+        bool carry = high >> 63;
+        high = high << 1 | low >> 63;
+        low <<= 1;
+        quotient <<= 1;
+        if (carry || high >= divisor) {
+            high -= divisor;
+            quotient |= 1;
+        }
     }
+    *remainder = high;
+    return quotient;
+#endif
+}
 
-    Number num = to_IEEE754_standard(format, number1);
-    if (argc == 6) {
-        Number num2 = to_IEEE754_standard(format, number2);
-        switch (operation) {
-            case '+':
-                num = add(rounding, num, num2);
-                break;
-            case '-':
-                num = subtract(rounding, num, num2);
+// Square root rounded down, one bit per step from the top bit of value down; *remainder is value - root^2.
+uint64_t isqrt(uint64_t value, uint64_t *remainder) {
+    uint64_t root = 0;
+    for (uint64_t bit = UINT64_C(1) << ((63 - count_leading_zeros(value | 1)) & ~1); bit; bit >>= 2) {
+        // the outcome of every step is a coin flip, so it is masked in rather than branched on
+        uint64_t fits = -(uint64_t) (value >= root + bit);
+        value -= (root + bit) & fits;
+        root = root >> 1 | (bit & fits);
+    }
+    *remainder = value;
+    return root;
+}
+
+// Square root of the 128-bit value high:low, rounded down, for 2^60 <= high < 2^62. The root of the high word is off
+// by less than 2^32; two Newton steps from above leave the result at most one too large.
+uint64_t isqrt_wide(uint64_t high, uint64_t low, uint64_t *remainder) {
+    uint64_t root = (isqrt(high, remainder) + 1) << 32;
+    for (int step = 0; step < 2; ++step) {
+        root = (root + divide_wide(high, low, root, remainder)) >> 1;
+    }
+    uint64_t square_low;
+    uint64_t square_high = multiply_wide(root, root, &square_low);
+    if (square_high > high || (square_high == high && square_low > low)) {
+        --root;
+        square_low -= 2 * root + 1;
+    }
+    // below 2 * root + 1, so the low words alone hold it
+    *remainder = low - square_low;
+    return root;
+}
+
+// Mask-based select: the kernels below must not branch on their data.
+static ALWAYS_INLINE uint64_t select_bits(bool condition, uint64_t if_true, uint64_t if_false) {
+    uint64_t mask = -(uint64_t) condition;
+    return (if_true & mask) | (if_false & ~mask);
+}
+
+// Significand with the implicit bit of a finite bit pattern; subnormals get exponent 1 and no implicit bit.
+static ALWAYS_INLINE uint64_t unpack_bits(uint8_t format, uint64_t bits, int32_t *exponent) {
+    int32_t biased = (int32_t) (bits >> mant_size(format) & exp_mask(format));
+    *exponent = biased + !biased;
+    return (bits & mant_mask(format)) | select_bits(biased != 0, implicit_bit(format), 0);
+}
+
+// Infinity with the given sign, or NaN for formats without infinities.
+static ALWAYS_INLINE uint64_t infinity_result(uint8_t format, uint64_t sign) {
+    return has_inf(format) ? sign << sign_shift(format) | inf_bits(format) : quiet_nan_bits(format);
+}
+
+// Whether a signaling NaN, as in signaling_flags.
+static ALWAYS_INLINE bool signaling_bits(uint8_t format, uint64_t bits) {
+    return ((bits & abs_mask(format)) >= nan_bits(format)) & !(bits & implicit_bit(format) >> 1);
+}
+
+// What round_pack_bits adds to the bits below the rounding position, see there.
+static ALWAYS_INLINE uint64_t rounding_increment(uint8_t rounding, uint64_t sign, uint64_t kept, uint64_t below) {
+    if (rounding == TOWARD_NEAREST_EVEN)
+        return (below >> 1) + (kept & 1);
+    if (rounding == TOWARD_POS_INF)
+        return below & (sign - 1);
+    if (rounding == TOWARD_NEG_INF)
+        return below & -sign;
+    return 0;
+}
+
+// Rounds significand * 2^(exponent - bias - 62) and packs it with the sign. significand < 2^63 has its leading one
+// at bit 62 unless the value is subnormal; bits below the rounding position only need to be non-zero when inexact.
+// flags receives the exceptions rounding raises, detected as by round_number; where no one reads them, the compiler
+// drops their computation.
+static ALWAYS_INLINE uint64_t round_pack_bits(uint8_t format, uint8_t rounding, uint64_t sign, int32_t exponent, uint64_t significand, uint8_t *flags) {
+    uint32_t mant = mant_size(format);
+    uint64_t overflow = overflow_bits(format);
+    uint32_t drop = 62 - mant;
+    uint64_t below = (UINT64_C(1) << drop) - 1;
+    // tiny after rounding: below the smallest normal number, unless just below it and rounding to full precision
+    // reaches it. Flags are built from masks like the rest, which keeps the loops over them vectorizable.
+    uint64_t full = significand >> drop;
+    uint64_t carry = ((significand & below) + rounding_increment(rounding, sign, full, below)) >> drop;
+    uint64_t reaches_normal = select_bits(exponent == 0, select_bits(full == (implicit_bit(format) << 1) - 1, carry, 0), 0);
+    uint64_t underflow = select_bits(exponent < 1, EXCEPTION_UNDERFLOW, 0) & (reaches_normal - 1);
+    int32_t shift = (int32_t) select_bits(exponent < 1, (uint64_t) (1 - exponent), 0);
+    shift = (int32_t) select_bits(shift > 63, 63, shift);
+    uint64_t lost = significand - (significand >> shift << shift);
+    significand = significand >> shift | (lost != 0);
+    exponent = (int32_t) select_bits(exponent < 1, 1, (uint64_t) exponent);
+    if (sign_shift(format) > 32) {
+        // anything past the largest exponent overflows alike; the clamp keeps the packed bits from wrapping
+        int32_t max_exponent = (int32_t) (overflow >> mant) + 1;
+        exponent = (int32_t) select_bits(exponent > max_exponent, (uint64_t) max_exponent, (uint64_t) exponent);
+    }
+
+    uint64_t kept = significand >> drop;
+    uint64_t rest = significand & below;
+    // rounding up is a carry out of the dropped bits once this is added to them: just short of the half-way point
+    // plus the lowest kept bit for ties to even, all ones in the direction the mode rounds away from zero
+    uint64_t up = (rest + rounding_increment(rounding, sign, kept, below)) >> drop;
+    // the implicit bit carries into the exponent field, a rounding carry out of the significand as well
+    uint64_t bits = ((uint64_t) (exponent - 1) << mant) + kept + up;
+    // all ones when overflow goes to infinity rather than to the largest finite number
+    uint64_t to_inf = 0;
+    if (rounding == TOWARD_NEAREST_EVEN)
+        to_inf = ~UINT64_C(0);
+    else if (rounding == TOWARD_POS_INF)
+        to_inf = sign - 1;
+    else if (rounding == TOWARD_NEG_INF)
+        to_inf = -sign;
+    uint64_t limit = (infinity_result(format, sign) & to_inf) | ((sign << sign_shift(format) | (overflow - 1)) & ~to_inf);
+    *flags = (uint8_t) (select_bits(rest != 0, EXCEPTION_INEXACT | underflow, 0) |
+                        select_bits(bits >= overflow, EXCEPTION_OVERFLOW | EXCEPTION_INEXACT, 0));
+    return select_bits(bits >= overflow, limit, sign << sign_shift(format) | bits);
+}
+
+// The operations below work on bit patterns and are branch-free, so that batches of independent lanes can be
+// evaluated back to back. Every NaN result is the canonical quiet NaN. flags receives the exceptions raised, those of
+// rounding or, where a special case overrides the result, its own.
+static ALWAYS_INLINE uint64_t add_bits(uint8_t format, uint8_t rounding, uint64_t a, uint64_t b, uint8_t *flags) {
+    uint32_t mant = mant_size(format);
+    uint64_t magnitude = abs_mask(format);
+    bool swap = (b & magnitude) > (a & magnitude);
+    uint64_t x = select_bits(swap, b, a);
+    uint64_t y = select_bits(swap, a, b);
+    uint64_t sign = x >> sign_shift(format);
+    bool opposite = (x ^ y) >> sign_shift(format);
+    int32_t exp_x, exp_y;
+    uint64_t sig_x = unpack_bits(format, x, &exp_x) << (61 - mant);
+    uint64_t sig_y = unpack_bits(format, y, &exp_y) << (61 - mant);
+    uint32_t gap = (uint32_t) select_bits(exp_x - exp_y > 63, 63, (uint64_t) (exp_x - exp_y));
+    uint64_t sticky = (sig_y & ((UINT64_C(1) << gap) - 1)) != 0;
+    sig_y = sig_y >> gap | sticky;
+    uint64_t sum = select_bits(opposite, sig_x - sig_y, sig_x + sig_y);
+    uint8_t zeros = count_leading_zeros(sum | 1);
+    uint64_t result = round_pack_bits(format, rounding, sign, exp_x + 2 - zeros, sum << (zeros - 1), flags);
+
+    // an exact zero sum raises nothing, which is what rounding it gives as well
+    uint64_t exact_zero = select_bits(opposite, rounding == TOWARD_NEG_INF, sign) << sign_shift(format);
+    result = select_bits(sum != 0, result, exact_zero);
+    bool infinite = (x & magnitude) == inf_bits(format);
+    result = select_bits(infinite, x, result);
+    // inf - inf: x is infinite whenever y is and neither is NaN
+    bool invalid = infinite & ((y & magnitude) == inf_bits(format)) & opposite;
+    bool nan = ((a & magnitude) >= nan_bits(format)) | ((b & magnitude) >= nan_bits(format)) | invalid;
+    invalid |= signaling_bits(format, a) | signaling_bits(format, b);
+    *flags = (uint8_t) select_bits(infinite | nan, select_bits(invalid, EXCEPTION_INVALID, 0), *flags);
+    return select_bits(nan, quiet_nan_bits(format), result);
+}
+
+static ALWAYS_INLINE uint64_t subtract_bits(uint8_t format, uint8_t rounding, uint64_t a, uint64_t b, uint8_t *flags) {
+    return add_bits(format, rounding, a, b ^ UINT64_C(1) << sign_shift(format), flags);
+}
+
+static ALWAYS_INLINE uint64_t multiply_bits(uint8_t format, uint8_t rounding, uint64_t a, uint64_t b, uint8_t *flags) {
+    uint32_t mant = mant_size(format);
+    uint64_t magnitude = abs_mask(format);
+    uint64_t sign = (a ^ b) >> sign_shift(format) & 1;
+    int32_t exp_a, exp_b;
+    uint64_t sig_a = unpack_bits(format, a, &exp_a);
+    uint64_t sig_b = unpack_bits(format, b, &exp_b);
+    int32_t exponent;
+    uint64_t significand;
+    if (mant <= 30) {
+        // both significands fit 32 bits, so the product is exact in 64
+        uint64_t product = sig_a * sig_b;
+        uint8_t zeros = count_leading_zeros(product | 1);
+        exponent = exp_a + exp_b - exp_offset(format) - 2 * (int32_t) mant + 63 - zeros;
+        significand = product << (zeros - 1);
+    } else {
+        // leading ones at bits 63 and 62 put the product's at bit 61 or 62 of the high half; the low half is sticky
+        uint8_t zeros_a = count_leading_zeros(sig_a | 1), zeros_b = count_leading_zeros(sig_b | 1);
+        uint64_t low;
+        uint64_t high = multiply_wide(sig_a << zeros_a, sig_b << (zeros_b - 1), &low) | (low != 0);
+        uint8_t zeros = count_leading_zeros(high | 1);
+        exponent = exp_a + exp_b - exp_offset(format) - 2 * (int32_t) mant + 128 - zeros_a - zeros_b - zeros;
+        significand = high << (zeros - 1);
+    }
+    uint64_t result = round_pack_bits(format, rounding, sign, exponent, significand, flags);
+
+    bool zero = !(a & magnitude) | !(b & magnitude);
+    bool infinite = ((a & magnitude) == inf_bits(format)) | ((b & magnitude) == inf_bits(format));
+    result = select_bits(zero, sign << sign_shift(format), result);
+    result = select_bits(infinite, infinity_result(format, sign), result);
+    bool nan = ((a & magnitude) >= nan_bits(format)) | ((b & magnitude) >= nan_bits(format)) | (zero & infinite);
+    bool invalid = (zero & infinite) | signaling_bits(format, a) | signaling_bits(format, b);
+    *flags = (uint8_t) select_bits(zero | infinite | nan, select_bits(invalid, EXCEPTION_INVALID, 0), *flags);
+    return select_bits(nan, quiet_nan_bits(format), result);
+}
+
+// Overrides the rounded quotient of a / b where either operand is zero, infinite or NaN, and the flags of its
+// rounding with those of the special case.
+static ALWAYS_INLINE uint64_t divide_special_bits(uint8_t format, uint64_t a, uint64_t b, uint64_t result, uint8_t *flags) {
+    uint64_t magnitude = abs_mask(format);
+    uint64_t sign = (a ^ b) >> sign_shift(format) & 1;
+    bool zero_a = !(a & magnitude), zero_b = !(b & magnitude);
+    bool inf_a = (a & magnitude) == inf_bits(format), inf_b = (b & magnitude) == inf_bits(format);
+    bool nan_a = (a & magnitude) >= nan_bits(format), nan_b = (b & magnitude) >= nan_bits(format);
+    result = select_bits(zero_a | inf_b, sign << sign_shift(format), result);
+    result = select_bits(inf_a | zero_b, infinity_result(format, sign), result);
+    bool invalid = (zero_a & zero_b) | (inf_a & inf_b);
+    bool nan = nan_a | nan_b | invalid;
+    invalid |= signaling_bits(format, a) | signaling_bits(format, b);
+    // only a finite non-zero dividend divides by zero
+    bool divide_by_zero = zero_b & !zero_a & !inf_a & !nan_a;
+    uint64_t special_flags = select_bits(invalid, EXCEPTION_INVALID, 0) | select_bits(divide_by_zero, EXCEPTION_DIVIDE_BY_ZERO, 0);
+    *flags = (uint8_t) select_bits(zero_a | zero_b | inf_a | inf_b | nan, special_flags, *flags);
+    return select_bits(nan, quiet_nan_bits(format), result);
+}
+
+static ALWAYS_INLINE uint64_t divide_bits(uint8_t format, uint8_t rounding, uint64_t a, uint64_t b, uint8_t *flags) {
+    uint32_t mant = mant_size(format);
+    uint64_t sign = (a ^ b) >> sign_shift(format) & 1;
+    int32_t exp_a, exp_b;
+    uint64_t sig_a = unpack_bits(format, a, &exp_a);
+    uint64_t sig_b = unpack_bits(format, b, &exp_b);
+    // zeros are replaced by the special cases below, 1 only keeps the arithmetic defined
+    sig_a |= sig_a == 0;
+    sig_b |= sig_b == 0;
+    // subnormal significands are brought up to the implicit bit
+    int32_t shift_a = count_leading_zeros(sig_a) - 63 + (int32_t) mant;
+    int32_t shift_b = count_leading_zeros(sig_b) - 63 + (int32_t) mant;
+    uint64_t quotient = divide_significands(mant, sig_a << shift_a, sig_b << shift_b);
+    uint8_t zeros = count_leading_zeros(quotient);
+    int32_t exponent = exp_a - exp_b - shift_a + shift_b + exp_offset(format) + 60 - (int32_t) mant - zeros;
+    uint64_t result = round_pack_bits(format, rounding, sign, exponent, quotient << (zeros - 1), flags);
+    return divide_special_bits(format, a, b, result, flags);
+}
+
+// Whether bits is a normal number: no zero, subnormal, infinity or NaN.
+static ALWAYS_INLINE bool is_normal_bits(uint8_t format, uint64_t bits) {
+    return (bits & abs_mask(format)) - implicit_bit(format) < overflow_bits(format) - implicit_bit(format);
+}
+
+// Significand with the implicit bit of a normal number, which needs neither the subnormal case of unpack_bits nor
+// normalizing: its leading one is always at bit mant.
+static ALWAYS_INLINE uint64_t unpack_normal_bits(uint8_t format, uint64_t bits, int32_t *exponent) {
+    *exponent = (int32_t) (bits >> mant_size(format) & exp_mask(format));
+    return (bits & mant_mask(format)) | implicit_bit(format);
+}
+
+// The kernels below are add_bits, multiply_bits and divide_bits for two normal operands, with nothing to override
+// afterwards; results may still be subnormal, zero or out of range, which round_pack_bits handles as usual. They are
+// written so that the compiler can vectorize them wherever the arithmetic allows: the sticky bit comes from a
+// subtraction instead of a mask built from the shift.
+static ALWAYS_INLINE uint64_t add_normal_bits(uint8_t format, uint8_t rounding, uint64_t a, uint64_t b, uint8_t *flags) {
+    uint32_t mant = mant_size(format);
+    uint64_t magnitude = abs_mask(format);
+    bool swap = (b & magnitude) > (a & magnitude);
+    uint64_t x = select_bits(swap, b, a);
+    uint64_t y = select_bits(swap, a, b);
+    uint64_t sign = x >> sign_shift(format);
+    uint64_t opposite = (x ^ y) >> sign_shift(format);
+    int32_t exp_x, exp_y;
+    uint64_t sig_x = unpack_normal_bits(format, x, &exp_x) << (61 - mant);
+    uint64_t sig_y = unpack_normal_bits(format, y, &exp_y) << (61 - mant);
+    uint32_t gap = (uint32_t) select_bits(exp_x - exp_y > 63, 63, (uint64_t) (exp_x - exp_y));
+    uint64_t lost = sig_y - (sig_y >> gap << gap);
+    sig_y = sig_y >> gap | (lost != 0);
+    uint64_t sum = sig_x + (sig_y ^ -opposite) + opposite;
+    uint8_t zeros = count_leading_zeros(sum | 1);
+    uint64_t result = round_pack_bits(format, rounding, sign, exp_x + 2 - zeros, sum << (zeros - 1), flags);
+    // only opposite signs cancel exactly
+    return select_bits(sum == 0, (uint64_t) (rounding == TOWARD_NEG_INF) << sign_shift(format), result);
+}
+
+static ALWAYS_INLINE uint64_t multiply_normal_bits(uint8_t format, uint8_t rounding, uint64_t a, uint64_t b, uint8_t *flags) {
+    uint32_t mant = mant_size(format);
+    uint64_t sign = (a ^ b) >> sign_shift(format) & 1;
+    int32_t exp_a, exp_b;
+    uint64_t sig_a = unpack_normal_bits(format, a, &exp_a);
+    uint64_t sig_b = unpack_normal_bits(format, b, &exp_b);
+    uint64_t product;
+    if (mant <= 30) {
+        product = sig_a * sig_b;
+    } else {
+        uint64_t low;
+        product = multiply_wide(sig_a << (63 - mant), sig_b << (62 - mant), &low) | (low != 0);
+    }
+    // the product's leading one is at bit 2 * mant or one above, or at bit 61 or 62 of the wide product's high half
+    uint8_t zeros = count_leading_zeros(product);
+    int32_t top = mant <= 30 ? 63 - 2 * (int32_t) mant : 2;
+    return round_pack_bits(format, rounding, sign, exp_a + exp_b - exp_offset(format) + top - zeros, product << (zeros - 1),
+                           flags);
+}
+
+static ALWAYS_INLINE uint64_t divide_normal_bits(uint8_t format, uint8_t rounding, uint64_t a, uint64_t b, uint8_t *flags) {
+    uint32_t mant = mant_size(format);
+    uint64_t sign = (a ^ b) >> sign_shift(format) & 1;
+    int32_t exp_a, exp_b;
+    uint64_t sig_a = unpack_normal_bits(format, a, &exp_a);
+    uint64_t sig_b = unpack_normal_bits(format, b, &exp_b);
+    uint64_t quotient = divide_significands(mant, sig_a, sig_b);
+    uint8_t zeros = count_leading_zeros(quotient);
+    int32_t exponent = exp_a - exp_b + exp_offset(format) + 60 - (int32_t) mant - zeros;
+    return round_pack_bits(format, rounding, sign, exponent, quotient << (zeros - 1), flags);
+}
+
+// One value of format src in format dst, rounded once; NaNs become dst's canonical quiet NaN, infinities NaN where
+// dst has none. Conversions report no flags.
+static ALWAYS_INLINE uint64_t convert_bits(uint8_t src, uint8_t dst, uint8_t rounding, uint64_t bits) {
+    uint8_t flags;
+    uint64_t magnitude = bits & abs_mask(src);
+    uint64_t sign = bits >> sign_shift(src) & 1;
+    int32_t exponent;
+    uint64_t significand = unpack_bits(src, bits, &exponent);
+    uint8_t zeros = count_leading_zeros(significand | 1);
+    exponent += exp_offset(dst) - exp_offset(src) + 63 - (int32_t) mant_size(src) - zeros;
+    uint64_t result = round_pack_bits(dst, rounding, sign, exponent, significand << (zeros - 1), &flags);
+    result = select_bits(magnitude == 0, sign << sign_shift(dst), result);
+    result = select_bits(magnitude == inf_bits(src), infinity_result(dst, sign), result);
+    return select_bits(magnitude >= nan_bits(src), quiet_nan_bits(dst), result);
+}
+
+void print_result(Number num) {
+    if (num.type != NAN && num.sign) {
+        printf("-");
+    }
+    switch (num.type) {
+        case ZERO:
+            printf("0x0.%0*dp+0\n", digits_to_print(num.format), 0);
+            break;
+        case OK:
+            printf("0x1.%0*" PRIx64 "p%+" PRIi16 "\n",
+                   digits_to_print(num.format),
+                   num.mantissa << mant_gap_to_print(num.format),
+                   num.exponent - exp_offset(num.format));
+            break;
+        case INF:
+            printf("inf\n");
+            break;
+        case NAN:
+            printf("nan\n");
+            break;
+        default:
+            break;
+    }
+}
+
+uint64_t pack_number(Number num) {
+    uint64_t sign_bit = (uint64_t) num.sign << sign_shift(num.format);
+    switch (num.type) {
+        case ZERO:
+            return sign_bit;
+        case INF:
+            return sign_bit | inf_bits(num.format);
+        case NAN:
+            return quiet_nan_bits(num.format);
+        default:
+            break;
+    }
+    uint64_t mantissa = num.mantissa | implicit_bit(num.format);
+    if (num.exponent < 1) {
+        // exact: round_number already dropped the bits below the subnormal range
+        return sign_bit | mantissa >> (1 - num.exponent);
+    }
+    return sign_bit | (uint64_t) num.exponent << mant_size(num.format) | (mantissa & mant_mask(num.format));
+}
+
+// Lanes evaluated per chunk of a batch.
+#define BATCH_CHUNK (1 << 20)
+
+// fma and sqrt have no bit-level kernels: their lanes go through the scalar operations.
+static ALWAYS_INLINE uint64_t evaluate_scalar(uint8_t format, uint8_t rounding, char operation, const uint64_t *operands, uint8_t *flags) {
+    Number numbers[MAX_OPERANDS];
+    for (uint8_t i = 0; i < operand_count(operation); ++i)
+        numbers[i] = to_IEEE754_standard(format, operands[i]);
+    Number result = apply_operation(rounding, operation, numbers);
+    *flags = result.flags;
+    return pack_number(result);
+}
+
+// Lanes of a binary operation sorted by class at a time, and the most of them that may need the general kernel
+// before the whole block takes it instead.
+#define SPLIT_BLOCK 1024
+#define SPLIT_MAX_SLOW (SPLIT_BLOCK / 8)
+
+// Lanes a thread takes at a time, a multiple of SPLIT_BLOCK. The parallel loops run over these outside the kernels:
+// OpenMP outlines a loop's body before inlining, so that a loop inside an instantiated kernel would see the format,
+// operation and rounding mode as variables again and no longer vectorize.
+#define THREAD_CHUNK (16 * SPLIT_BLOCK)
+
+static ALWAYS_INLINE uint64_t operate_bits(uint8_t format, uint8_t rounding, char operation, uint64_t a, uint64_t b, uint8_t *flags) {
+    switch (operation) {
+        case '+':
+            return add_bits(format, rounding, a, b, flags);
+        case '-':
+            return subtract_bits(format, rounding, a, b, flags);
+        case '*':
+            return multiply_bits(format, rounding, a, b, flags);
+        default:
+            return divide_bits(format, rounding, a, b, flags);
+    }
+}
+
+static ALWAYS_INLINE uint64_t operate_normal_bits(uint8_t format, uint8_t rounding, char operation, uint64_t a, uint64_t b, uint8_t *flags) {
+    switch (operation) {
+        case '+':
+            return add_normal_bits(format, rounding, a, b, flags);
+        case '-':
+            return add_normal_bits(format, rounding, a, b ^ UINT64_C(1) << sign_shift(format), flags);
+        case '*':
+            return multiply_normal_bits(format, rounding, a, b, flags);
+        default:
+            return divide_normal_bits(format, rounding, a, b, flags);
+    }
+}
+
+// The lane loops below store the flags of lane i to flags[i] unless flags is NULL. They are instantiated with a NULL
+// constant as well, where the flags are never computed.
+static ALWAYS_INLINE void normal_lanes(uint8_t format, uint8_t rounding, char operation, const uint64_t *operands, uint64_t *results, uint8_t *flags, int32_t count) {
+    for (int32_t i = 0; i < count; i++) {
+        uint8_t lane_flags;
+        results[i] = operate_normal_bits(format, rounding, operation, operands[2 * i], operands[2 * i + 1], &lane_flags);
+        if (flags)
+            flags[i] = lane_flags;
+    }
+}
+
+static ALWAYS_INLINE void general_lane(uint8_t format, uint8_t rounding, char operation, const uint64_t *operands, uint64_t *results, uint8_t *flags, int64_t i) {
+    uint8_t lane_flags;
+    results[i] = operate_bits(format, rounding, operation, operands[2 * i], operands[2 * i + 1], &lane_flags);
+    if (flags)
+        flags[i] = lane_flags;
+}
+
+// Binary operations, one block at a time: the indices of lanes with an operand that is not normal are gathered
+// first, then every lane takes the kernel for normal operands and the gathered ones are redone with the general
+// kernel. Blocks where those are too many to be worth a second pass take the general kernel throughout. The loop over
+// normal operands is instantiated per rounding mode, like the conversions, so that it is straight-line code.
+static ALWAYS_INLINE void split_lanes(uint8_t format, uint8_t rounding, char operation, const uint64_t *operands, uint64_t *results, uint8_t *flags, int64_t count) {
+    for (int64_t start = 0; start < count; start += SPLIT_BLOCK) {
+        int32_t size = count - start < SPLIT_BLOCK ? (int32_t) (count - start) : SPLIT_BLOCK;
+        const uint64_t *block = operands + 2 * start;
+        uint64_t *block_results = results + start;
+        uint8_t *block_flags = flags ? flags + start : NULL;
+        int32_t slow[SPLIT_BLOCK];
+        int32_t slow_count = 0;
+        for (int32_t i = 0; i < size; i++) {
+            slow[slow_count] = i;
+            slow_count += !(is_normal_bits(format, block[2 * i]) & is_normal_bits(format, block[2 * i + 1]));
+        }
+        if (slow_count > SPLIT_MAX_SLOW) {
+            for (int32_t i = 0; i < size; i++)
+                general_lane(format, rounding, operation, block, block_results, block_flags, i);
+            continue;
+        }
+        switch (rounding) {
+            case TOWARD_ZERO:
+                normal_lanes(format, TOWARD_ZERO, operation, block, block_results, block_flags, size);
                 break;
-            case '*':
-                num = multiply(rounding, num, num2);
+            case TOWARD_NEAREST_EVEN:
+                normal_lanes(format, TOWARD_NEAREST_EVEN, operation, block, block_results, block_flags, size);
                 break;
-            case '/':
-                num = divide(rounding, num, num2);
+            case TOWARD_POS_INF:
+                normal_lanes(format, TOWARD_POS_INF, operation, block, block_results, block_flags, size);
                 break;
             default:
-                fprintf(stderr, "Error: Unsupported operation: %c\n", operation);
-                return ERROR_UNSUPPORTED;
+                normal_lanes(format, TOWARD_NEG_INF, operation, block, block_results, block_flags, size);
+                break;
         }
+        for (int32_t k = 0; k < slow_count; k++)
+            general_lane(format, rounding, operation, block, block_results, block_flags, slow[k]);
+    }
+}
+
+static ALWAYS_INLINE void binary_lanes(uint8_t format, uint8_t rounding, char operation, bool split, const uint64_t *operands, uint64_t *results, uint8_t *flags, int64_t count) {
+    if (split) {
+        split_lanes(format, rounding, operation, operands, results, flags, count);
+        return;
+    }
+    for (int64_t i = 0; i < count; i++)
+        general_lane(format, rounding, operation, operands, results, flags, i);
+}
+
+// fma and sqrt lanes, on the scalar path.
+static ALWAYS_INLINE void scalar_lanes(uint8_t format, uint8_t rounding, char operation, const uint64_t *operands, uint64_t *results, uint8_t *flags, int64_t count) {
+    uint8_t arity = operand_count(operation);
+    for (int64_t i = 0; i < count; i++) {
+        uint8_t lane_flags;
+        results[i] = evaluate_scalar(format, rounding, operation, &operands[arity * i], &lane_flags);
+        if (flags)
+            flags[i] = lane_flags;
+    }
+}
+
+// Instantiated once per format by evaluate_batch so that the format parameters fold into constants in the kernels.
+// Without split, binary operations take the general kernels on every lane.
+static ALWAYS_INLINE void evaluate_lanes(uint8_t format, uint8_t rounding, char operation, bool split, const uint64_t *operands, uint64_t *results, uint8_t *flags, int64_t count) {
+    switch (operation) {
+        case '+':
+            binary_lanes(format, rounding, '+', split, operands, results, flags, count);
+            break;
+        case '-':
+            binary_lanes(format, rounding, '-', split, operands, results, flags, count);
+            break;
+        case '*':
+            binary_lanes(format, rounding, '*', split, operands, results, flags, count);
+            break;
+        case '/':
+            binary_lanes(format, rounding, '/', split, operands, results, flags, count);
+            break;
+        case OPERATION_FMA:
+            scalar_lanes(format, rounding, OPERATION_FMA, operands, results, flags, count);
+            break;
+        case OPERATION_SQRT:
+            scalar_lanes(format, rounding, OPERATION_SQRT, operands, results, flags, count);
+            break;
+        default:
+            break;
+    }
+}
+
+static void evaluate_chunk(uint8_t format, uint8_t rounding, char operation, bool split, const uint64_t *operands, uint64_t *results, uint8_t *flags, int64_t count) {
+    switch (format) {
+#define EVALUATE_FORMAT(id, name, exp, mant, inf)                                               \
+        case id:                                                                                \
+            if (flags)                                                                          \
+                evaluate_lanes(id, rounding, operation, split, operands, results, flags, count); \
+            else                                                                                \
+                evaluate_lanes(id, rounding, operation, split, operands, results, NULL, count);  \
+            break;
+        FORMATS(EVALUATE_FORMAT)
+#undef EVALUATE_FORMAT
+        default:
+            break;
+    }
+}
+
+// flags, if not NULL, receives the exceptions each lane raised.
+void evaluate_formats(uint8_t format, uint8_t rounding, char operation, bool split, const uint64_t *operands, uint64_t *results, uint8_t *flags, int64_t count) {
+    int64_t arity = operand_count(operation);
+#pragma omp parallel for schedule(static) if (count > THREAD_CHUNK)
+    for (int64_t start = 0; start < count; start += THREAD_CHUNK) {
+        int64_t size = count - start < THREAD_CHUNK ? count - start : THREAD_CHUNK;
+        evaluate_chunk(format, rounding, operation, split, operands + arity * start, results + start,
+                       flags ? flags + start : NULL, size);
+    }
+}
+
+void evaluate_batch(uint8_t format, uint8_t rounding, char operation, const uint64_t *operands, uint64_t *results, int64_t count) {
+    evaluate_formats(format, rounding, operation, true, operands, results, NULL, count);
+}
+
+// evaluate_batch that also stores the exceptions each lane raised to flags and returns them all or-ed together, the
+// sticky flags of the batch.
+uint8_t evaluate_batch_flags(uint8_t format, uint8_t rounding, char operation, const uint64_t *operands, uint64_t *results, uint8_t *flags, int64_t count) {
+    evaluate_formats(format, rounding, operation, true, operands, results, flags, count);
+    uint8_t sticky = 0;
+    for (int64_t i = 0; i < count; i++)
+        sticky |= flags[i];
+    return sticky;
+}
+
+// Tables of the half precision backend behind --lut, filled by build_half_tables. sqrt has a single operand, so every
+// result fits a table per rounding mode. Binary operations would need 2^32 entries; division only swaps its 64-bit
+// integer division for the reciprocal of the divisor's significand, and +, -, * and fma stay computed, since a lookup
+// costs more than the multiplication it would replace.
+static uint16_t half_sqrt_table[TOWARD_NEG_INF + 1][0x10000];
+static uint32_t half_reciprocal_table[0x400];
+
+// Fills the tables from the scalar path, so that the table backend gives its results by construction. Runs once.
+void build_half_tables(void) {
+    static bool built = false;
+    if (built)
+        return;
+    for (uint8_t rounding = 0; rounding <= TOWARD_NEG_INF; ++rounding) {
+        for (uint32_t bits = 0; bits < 0x10000; ++bits) {
+            Number root = square_root(rounding, to_IEEE754_standard(FORMAT_HALF, bits));
+            half_sqrt_table[rounding][bits] = (uint16_t) pack_number(root);
+        }
+    }
+    // floor(2^32 / significand): the quotient estimated with it is at most one too small
+    for (uint32_t fraction = 0; fraction < 0x400; ++fraction)
+        half_reciprocal_table[fraction] = (uint32_t) ((UINT64_C(1) << 32) / (0x400 | fraction));
+    built = true;
+}
+
+// divide_bits for half precision with a multiplication by the divisor's reciprocal in place of the division. The
+// dividend has 24 bits and the quotient 13 or 14, a guard bit more than rounding needs; the remainder corrects the
+// estimate and gives the sticky bit.
+static ALWAYS_INLINE uint64_t divide_half_table(uint8_t rounding, uint64_t a, uint64_t b) {
+    uint64_t sign = (a ^ b) >> sign_shift(FORMAT_HALF) & 1;
+    int32_t exp_a, exp_b;
+    uint64_t sig_a = unpack_bits(FORMAT_HALF, a, &exp_a);
+    uint64_t sig_b = unpack_bits(FORMAT_HALF, b, &exp_b);
+    sig_a |= sig_a == 0;
+    sig_b |= sig_b == 0;
+    // subnormals are normalized here, with their leading ones at bit 10 like the others
+    int32_t shift_a = count_leading_zeros(sig_a) - 53, shift_b = count_leading_zeros(sig_b) - 53;
+    uint64_t dividend = sig_a << (shift_a + 13);
+    uint64_t divisor = sig_b << shift_b;
+    uint64_t quotient = dividend * half_reciprocal_table[divisor & 0x3FF] >> 32;
+    uint64_t remainder = dividend - quotient * divisor;
+    bool short_by_one = remainder >= divisor;
+    quotient += short_by_one;
+    remainder -= select_bits(short_by_one, divisor, 0);
+    quotient |= remainder != 0;
+    uint8_t zeros = count_leading_zeros(quotient);
+    int32_t exponent = exp_a - exp_b + shift_b - shift_a + exp_offset(FORMAT_HALF) + 50 - zeros;
+    // the table backend reports no flags
+    uint8_t flags;
+    uint64_t result = round_pack_bits(FORMAT_HALF, rounding, sign, exponent, quotient << (zeros - 1), &flags);
+    return divide_special_bits(FORMAT_HALF, a, b, result, &flags);
+}
+
+static void half_table_chunk(uint8_t rounding, char operation, const uint64_t *operands, uint64_t *results, int64_t count) {
+    switch (operation) {
+        case '/':
+            for (int64_t i = 0; i < count; i++)
+                results[i] = divide_half_table(rounding, operands[2 * i], operands[2 * i + 1]);
+            break;
+        case OPERATION_SQRT:
+            for (int64_t i = 0; i < count; i++)
+                results[i] = half_sqrt_table[rounding][operands[i]];
+            break;
+        default:
+            evaluate_lanes(FORMAT_HALF, rounding, operation, true, operands, results, NULL, count);
+            break;
+    }
+}
+
+// evaluate_batch for half precision on the tables; build_half_tables must have run.
+void evaluate_half_table(uint8_t rounding, char operation, const uint64_t *operands, uint64_t *results, int64_t count) {
+    int64_t arity = operand_count(operation);
+#pragma omp parallel for schedule(static)
+    for (int64_t start = 0; start < count; start += THREAD_CHUNK) {
+        int64_t size = count - start < THREAD_CHUNK ? count - start : THREAD_CHUNK;
+        half_table_chunk(rounding, operation, operands + arity * start, results + start, size);
+    }
+}
+
+// Instantiated for every pair of formats and every rounding mode, so that each loop is a straight-line kernel the
+// compiler can vectorize.
+static ALWAYS_INLINE void convert_lanes(uint8_t src, uint8_t dst, uint8_t rounding, const uint64_t *in, uint64_t *out, int64_t count) {
+    switch (rounding) {
+        case TOWARD_ZERO:
+            for (int64_t i = 0; i < count; i++)
+                out[i] = convert_bits(src, dst, TOWARD_ZERO, in[i]);
+            break;
+        case TOWARD_NEAREST_EVEN:
+            for (int64_t i = 0; i < count; i++)
+                out[i] = convert_bits(src, dst, TOWARD_NEAREST_EVEN, in[i]);
+            break;
+        case TOWARD_POS_INF:
+            for (int64_t i = 0; i < count; i++)
+                out[i] = convert_bits(src, dst, TOWARD_POS_INF, in[i]);
+            break;
+        case TOWARD_NEG_INF:
+            for (int64_t i = 0; i < count; i++)
+                out[i] = convert_bits(src, dst, TOWARD_NEG_INF, in[i]);
+            break;
+        default:
+            break;
+    }
+}
+
+static ALWAYS_INLINE void convert_from(uint8_t src, uint8_t dst, uint8_t rounding, const uint64_t *in, uint64_t *out, int64_t count) {
+    switch (dst) {
+#define CONVERT_TO(id, name, exp, mant, inf)                          \
+        case id:                                                      \
+            convert_lanes(src, id, rounding, in, out, count);         \
+            break;
+        FORMATS(CONVERT_TO)
+#undef CONVERT_TO
+        default:
+            break;
+    }
+}
+
+static void convert_chunk(uint8_t src_format, uint8_t dst_format, uint8_t rounding, const uint64_t *in, uint64_t *out, int64_t count) {
+    switch (src_format) {
+#define CONVERT_FROM(id, name, exp, mant, inf)                                    \
+        case id:                                                                  \
+            convert_from(id, dst_format, rounding, in, out, count);               \
+            break;
+        FORMATS(CONVERT_FROM)
+#undef CONVERT_FROM
+        default:
+            break;
+    }
+}
+
+// Converts count values of src_format in `in` to dst_format in `out`, which may be the same array. Values are bit
+// patterns in the low bits of each element, as everywhere else; nothing here does I/O or keeps state, so it can be
+// called on any slice of a tensor from any thread.
+void convert(uint8_t src_format, uint8_t dst_format, uint8_t rounding, const uint64_t *in, uint64_t *out, int64_t count) {
+#pragma omp parallel for schedule(static)
+    for (int64_t start = 0; start < count; start += THREAD_CHUNK) {
+        int64_t size = count - start < THREAD_CHUNK ? count - start : THREAD_CHUNK;
+        convert_chunk(src_format, dst_format, rounding, in + start, out + start, size);
+    }
+}
+
+bool read_hex_operand(FILE *in, uint64_t *value) {
+    int c;
+    do {
+        c = getc(in);
+    } while (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+    if (c == EOF)
+        return false;
+    bool digits = false, overflow = false;
+    if (c == '0') {
+        digits = true;
+        c = getc(in);
+        if (c == 'x' || c == 'X') {
+            digits = false;
+            c = getc(in);
+        }
+    }
+    *value = 0;
+    for (;; c = getc(in)) {
+        uint64_t digit;
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            digit = c - 'A' + 10;
+        else
+            break;
+        overflow |= *value >> 60 != 0;
+        *value = *value << 4 | digit;
+        digits = true;
+    }
+    if (c != EOF)
+        ungetc(c, in);
+    return digits && !overflow;
+}
+
+// Packed values of the format's width in native byte order, to and from one uint64_t each. Separate loops per
+// width keep the conversions vectorizable.
+static void widen_values(const unsigned char *restrict bytes, uint64_t *restrict values, size_t count, uint8_t width) {
+    switch (width) {
+        case sizeof(uint8_t):
+            for (size_t i = 0; i < count; i++)
+                values[i] = bytes[i];
+            break;
+        case sizeof(uint16_t):
+            for (size_t i = 0; i < count; i++) {
+                uint16_t value;
+                memcpy(&value, bytes + i * sizeof(value), sizeof(value));
+                values[i] = value;
+            }
+            break;
+        case sizeof(uint32_t):
+            for (size_t i = 0; i < count; i++) {
+                uint32_t value;
+                memcpy(&value, bytes + i * sizeof(value), sizeof(value));
+                values[i] = value;
+            }
+            break;
+        default:
+            memcpy(values, bytes, count * sizeof(uint64_t));
+            break;
+    }
+}
+
+static void narrow_values(const uint64_t *restrict values, unsigned char *restrict bytes, size_t count, uint8_t width) {
+    switch (width) {
+        case sizeof(uint8_t):
+            for (size_t i = 0; i < count; i++)
+                bytes[i] = (uint8_t) values[i];
+            break;
+        case sizeof(uint16_t):
+            for (size_t i = 0; i < count; i++) {
+                uint16_t value = (uint16_t) values[i];
+                memcpy(bytes + i * sizeof(value), &value, sizeof(value));
+            }
+            break;
+        case sizeof(uint32_t):
+            for (size_t i = 0; i < count; i++) {
+                uint32_t value = (uint32_t) values[i];
+                memcpy(bytes + i * sizeof(value), &value, sizeof(value));
+            }
+            break;
+        default:
+            memcpy(bytes, values, count * sizeof(uint64_t));
+            break;
+    }
+}
+
+// Reads up to max_count lanes of arity operands each; *status is set when the input is malformed. Binary input goes
+// through raw, which holds arity * max_count values of any width.
+int64_t read_operands(FILE *in, bool binary, uint8_t format, uint8_t arity, unsigned char *raw, uint64_t *operands, int64_t max_count, int *status) {
+    if (binary) {
+        size_t read = fread(raw, format_width(format), arity * max_count, in);
+        widen_values(raw, operands, read, format_width(format));
+        *status = read % arity ? ERROR_DATA_INVALID : SUCCESS;
+        return (int64_t) read / arity;
+    }
+    uint64_t limit = value_mask(format);
+    int64_t count = 0;
+    *status = SUCCESS;
+    while (count < max_count && read_hex_operand(in, &operands[arity * count])) {
+        for (uint8_t i = 0; i < arity; ++i) {
+            if ((i && !read_hex_operand(in, &operands[arity * count + i])) || operands[arity * count + i] > limit) {
+                *status = ERROR_DATA_INVALID;
+                return count;
+            }
+        }
+        ++count;
+    }
+    int c;
+    while ((c = getc(in)) == ' ' || c == '\t' || c == '\n' || c == '\r')
+        ;
+    if (c != EOF && count < max_count)
+        *status = ERROR_DATA_INVALID;
+    else if (c != EOF)
+        ungetc(c, in);
+    return count;
+}
+
+// Writes each value as digits lowercase hex digits and a newline, as printf("%0*" PRIx64 "\n") would, and returns the
+// number of characters; text must hold (digits + 1) * count of them.
+size_t format_hex(const uint64_t *values, int64_t count, uint8_t digits, char *text) {
+    static const char hex_digits[16] = "0123456789abcdef";
+    for (int64_t i = 0; i < count; i++) {
+        char *line = text + (size_t) i * (digits + 1);
+        uint64_t value = values[i];
+        for (int digit = digits - 1; digit >= 0; --digit) {
+            line[digit] = hex_digits[value & 0xF];
+            value >>= 4;
+        }
+        line[digits] = '\n';
+    }
+    return (size_t) count * (digits + 1);
+}
+
+// raw has room for the text of a whole chunk: 20 characters per value at most, against the 8 * MAX_OPERANDS bytes per
+// lane it holds for reading. Unless flags is NULL, each result is followed by its flags, a byte in bin streams and two
+// hex digits after a space in hex ones.
+void write_results(FILE *out, bool binary, uint8_t format, const uint64_t *results, const uint8_t *flags, unsigned char *raw, int64_t count) {
+    if (flags) {
+        uint8_t width = format_width(format);
+        size_t size = 0;
+        for (int64_t i = 0; i < count; i++) {
+            if (binary) {
+                narrow_values(&results[i], raw + size, 1, width);
+                size += width;
+                raw[size++] = flags[i];
+            } else {
+                uint64_t lane_flags = flags[i];
+                size += format_hex(&results[i], 1, 2 * width, (char *) raw + size);
+                raw[size - 1] = ' ';
+                size += format_hex(&lane_flags, 1, 2, (char *) raw + size);
+            }
+        }
+        fwrite(raw, 1, size, out);
+    } else if (binary) {
+        narrow_values(results, raw, count, format_width(format));
+        fwrite(raw, format_width(format), count, out);
+    } else {
+        fwrite(raw, 1, format_hex(results, count, 2 * format_width(format), (char *) raw), out);
+    }
+}
+
+// Names of the exceptions, by bit of the flags.
+static const char *const EXCEPTION_NAMES[] = {"invalid", "divide-by-zero", "overflow", "underflow", "inexact"};
+
+void print_flags(FILE *out, uint8_t flags) {
+    fprintf(out, "flags:");
+    for (size_t bit = 0; bit < sizeof(EXCEPTION_NAMES) / sizeof(EXCEPTION_NAMES[0]); ++bit) {
+        if (flags >> bit & 1)
+            fprintf(out, " %s", EXCEPTION_NAMES[bit]);
+    }
+    fprintf(out, flags ? "\n" : " none\n");
+}
+
+int run_batch(uint8_t format, uint8_t rounding, char operation, bool binary, bool table, bool with_flags, FILE *in, FILE *out) {
+    uint64_t *operands = malloc(sizeof(uint64_t) * MAX_OPERANDS * BATCH_CHUNK);
+    uint64_t *results = malloc(sizeof(uint64_t) * BATCH_CHUNK);
+    unsigned char *raw = malloc(sizeof(uint64_t) * MAX_OPERANDS * BATCH_CHUNK);
+    uint8_t *flags = with_flags ? malloc(BATCH_CHUNK) : NULL;
+    if (!operands || !results || !raw || (with_flags && !flags)) {
+        free(operands);
+        free(results);
+        free(raw);
+        free(flags);
+        fprintf(stderr, "Error: not enough memory\n");
+        return ERROR_NOTENOUGH_MEMORY;
+    }
+    if (table)
+        build_half_tables();
+    int status = SUCCESS;
+    uint8_t arity = operand_count(operation);
+    int64_t count;
+    uint8_t sticky = 0;
+    while (status == SUCCESS && (count = read_operands(in, binary, format, arity, raw, operands, BATCH_CHUNK, &status)) > 0) {
+        if (table)
+            evaluate_half_table(rounding, operation, operands, results, count);
+        else if (with_flags)
+            sticky |= evaluate_batch_flags(format, rounding, operation, operands, results, flags, count);
+        else
+            evaluate_batch(format, rounding, operation, operands, results, count);
+        write_results(out, binary, format, results, flags, raw, count);
+    }
+    if (status != SUCCESS)
+        fprintf(stderr, "Error: invalid operand stream\n");
+    else if (with_flags)
+        print_flags(stderr, sticky);
+    free(operands);
+    free(results);
+    free(raw);
+    free(flags);
+    return status;
+}
+
+// Shared by the modes invoked as main <format> <rounding> --<mode> <op> ...
+int parse_mode_arguments(char *argv[], uint8_t *format, uint8_t *rounding, char *operation) {
+    if (sscanf(argv[2], "%hhu", rounding) < 1) {
+        fprintf(stderr, "Error: invalid datatype\n");
+        return ERROR_DATA_INVALID;
+    }
+    if (!parse_format(argv[1], format)) {
+        fprintf(stderr, "Error: Unsupported data format: %s\n", argv[1]);
+        return ERROR_ARGUMENTS_INVALID;
+    }
+    if (*rounding > TOWARD_NEG_INF) {
+        fprintf(stderr, "Error: Unsupported rounding type: %hhd\n", *rounding);
+        return ERROR_ARGUMENTS_INVALID;
+    }
+    if (!parse_operation(argv[4], operation)) {
+        fprintf(stderr, "Error: Unsupported operation: %s\n", argv[4]);
+        return ERROR_ARGUMENTS_INVALID;
+    }
+    return SUCCESS;
+}
+
+// <format> <rounding> --batch <operation> <hex|bin> [input] [output]: evaluates operand pairs (triples for fma, single
+// values for sqrt) read from input (stdin if omitted or "-") and writes one result per lane to output (stdout likewise).
+// Hex streams hold whitespace-separated numbers, one result per line; bin streams hold packed values of the format's
+// width in native byte order. h <rounding> --lut ... does the same on the table backend. --flags instead of --batch
+// follows every result with the exceptions its lane raised, see write_results, and prints them all or-ed together, the
+// sticky flags, to stderr at the end.
+int batch_main(int argc, char *argv[]) {
+    uint8_t format = FORMAT_SINGLE;
+    char operation = '\0';
+    uint8_t rounding = TOWARD_ZERO;
+    int ret = parse_mode_arguments(argv, &format, &rounding, &operation);
+    if (ret != SUCCESS) {
+        return ret;
+    }
+    bool table = strcmp(argv[3], "--lut") == 0;
+    bool with_flags = strcmp(argv[3], "--flags") == 0;
+    if (table && format != FORMAT_HALF) {
+        fprintf(stderr, "Error: --lut only supports h\n");
+        return ERROR_ARGUMENTS_INVALID;
+    }
+    bool binary = strcmp(argv[5], "bin") == 0;
+    if (!binary && strcmp(argv[5], "hex") != 0) {
+        fprintf(stderr, "Error: Unsupported stream format: %s\n", argv[5]);
+        return ERROR_ARGUMENTS_INVALID;
+    }
+    FILE *in = argc > 6 && strcmp(argv[6], "-") != 0 ? fopen(argv[6], "rb") : stdin;
+    if (!in) {
+        fprintf(stderr, "Error: cannot open file %s\n", argv[6]);
+        return ERROR_CANNOT_OPEN_FILE;
+    }
+    FILE *out = argc > 7 && strcmp(argv[7], "-") != 0 ? fopen(argv[7], "wb") : stdout;
+    if (!out) {
+        fprintf(stderr, "Error: cannot open file %s\n", argv[7]);
+        if (in != stdin)
+            fclose(in);
+        return ERROR_CANNOT_OPEN_FILE;
+    }
+    ret = run_batch(format, rounding, operation, binary, table, with_flags, in, out);
+    if (in != stdin)
+        fclose(in);
+    if (out != stdout && fclose(out) != 0 && ret == SUCCESS) {
+        fprintf(stderr, "Error: cannot write file %s\n", argv[7]);
+        ret = ERROR_CANNOT_OPEN_FILE;
+    }
+    return ret;
+}
+
+int run_convert(uint8_t src_format, uint8_t dst_format, uint8_t rounding, bool binary, FILE *in, FILE *out) {
+    uint64_t *values = malloc(sizeof(uint64_t) * BATCH_CHUNK);
+    unsigned char *raw = malloc(sizeof(uint64_t) * MAX_OPERANDS * BATCH_CHUNK);
+    if (!values || !raw) {
+        free(values);
+        free(raw);
+        fprintf(stderr, "Error: not enough memory\n");
+        return ERROR_NOTENOUGH_MEMORY;
+    }
+    int status = SUCCESS;
+    int64_t count;
+    while (status == SUCCESS && (count = read_operands(in, binary, src_format, 1, raw, values, BATCH_CHUNK, &status)) > 0) {
+        convert(src_format, dst_format, rounding, values, values, count);
+        write_results(out, binary, dst_format, values, NULL, raw, count);
+    }
+    if (status != SUCCESS)
+        fprintf(stderr, "Error: invalid value stream\n");
+    free(values);
+    free(raw);
+    return status;
+}
+
+// <format> <rounding> --convert <format> <hex|bin> [input] [output]: converts every value read from input to the second
+// format, rounding in the given mode; streams are as in --batch, values in the first format in and the second out.
+int convert_main(int argc, char *argv[]) {
+    uint8_t src_format = FORMAT_SINGLE, dst_format = FORMAT_SINGLE;
+    uint8_t rounding = TOWARD_ZERO;
+    if (sscanf(argv[2], "%hhu", &rounding) < 1) {
+        fprintf(stderr, "Error: invalid datatype\n");
+        return ERROR_DATA_INVALID;
+    }
+    if (!parse_format(argv[1], &src_format)) {
+        fprintf(stderr, "Error: Unsupported data format: %s\n", argv[1]);
+        return ERROR_ARGUMENTS_INVALID;
+    }
+    if (!parse_format(argv[4], &dst_format)) {
+        fprintf(stderr, "Error: Unsupported data format: %s\n", argv[4]);
+        return ERROR_ARGUMENTS_INVALID;
+    }
+    if (rounding > TOWARD_NEG_INF) {
+        fprintf(stderr, "Error: Unsupported rounding type: %hhd\n", rounding);
+        return ERROR_ARGUMENTS_INVALID;
+    }
+    bool binary = strcmp(argv[5], "bin") == 0;
+    if (!binary && strcmp(argv[5], "hex") != 0) {
+        fprintf(stderr, "Error: Unsupported stream format: %s\n", argv[5]);
+        return ERROR_ARGUMENTS_INVALID;
+    }
+    FILE *in = argc > 6 && strcmp(argv[6], "-") != 0 ? fopen(argv[6], "rb") : stdin;
+    if (!in) {
+        fprintf(stderr, "Error: cannot open file %s\n", argv[6]);
+        return ERROR_CANNOT_OPEN_FILE;
+    }
+    FILE *out = argc > 7 && strcmp(argv[7], "-") != 0 ? fopen(argv[7], "wb") : stdout;
+    if (!out) {
+        fprintf(stderr, "Error: cannot open file %s\n", argv[7]);
+        if (in != stdin)
+            fclose(in);
+        return ERROR_CANNOT_OPEN_FILE;
+    }
+    int ret = run_convert(src_format, dst_format, rounding, binary, in, out);
+    if (in != stdin)
+        fclose(in);
+    if (out != stdout && fclose(out) != 0 && ret == SUCCESS) {
+        fprintf(stderr, "Error: cannot write file %s\n", argv[7]);
+        ret = ERROR_CANNOT_OPEN_FILE;
+    }
+    return ret;
+}
+
+// Registers of the --trace machine and instructions decoded per read of the trace. An instruction is a header and a
+// 64-bit operand per input.
+#define TRACE_REGISTERS (1 << 16)
+#define TRACE_CHUNK (1 << 16)
+#define TRACE_HEADER_SIZE 8
+#define TRACE_RECORD_MAX (TRACE_HEADER_SIZE + sizeof(uint64_t) * MAX_OPERANDS)
+// Groups, and kinds within a group, of fewer instructions take the scalar operations: lanes for the batch kernels
+// cost more than they save on them.
+#define TRACE_MIN_BATCH 16
+
+// Operations a trace may use, in the order of their kinds.
+static const char TRACE_OPERATIONS[] = {'+', '-', '*', '/', OPERATION_FMA, OPERATION_SQRT};
+#define TRACE_KINDS (sizeof(TRACE_OPERATIONS) * FORMAT_COUNT * (TOWARD_NEG_INF + 1))
+
+// Decodes up to max_count instructions. raw holds TRACE_CHUNK instructions of the largest size and keeps the
+// *buffered bytes not decoded yet between calls; *status is set when the trace is malformed or ends inside an
+// instruction.
+int64_t read_trace(FILE *in, unsigned char *raw, size_t *buffered, TraceInstruction *instructions, int64_t max_count, int *status) {
+    *buffered += fread(raw + *buffered, 1, TRACE_CHUNK * TRACE_RECORD_MAX - *buffered, in);
+    *status = SUCCESS;
+    size_t offset = 0;
+    int64_t count = 0;
+    while (count < max_count && *buffered - offset >= TRACE_HEADER_SIZE) {
+        const unsigned char *record = raw + offset;
+        TraceInstruction *instruction = &instructions[count];
+        instruction->operation = (char) record[0];
+        instruction->format = record[1];
+        instruction->rounding = record[2];
+        instruction->registers = record[3];
+        memcpy(&instruction->destination, record + 4, sizeof(instruction->destination));
+        const char *operation = memchr(TRACE_OPERATIONS, record[0], sizeof(TRACE_OPERATIONS));
+        uint8_t arity = operand_count(instruction->operation);
+        if (!operation || instruction->format >= FORMAT_COUNT || instruction->rounding > TOWARD_NEG_INF ||
+            instruction->registers >> arity != 0 || instruction->destination >= TRACE_REGISTERS) {
+            *status = ERROR_FORMAT_INVALID;
+            return count;
+        }
+        size_t size = TRACE_HEADER_SIZE + sizeof(uint64_t) * arity;
+        if (*buffered - offset < size)
+            break;
+        memcpy(instruction->operands, record + TRACE_HEADER_SIZE, sizeof(uint64_t) * arity);
+        for (uint8_t i = 0; i < arity; ++i) {
+            uint64_t limit = instruction->registers >> i & 1 ? TRACE_REGISTERS - 1 : value_mask(instruction->format);
+            if (instruction->operands[i] > limit) {
+                *status = ERROR_FORMAT_INVALID;
+                return count;
+            }
+        }
+        instruction->kind = (uint8_t) (((operation - TRACE_OPERATIONS) * FORMAT_COUNT + instruction->format) *
+                                       (TOWARD_NEG_INF + 1) + instruction->rounding);
+        offset += size;
+        ++count;
+    }
+    *buffered -= offset;
+    memmove(raw, raw + offset, *buffered);
+    // the buffer always has room for a whole instruction, so that one left incomplete is cut off by the end of input
+    if (count == 0 && *buffered != 0)
+        *status = ERROR_FORMAT_INVALID;
+    return count;
+}
+
+static ALWAYS_INLINE uint64_t trace_operand(const TraceInstruction *instruction, uint8_t i, const uint64_t *registers) {
+    uint64_t operand = instruction->operands[i];
+    return instruction->registers >> i & 1 ? registers[operand] & value_mask(instruction->format) : operand;
+}
+
+static uint64_t evaluate_trace_scalar(const TraceInstruction *instruction, const uint64_t *registers) {
+    Number numbers[MAX_OPERANDS];
+    for (uint8_t k = 0; k < operand_count(instruction->operation); ++k)
+        numbers[k] = to_IEEE754_standard(instruction->format, trace_operand(instruction, k, registers));
+    return pack_number(apply_operation(instruction->rounding, instruction->operation, numbers));
+}
+
+// Evaluates instructions none of which reads a register that another of them writes, so that all of them see the
+// registers as they were before the group. Longer groups are sorted by kind into lanes for the batch kernels; short
+// ones, and kinds with few instructions in the group, go through the scalar operations one instruction at a time.
+// lanes and lane_results hold count lanes, order count indices.
+static void evaluate_trace_group(const TraceInstruction *instructions, int64_t count, const uint64_t *registers, uint64_t *results, uint64_t *lanes, uint64_t *lane_results, int32_t *order) {
+    if (count < TRACE_MIN_BATCH) {
+        for (int64_t i = 0; i < count; ++i)
+            results[i] = evaluate_trace_scalar(&instructions[i], registers);
+        return;
+    }
+    int32_t starts[TRACE_KINDS + 1] = {0};
+    int32_t next[TRACE_KINDS];
+    for (int64_t i = 0; i < count; ++i)
+        ++starts[instructions[i].kind + 1];
+    for (size_t kind = 0; kind < TRACE_KINDS; ++kind) {
+        starts[kind + 1] += starts[kind];
+        next[kind] = starts[kind];
+    }
+    for (int64_t i = 0; i < count; ++i)
+        order[next[instructions[i].kind]++] = (int32_t) i;
+    for (size_t kind = 0; kind < TRACE_KINDS; ++kind) {
+        int32_t lane_count = starts[kind + 1] - starts[kind];
+        const int32_t *members = order + starts[kind];
+        if (lane_count < TRACE_MIN_BATCH) {
+            for (int32_t lane = 0; lane < lane_count; ++lane)
+                results[members[lane]] = evaluate_trace_scalar(&instructions[members[lane]], registers);
+            continue;
+        }
+        const TraceInstruction *first = &instructions[members[0]];
+        uint8_t arity = operand_count(first->operation);
+        for (int32_t lane = 0; lane < lane_count; ++lane) {
+            for (uint8_t k = 0; k < arity; ++k)
+                lanes[arity * lane + k] = trace_operand(&instructions[members[lane]], k, registers);
+        }
+        evaluate_formats(first->format, first->rounding, first->operation, true, lanes, lane_results, NULL, lane_count);
+        for (int32_t lane = 0; lane < lane_count; ++lane)
+            results[members[lane]] = lane_results[lane];
+    }
+}
+
+int run_trace(bool binary, FILE *in, FILE *out, FILE *registers_out) {
+    TraceInstruction *instructions = malloc(sizeof(TraceInstruction) * TRACE_CHUNK);
+    unsigned char *raw = malloc(TRACE_CHUNK * TRACE_RECORD_MAX);
+    char *text = malloc(sizeof(uint64_t) * 3 * TRACE_CHUNK);
+    uint64_t *results = malloc(sizeof(uint64_t) * TRACE_CHUNK);
+    uint64_t *lanes = malloc(sizeof(uint64_t) * MAX_OPERANDS * TRACE_CHUNK);
+    uint64_t *lane_results = malloc(sizeof(uint64_t) * TRACE_CHUNK);
+    int32_t *order = malloc(sizeof(int32_t) * TRACE_CHUNK);
+    uint64_t *registers = calloc(TRACE_REGISTERS, sizeof(uint64_t));
+    // the group that last wrote each register, and the format of that write; FORMAT_COUNT if none did
+    uint32_t *written = calloc(TRACE_REGISTERS, sizeof(uint32_t));
+    uint8_t *register_formats = malloc(TRACE_REGISTERS);
+    if (!instructions || !raw || !text || !results || !lanes || !lane_results || !order || !registers || !written ||
+        !register_formats) {
+        free(instructions);
+        free(raw);
+        free(text);
+        free(results);
+        free(lanes);
+        free(lane_results);
+        free(order);
+        free(registers);
+        free(written);
+        free(register_formats);
+        fprintf(stderr, "Error: not enough memory\n");
+        return ERROR_NOTENOUGH_MEMORY;
+    }
+    memset(register_formats, FORMAT_COUNT, TRACE_REGISTERS);
+    struct timespec start_time, end_time;
+    timespec_get(&start_time, TIME_UTC);
+    int status = SUCCESS;
+    size_t buffered = 0;
+    uint32_t group = 1;
+    int64_t total = 0, groups = 0;
+    int64_t count;
+    while (status == SUCCESS && (count = read_trace(in, raw, &buffered, instructions, TRACE_CHUNK, &status)) > 0) {
+        // a group ends before the first instruction that reads a register written in it
+        int64_t start = 0;
+        for (int64_t i = 0; i <= count; ++i) {
+            bool dependent = i == count;
+            for (uint8_t k = 0; !dependent && k < operand_count(instructions[i].operation); ++k)
+                dependent = (instructions[i].registers >> k & 1) && written[instructions[i].operands[k]] == group;
+            if (dependent && i > start) {
+                evaluate_trace_group(instructions + start, i - start, registers, results + start, lanes, lane_results, order);
+                for (int64_t k = start; k < i; ++k) {
+                    registers[instructions[k].destination] = results[k];
+                    register_formats[instructions[k].destination] = instructions[k].format;
+                }
+                ++group;
+                ++groups;
+                start = i;
+            }
+            if (i < count)
+                written[instructions[i].destination] = group;
+        }
+        size_t length = 0;
+        for (int64_t i = 0; i < count; ++i) {
+            uint8_t width = format_width(instructions[i].format);
+            if (binary) {
+                narrow_values(&results[i], (unsigned char *) text + length, 1, width);
+                length += width;
+            } else {
+                length += format_hex(&results[i], 1, 2 * width, text + length);
+            }
+        }
+        fwrite(text, 1, length, out);
+        total += count;
+    }
+    timespec_get(&end_time, TIME_UTC);
+    if (status != SUCCESS) {
+        fprintf(stderr, "Error: invalid trace\n");
+    } else {
+        double seconds = (double) (end_time.tv_sec - start_time.tv_sec) + (double) (end_time.tv_nsec - start_time.tv_nsec) * 1e-9;
+        fprintf(stderr, "%" PRId64 " operations in %.3f s: %.0f ops/s, %" PRId64 " groups of %.1f on average\n", total,
+                seconds, seconds > 0 ? (double) total / seconds : 0.0, groups, groups ? (double) total / (double) groups : 0.0);
+        for (uint32_t r = 0; registers_out && r < TRACE_REGISTERS; ++r) {
+            if (register_formats[r] < FORMAT_COUNT)
+                fprintf(registers_out, "%" PRIu32 " %s %0*" PRIx64 "\n", r, FORMAT_TRAITS[register_formats[r]].name,
+                        2 * format_width(register_formats[r]), registers[r]);
+        }
+    }
+    free(instructions);
+    free(raw);
+    free(text);
+    free(results);
+    free(lanes);
+    free(lane_results);
+    free(order);
+    free(registers);
+    free(written);
+    free(register_formats);
+    return status;
+}
+
+// --trace <hex|bin> <trace> [results] [registers]: replays a binary instruction trace (stdin if "-") on TRACE_REGISTERS
+// registers, zero at the start. An instruction is an 8-byte header: the operation (+, -, *, / or f for fma, s for
+// sqrt), the format (0 f, 1 h, 2 b, 3 d, 4 e4m3, 5 e5m2), the rounding mode, a mask whose bit i makes operand i a
+// register number rather than a value, and the 32-bit destination register; then a 64-bit operand per input, all in
+// native byte order. A register read in a format gives the low bits the format takes. Results go to results (stdout
+// if omitted or "-"), one per instruction as in --batch streams of its format; the registers written, with the format
+// of the last write, go to registers if given, and the throughput to stderr.
+int trace_main(int argc, char *argv[]) {
+    bool binary = strcmp(argv[2], "bin") == 0;
+    if (!binary && strcmp(argv[2], "hex") != 0) {
+        fprintf(stderr, "Error: Unsupported stream format: %s\n", argv[2]);
+        return ERROR_ARGUMENTS_INVALID;
+    }
+    FILE *in = strcmp(argv[3], "-") != 0 ? fopen(argv[3], "rb") : stdin;
+    if (!in) {
+        fprintf(stderr, "Error: cannot open file %s\n", argv[3]);
+        return ERROR_CANNOT_OPEN_FILE;
+    }
+    FILE *out = argc > 4 && strcmp(argv[4], "-") != 0 ? fopen(argv[4], "wb") : stdout;
+    if (!out) {
+        fprintf(stderr, "Error: cannot open file %s\n", argv[4]);
+        if (in != stdin)
+            fclose(in);
+        return ERROR_CANNOT_OPEN_FILE;
+    }
+    FILE *registers_out = argc > 5 ? fopen(argv[5], "w") : NULL;
+    if (argc > 5 && !registers_out) {
+        fprintf(stderr, "Error: cannot open file %s\n", argv[5]);
+        if (in != stdin)
+            fclose(in);
+        if (out != stdout)
+            fclose(out);
+        return ERROR_CANNOT_OPEN_FILE;
+    }
+    int ret = run_trace(binary, in, out, registers_out);
+    if (in != stdin)
+        fclose(in);
+    if (out != stdout && fclose(out) != 0 && ret == SUCCESS) {
+        fprintf(stderr, "Error: cannot write file %s\n", argv[4]);
+        ret = ERROR_CANNOT_OPEN_FILE;
+    }
+    if (registers_out && fclose(registers_out) != 0 && ret == SUCCESS) {
+        fprintf(stderr, "Error: cannot write file %s\n", argv[5]);
+        ret = ERROR_CANNOT_OPEN_FILE;
+    }
+    return ret;
+}
+
+// Lanes per exponent gap and passes over them in --bench.
+#define BENCH_LANES 4096
+#define BENCH_PASSES 64
+
+// Times the scalar path on operands whose exponents differ by every gap the format allows, so that any latency that
+// depends on the gap shows up as a slope in the output. The first operand carries the gap over the last, which is the
+// smallest normal number with a random sign; fma multiplies the first by a number in [1, 2), so its product and addend
+// are that far apart, and sqrt simply takes roots of numbers across the whole exponent range.
+int run_bench(uint8_t format, uint8_t rounding, char operation) {
+    uint8_t arity = operand_count(operation);
+    Number *operands = malloc(sizeof(Number) * arity * BENCH_LANES);
+    if (!operands) {
+        fprintf(stderr, "Error: not enough memory\n");
+        return ERROR_NOTENOUGH_MEMORY;
+    }
+    uint32_t seed = 1;
+    uint64_t checksum = 0;
+    printf("gap,ns_per_op\n");
+    for (uint32_t gap = 0; gap < (uint32_t) exp_mask(format) - 1; ++gap) {
+        for (int i = 0; i < BENCH_LANES; ++i) {
+            for (uint8_t k = 0; k < arity; ++k) {
+                seed = seed * 1664525 + 1013904223;
+                uint64_t number = (seed & mant_mask(format)) | (uint64_t) exp_offset(format) << mant_size(format);
+                if (k == 0) {
+                    number = (uint64_t) (gap + 1) << mant_size(format) | (seed & mant_mask(format));
+                } else if (k == arity - 1) {
+                    number = implicit_bit(format) | (seed & mant_mask(format)) |
+                             (uint64_t) (seed >> 31) << sign_shift(format);
+                }
+                operands[arity * i + k] = to_IEEE754_standard(format, number);
+            }
+        }
+        struct timespec start, end;
+        timespec_get(&start, TIME_UTC);
+        for (int pass = 0; pass < BENCH_PASSES; ++pass) {
+            for (int i = 0; i < BENCH_LANES; ++i) {
+                Number result = apply_operation(rounding, operation, &operands[arity * i]);
+                checksum += result.mantissa ^ (uint64_t) result.exponent;
+            }
+        }
+        timespec_get(&end, TIME_UTC);
+        double elapsed = (double) (end.tv_sec - start.tv_sec) * 1e9 + (double) (end.tv_nsec - start.tv_nsec);
+        printf("%" PRIu32 ",%.2f\n", gap, elapsed / ((double) BENCH_PASSES * BENCH_LANES));
+    }
+    // keeps the results observable so the timed loop cannot be dropped
+    fprintf(stderr, "checksum %016" PRIx64 "\n", checksum);
+    free(operands);
+    return SUCCESS;
+}
+
+int bench_main(int argc, char *argv[]) {
+    (void) argc;
+    uint8_t format = FORMAT_SINGLE;
+    char operation = '\0';
+    uint8_t rounding = TOWARD_ZERO;
+    int ret = parse_mode_arguments(argv, &format, &rounding, &operation);
+    if (ret != SUCCESS) {
+        return ret;
+    }
+    return run_bench(format, rounding, operation);
+}
+
+// Lanes and passes over them in --lut-bench.
+#define TABLE_BENCH_LANES (1 << 20)
+#define TABLE_BENCH_PASSES 16
+
+// Times a batch of random finite half precision operands on the computed kernels and on the table backend, and checks
+// that both give the same results.
+int run_table_bench(uint8_t rounding, char operation) {
+    uint8_t arity = operand_count(operation);
+    uint64_t *operands = malloc(sizeof(uint64_t) * arity * TABLE_BENCH_LANES);
+    uint64_t *computed = malloc(sizeof(uint64_t) * TABLE_BENCH_LANES);
+    uint64_t *table = malloc(sizeof(uint64_t) * TABLE_BENCH_LANES);
+    if (!operands || !computed || !table) {
+        free(operands);
+        free(computed);
+        free(table);
+        fprintf(stderr, "Error: not enough memory\n");
+        return ERROR_NOTENOUGH_MEMORY;
+    }
+    uint32_t seed = 1;
+    for (int64_t i = 0; i < (int64_t) arity * TABLE_BENCH_LANES; ++i) {
+        seed = seed * 1664525 + 1013904223;
+        uint64_t magnitude = (seed >> 8) % inf_bits(FORMAT_HALF);
+        operands[i] = (uint64_t) (seed >> 31) << sign_shift(FORMAT_HALF) | magnitude;
+    }
+    struct timespec start, end;
+    timespec_get(&start, TIME_UTC);
+    build_half_tables();
+    timespec_get(&end, TIME_UTC);
+    double build = (double) (end.tv_sec - start.tv_sec) * 1e3 + (double) (end.tv_nsec - start.tv_nsec) * 1e-6;
+    printf("backend,ns_per_lane\n");
+    for (int backend = 0; backend < 2; ++backend) {
+        // pass -1 is a warm-up that leaves page faults and cold tables out of the timing
+        for (int pass = -1; pass < TABLE_BENCH_PASSES; ++pass) {
+            if (pass == 0)
+                timespec_get(&start, TIME_UTC);
+            if (backend)
+                evaluate_half_table(rounding, operation, operands, table, TABLE_BENCH_LANES);
+            else
+                evaluate_batch(FORMAT_HALF, rounding, operation, operands, computed, TABLE_BENCH_LANES);
+        }
+        timespec_get(&end, TIME_UTC);
+        double elapsed = (double) (end.tv_sec - start.tv_sec) * 1e9 + (double) (end.tv_nsec - start.tv_nsec);
+        printf("%s,%.2f\n", backend ? "table" : "computed", elapsed / ((double) TABLE_BENCH_PASSES * TABLE_BENCH_LANES));
+    }
+    fprintf(stderr, "tables built in %.1f ms\n", build);
+    int ret = memcmp(computed, table, sizeof(uint64_t) * TABLE_BENCH_LANES) == 0 ? SUCCESS : ERROR_DATA_INVALID;
+    if (ret != SUCCESS)
+        fprintf(stderr, "Error: the backends disagree\n");
+    free(operands);
+    free(computed);
+    free(table);
+    return ret;
+}
+
+int table_bench_main(int argc, char *argv[]) {
+    (void) argc;
+    uint8_t format = FORMAT_SINGLE;
+    char operation = '\0';
+    uint8_t rounding = TOWARD_ZERO;
+    int ret = parse_mode_arguments(argv, &format, &rounding, &operation);
+    if (ret != SUCCESS) {
+        return ret;
+    }
+    if (format != FORMAT_HALF) {
+        fprintf(stderr, "Error: --lut-bench only supports h\n");
+        return ERROR_ARGUMENTS_INVALID;
+    }
+    return run_table_bench(rounding, operation);
+}
+
+// Lanes and passes over them per operand distribution in --split-bench.
+#define SPLIT_BENCH_LANES (1 << 20)
+#define SPLIT_BENCH_PASSES 16
+
+static const char *const SPLIT_BENCH_DISTRIBUTIONS[] = {"near-one", "sparse", "rare-special", "full-range", "random-bits"};
+
+// xorshift64*: the operands of every format, d included, need more random bits than the LCGs above give.
+static uint64_t split_bench_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * UINT64_C(0x2545F4914F6CDD1D);
+}
+
+// An operand of the given distribution: normal numbers within a factor of 2^8 of one; the same with a quarter zeros,
+// like activations after a ReLU; the same with one operand in a thousand zero, subnormal, infinite or NaN; normal
+// numbers of any exponent; and uniformly random bit patterns.
+static uint64_t split_bench_operand(uint8_t format, int distribution, uint64_t *state) {
+    uint64_t bits = split_bench_random(state);
+    uint64_t control = split_bench_random(state);
+    if (distribution == 4)
+        return bits & value_mask(format);
+    uint64_t sign = bits >> 63 << sign_shift(format);
+    // the largest exponent field is left out, since E4M3 keeps its NaN there
+    int32_t max_exponent = exp_mask(format) - 1;
+    int32_t exponent = distribution == 3 ? 1 + (int32_t) (control % (uint64_t) max_exponent)
+                                         : exp_offset(format) + (int32_t) (control % 17) - 8;
+    exponent = exponent < 1 ? 1 : exponent > max_exponent ? max_exponent : exponent;
+    uint32_t pick = (uint32_t) (control >> 32) % 1000;
+    if (distribution == 1 && pick < 250)
+        return sign;
+    if (distribution == 2 && pick == 0) {
+        switch (control >> 62) {
+            case 0:
+                return sign;
+            case 1:
+                return sign | (bits & mant_mask(format)) | 1;
+            case 2:
+                return sign | overflow_bits(format);
+            default:
+                return quiet_nan_bits(format);
+        }
+    }
+    return sign | (uint64_t) exponent << mant_size(format) | (bits & mant_mask(format));
+}
+
+// Times binary operations on every lane through the general kernels and through the split by operand class, over
+// operand distributions from all normal to random bit patterns, and checks that both give the same results.
+int run_split_bench(uint8_t format, uint8_t rounding, char operation) {
+    uint64_t *operands = malloc(sizeof(uint64_t) * 2 * SPLIT_BENCH_LANES);
+    uint64_t *general = malloc(sizeof(uint64_t) * SPLIT_BENCH_LANES);
+    uint64_t *split = malloc(sizeof(uint64_t) * SPLIT_BENCH_LANES);
+    if (!operands || !general || !split) {
+        free(operands);
+        free(general);
+        free(split);
+        fprintf(stderr, "Error: not enough memory\n");
+        return ERROR_NOTENOUGH_MEMORY;
+    }
+    int ret = SUCCESS;
+    uint64_t state = UINT64_C(0x9E3779B97F4A7C15);
+    printf("distribution,slow_lanes,general_ns_per_lane,split_ns_per_lane\n");
+    for (int distribution = 0; distribution < 5; ++distribution) {
+        int64_t slow = 0;
+        for (int64_t i = 0; i < SPLIT_BENCH_LANES; ++i) {
+            operands[2 * i] = split_bench_operand(format, distribution, &state);
+            operands[2 * i + 1] = split_bench_operand(format, distribution, &state);
+            slow += !is_normal_bits(format, operands[2 * i]) | !is_normal_bits(format, operands[2 * i + 1]);
+        }
+        double ns[2];
+        for (int backend = 0; backend < 2; ++backend) {
+            struct timespec start, end;
+            // pass -1 is a warm-up that leaves page faults out of the timing
+            for (int pass = -1; pass < SPLIT_BENCH_PASSES; ++pass) {
+                if (pass == 0)
+                    timespec_get(&start, TIME_UTC);
+                evaluate_formats(format, rounding, operation, backend, operands, backend ? split : general, NULL,
+                                 SPLIT_BENCH_LANES);
+            }
+            timespec_get(&end, TIME_UTC);
+            double elapsed = (double) (end.tv_sec - start.tv_sec) * 1e9 + (double) (end.tv_nsec - start.tv_nsec);
+            ns[backend] = elapsed / ((double) SPLIT_BENCH_PASSES * SPLIT_BENCH_LANES);
+        }
+        printf("%s,%.2f%%,%.2f,%.2f\n", SPLIT_BENCH_DISTRIBUTIONS[distribution], 100.0 * (double) slow / SPLIT_BENCH_LANES,
+               ns[0], ns[1]);
+        if (memcmp(general, split, sizeof(uint64_t) * SPLIT_BENCH_LANES) != 0) {
+            fprintf(stderr, "Error: the split disagrees with the general kernels on %s operands\n",
+                    SPLIT_BENCH_DISTRIBUTIONS[distribution]);
+            ret = ERROR_DATA_INVALID;
+        }
+    }
+    free(operands);
+    free(general);
+    free(split);
+    return ret;
+}
+
+int split_bench_main(int argc, char *argv[]) {
+    (void) argc;
+    uint8_t format = FORMAT_SINGLE;
+    char operation = '\0';
+    uint8_t rounding = TOWARD_ZERO;
+    int ret = parse_mode_arguments(argv, &format, &rounding, &operation);
+    if (ret != SUCCESS) {
+        return ret;
+    }
+    if (operand_count(operation) != 2) {
+        fprintf(stderr, "Error: --split-bench only supports + - * /\n");
+        return ERROR_ARGUMENTS_INVALID;
+    }
+    return run_split_bench(format, rounding, operation);
+}
+
+// Times evaluate_batch against evaluate_batch_flags on the operand distributions of --split-bench, so the cost of the
+// flags shows per distribution, and checks that both give the same results.
+int run_flags_bench(uint8_t format, uint8_t rounding, char operation) {
+    uint8_t arity = operand_count(operation);
+    uint64_t *operands = malloc(sizeof(uint64_t) * arity * SPLIT_BENCH_LANES);
+    uint64_t *plain = malloc(sizeof(uint64_t) * SPLIT_BENCH_LANES);
+    uint64_t *flagged = malloc(sizeof(uint64_t) * SPLIT_BENCH_LANES);
+    uint8_t *flags = malloc(SPLIT_BENCH_LANES);
+    if (!operands || !plain || !flagged || !flags) {
+        free(operands);
+        free(plain);
+        free(flagged);
+        free(flags);
+        fprintf(stderr, "Error: not enough memory\n");
+        return ERROR_NOTENOUGH_MEMORY;
+    }
+    int ret = SUCCESS;
+    uint64_t state = UINT64_C(0x9E3779B97F4A7C15);
+    printf("distribution,plain_ns_per_lane,flags_ns_per_lane,overhead\n");
+    for (int distribution = 0; distribution < 5; ++distribution) {
+        for (int64_t i = 0; i < arity * SPLIT_BENCH_LANES; ++i)
+            operands[i] = split_bench_operand(format, distribution, &state);
+        double ns[2];
+        uint8_t sticky = 0;
+        for (int backend = 0; backend < 2; ++backend) {
+            struct timespec start, end;
+            // pass -1 is a warm-up that leaves page faults out of the timing
+            for (int pass = -1; pass < SPLIT_BENCH_PASSES; ++pass) {
+                if (pass == 0)
+                    timespec_get(&start, TIME_UTC);
+                if (backend)
+                    sticky |= evaluate_batch_flags(format, rounding, operation, operands, flagged, flags, SPLIT_BENCH_LANES);
+                else
+                    evaluate_batch(format, rounding, operation, operands, plain, SPLIT_BENCH_LANES);
+            }
+            timespec_get(&end, TIME_UTC);
+            double elapsed = (double) (end.tv_sec - start.tv_sec) * 1e9 + (double) (end.tv_nsec - start.tv_nsec);
+            ns[backend] = elapsed / ((double) SPLIT_BENCH_PASSES * SPLIT_BENCH_LANES);
+        }
+        printf("%s,%.2f,%.2f,%.1f%%\n", SPLIT_BENCH_DISTRIBUTIONS[distribution], ns[0], ns[1], 100.0 * (ns[1] / ns[0] - 1));
+        // keeps the flags observable so that computing them cannot be dropped
+        fprintf(stderr, "%s ", SPLIT_BENCH_DISTRIBUTIONS[distribution]);
+        print_flags(stderr, sticky);
+        if (memcmp(plain, flagged, sizeof(uint64_t) * SPLIT_BENCH_LANES) != 0) {
+            fprintf(stderr, "Error: the results with flags differ on %s operands\n", SPLIT_BENCH_DISTRIBUTIONS[distribution]);
+            ret = ERROR_DATA_INVALID;
+        }
+    }
+    free(operands);
+    free(plain);
+    free(flagged);
+    free(flags);
+    return ret;
+}
+
+int flags_bench_main(int argc, char *argv[]) {
+    (void) argc;
+    uint8_t format = FORMAT_SINGLE;
+    char operation = '\0';
+    uint8_t rounding = TOWARD_ZERO;
+    int ret = parse_mode_arguments(argv, &format, &rounding, &operation);
+    if (ret != SUCCESS) {
+        return ret;
+    }
+    return run_flags_bench(format, rounding, operation);
+}
+
+// Mismatches printed by --exhaustive before it only counts them.
+#define EXHAUSTIVE_REPORTED 10
+
+#if defined(__FLT16_MANT_DIG__)
+// Host fma: the double fma of half operands is rounded to odd, which keeps enough bits for the conversion to half to
+// round correctly in every mode. A zero is exact, but its sign depends on the mode, so it is computed again in the
+// right one. The volatile accesses keep the fma between the rounding mode changes.
+static _Float16 host_fma(int rounding_mode, _Float16 a, _Float16 b, _Float16 c) {
+    fesetround(FE_TOWARDZERO);
+    feclearexcept(FE_INEXACT);
+    volatile double addend = c;
+    volatile double result = __builtin_fma(a, b, addend);
+    uint64_t bits;
+    double truncated = result;
+    memcpy(&bits, &truncated, sizeof(bits));
+    bits |= fetestexcept(FE_INEXACT) != 0;
+    memcpy(&truncated, &bits, sizeof(bits));
+    fesetround(rounding_mode);
+    if (truncated == 0) {
+        result = __builtin_fma(a, b, addend);
+        truncated = result;
+    }
+    return (_Float16) truncated;
+}
+
+// The conversion is exact for the arithmetic operations and rounds to odd for fma; sqrt in double has more than
+// twice the bits of half, so rounding it twice gives the same result as rounding once.
+static _Float16 host_operation(char operation, int rounding_mode, _Float16 a, _Float16 b, _Float16 c) {
+    switch (operation) {
+        case '+':
+            return a + b;
+        case '-':
+            return a - b;
+        case '*':
+            return a * b;
+        case OPERATION_FMA:
+            return host_fma(rounding_mode, a, b, c);
+        case OPERATION_SQRT:
+            return (_Float16) __builtin_sqrt(a);
+        default:
+            return a / b;
+    }
+}
+
+// The host's raised exceptions as flags.
+static uint8_t host_flags(int exceptions) {
+    return (exceptions & FE_INVALID ? EXCEPTION_INVALID : 0) | (exceptions & FE_DIVBYZERO ? EXCEPTION_DIVIDE_BY_ZERO : 0) |
+           (exceptions & FE_OVERFLOW ? EXCEPTION_OVERFLOW : 0) | (exceptions & FE_UNDERFLOW ? EXCEPTION_UNDERFLOW : 0) |
+           (exceptions & FE_INEXACT ? EXCEPTION_INEXACT : 0);
+}
+
+static int host_rounding(uint8_t rounding) {
+    switch (rounding) {
+        case TOWARD_ZERO:
+            return FE_TOWARDZERO;
+        case TOWARD_POS_INF:
+            return FE_UPWARD;
+        case TOWARD_NEG_INF:
+            return FE_DOWNWARD;
+        default:
+            return FE_TONEAREST;
+    }
+}
+
+// Addend paired with a and b in the fma sweep: all 2^48 triples are out of reach, so every product meets one
+// pseudo-random addend instead.
+static ALWAYS_INLINE uint32_t exhaustive_addend(uint32_t a, uint32_t b) {
+    uint32_t hash = a * 0x9E3779B1u ^ b * 0x85EBCA77u;
+    return (hash ^ hash >> 16) & 0xFFFF;
+}
+
+// Sweeps every half precision operand of sqrt, every pair of the other operations (fma with the addend above) and
+// compares every result and its flags with the host's _Float16 arithmetic in the same rounding mode. NaNs only have to
+// agree on being NaN. x86 detects tininess after rounding, like round_number; hosts that detect it before rounding
+// differ on underflow.
+int run_exhaustive(uint8_t rounding, char operation) {
+    Number *numbers = malloc(sizeof(Number) * 0x10000);
+    _Float16 *host = malloc(sizeof(_Float16) * 0x10000);
+    if (!numbers || !host) {
+        free(numbers);
+        free(host);
+        fprintf(stderr, "Error: not enough memory\n");
+        return ERROR_NOTENOUGH_MEMORY;
+    }
+    for (uint32_t bits = 0; bits < 0x10000; ++bits) {
+        uint16_t half = (uint16_t) bits;
+        numbers[bits] = to_IEEE754_standard(FORMAT_HALF, half);
+        memcpy(&host[bits], &half, sizeof(half));
+    }
+    uint8_t arity = operand_count(operation);
+    uint32_t second_count = arity > 1 ? 0x10000 : 1;
+    uint64_t mismatches = 0;
+    int reported = 0;
+    struct timespec start, end;
+    timespec_get(&start, TIME_UTC);
+#pragma omp parallel reduction(+:mismatches)
+    {
+        // the rounding mode is per thread
+        int rounding_mode = host_rounding(rounding);
+        fesetround(rounding_mode);
+#pragma omp for schedule(dynamic, 64)
+        for (int32_t a = 0; a < 0x10000; ++a) {
+            for (uint32_t b = 0; b < second_count; ++b) {
+                uint32_t c = arity > 2 ? exhaustive_addend((uint32_t) a, b) : 0;
+                Number operands[MAX_OPERANDS] = {numbers[a], numbers[b], numbers[c]};
+                Number number = apply_operation(rounding, operation, operands);
+                uint64_t got = pack_number(number);
+                // the volatile accesses keep the host's arithmetic between clearing the exceptions and testing them
+                volatile _Float16 host_a = host[a], host_b = host[b], host_c = host[c];
+                feclearexcept(FE_ALL_EXCEPT);
+                volatile _Float16 result = host_operation(operation, rounding_mode, host_a, host_b, host_c);
+                uint8_t expected_flags = host_flags(fetestexcept(FE_ALL_EXCEPT));
+                _Float16 host_result = result;
+                uint16_t expected;
+                memcpy(&expected, &host_result, sizeof(expected));
+                bool both_nan = (got & abs_mask(FORMAT_HALF)) >= nan_bits(FORMAT_HALF) &&
+                                (expected & abs_mask(FORMAT_HALF)) >= nan_bits(FORMAT_HALF);
+                if ((got != expected && !both_nan) || number.flags != expected_flags) {
+                    ++mismatches;
+#pragma omp critical(exhaustive_report)
+                    if (reported < EXHAUSTIVE_REPORTED) {
+                        ++reported;
+                        if (arity == 1) {
+                            printf("sqrt %04" PRIx32, (uint32_t) a);
+                        } else if (arity == 2) {
+                            printf("%04" PRIx32 " %c %04" PRIx32, (uint32_t) a, operation, b);
+                        } else {
+                            printf("fma %04" PRIx32 " %04" PRIx32 " %04" PRIx32, (uint32_t) a, b, c);
+                        }
+                        printf(": got %04" PRIx64 " flags %02" PRIx8 ", expected %04" PRIx16 " flags %02" PRIx8 "\n", got,
+                               number.flags, expected, expected_flags);
+                    }
+                }
+            }
+        }
+        fesetround(FE_TONEAREST);
+    }
+    timespec_get(&end, TIME_UTC);
+    double elapsed = (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) * 1e-9;
+    double total = (double) second_count * 0x10000;
+    printf("mismatches: %" PRIu64 " of %.0f\n", mismatches, total);
+    printf("elapsed: %.1f s, %.1f Mcases/s\n", elapsed, total / elapsed * 1e-6);
+    free(numbers);
+    free(host);
+    return mismatches ? ERROR_DATA_INVALID : SUCCESS;
+}
+#else
+int run_exhaustive(uint8_t rounding, char operation) {
+    (void) rounding;
+    (void) operation;
+    fprintf(stderr, "Error: the compiler has no _Float16 to compare with\n");
+    return ERROR_UNSUPPORTED;
+}
+#endif
+
+int exhaustive_main(int argc, char *argv[]) {
+    (void) argc;
+    uint8_t format = FORMAT_SINGLE;
+    char operation = '\0';
+    uint8_t rounding = TOWARD_ZERO;
+    int ret = parse_mode_arguments(argv, &format, &rounding, &operation);
+    if (ret != SUCCESS) {
+        return ret;
+    }
+    if (format != FORMAT_HALF) {
+        fprintf(stderr, "Error: --exhaustive only supports h\n");
+        return ERROR_ARGUMENTS_INVALID;
+    }
+    return run_exhaustive(rounding, operation);
+}
+
+// main <format> <rounding> <a> [<op> <b> | sqrt | fma <b> <c>], or one of the modes above.
+int main(int argc, char *argv[]) {
+    if (argc >= 4 && argc <= 6 && strcmp(argv[1], "--trace") == 0) {
+        return trace_main(argc, argv);
+    }
+    if (argc >= 6 && argc <= 8 &&
+        (strcmp(argv[3], "--batch") == 0 || strcmp(argv[3], "--lut") == 0 || strcmp(argv[3], "--flags") == 0)) {
+        return batch_main(argc, argv);
+    }
+    if (argc >= 6 && argc <= 8 && strcmp(argv[3], "--convert") == 0) {
+        return convert_main(argc, argv);
+    }
+    if (argc == 5 && strcmp(argv[3], "--bench") == 0) {
+        return bench_main(argc, argv);
+    }
+    if (argc == 5 && strcmp(argv[3], "--lut-bench") == 0) {
+        return table_bench_main(argc, argv);
+    }
+    if (argc == 5 && strcmp(argv[3], "--split-bench") == 0) {
+        return split_bench_main(argc, argv);
+    }
+    if (argc == 5 && strcmp(argv[3], "--flags-bench") == 0) {
+        return flags_bench_main(argc, argv);
+    }
+    if (argc == 5 && strcmp(argv[3], "--exhaustive") == 0) {
+        return exhaustive_main(argc, argv);
+    }
+    uint8_t format = FORMAT_SINGLE;
+    char operation = '\0';
+    uint8_t rounding = TOWARD_ZERO;
+    uint64_t numbers[MAX_OPERANDS] = {0};
+
+    switch (argc) {
+        case 5:
+        case 6:
+        case 7:
+            if (!parse_operation(argv[4], &operation)) {
+                fprintf(stderr, "Error: Unsupported operation: %s\n", argv[4]);
+                return ERROR_ARGUMENTS_INVALID;
+            }
+            if (operand_count(operation) != argc - 4) {
+                fprintf(stderr, "Error: %s takes %d operands\n", argv[4], operand_count(operation));
+                return ERROR_ARGUMENTS_INVALID;
+            }
+            for (int i = 1; i < operand_count(operation); ++i) {
+                if (sscanf(argv[4 + i], "%" SCNx64, &numbers[i]) < 1) {
+                    fprintf(stderr, "Error: invalid input format\n");
+                    return ERROR_DATA_INVALID;
+                }
+            }
+        case 4:
+            if (sscanf(argv[2], "%hhu", &rounding) + sscanf(argv[3], "%" SCNx64, &numbers[0]) < 2) {
+                fprintf(stderr, "Error: invalid datatype\n");
+                return ERROR_DATA_INVALID;
+            }
+            if (!parse_format(argv[1], &format)) {
+                fprintf(stderr, "Error: Unsupported data format: %s\n", argv[1]);
+                return ERROR_ARGUMENTS_INVALID;
+            }
+            if (rounding > TOWARD_NEG_INF) {
+                fprintf(stderr, "Error: Unsupported rounding type: %hhd\n", rounding);
+                return ERROR_ARGUMENTS_INVALID;
+            }
+            for (int i = 0; i < MAX_OPERANDS; ++i) {
+                if (numbers[i] > value_mask(format)) {
+                    fprintf(stderr, "Error: operand does not fit the format\n");
+                    return ERROR_DATA_INVALID;
+                }
+            }
+            break;
+        default:
+            fprintf(stderr, "Error: Invalid input format\n");
+            return ERROR_ARGUMENTS_INVALID;
+    }
+
+    Number num = to_IEEE754_standard(format, numbers[0]);
+    if (argc > 4) {
+        Number operands[MAX_OPERANDS];
+        for (int i = 0; i < MAX_OPERANDS; ++i)
+            operands[i] = to_IEEE754_standard(format, numbers[i]);
+        num = apply_operation(rounding, operation, operands);
     }
     print_result(num);
     return SUCCESS;
@@ -1,19 +1,27 @@
 #include "audio_util.h"
+#include "kernels.h"
+#include "profile.h"
 #include "return_codes.h"
-#include <fftw3.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
-#include <libswresample/swresample.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 
+// Decoded ahead of a --window start after seeking, in seconds.
+#define WINDOW_PREROLL 0.2
+
 void init_audio_info(AudioInfo *channel) {
 	memset(channel, 0, sizeof(AudioInfo));
 }
 
+void set_decode_window(AudioInfo *audio_info, double start, double len) {
+	audio_info->window.start = start;
+	audio_info->window.len = len;
+}
+
 void free_samples_mem(float **samples) {
 	if (*samples) {
 		free(*samples);
@@ -27,9 +35,13 @@ void free_resources(AudioInfo channel) {
 	avcodec_free_context(&channel.codec_context);
 	avformat_close_input(&channel.format_context);
 	free(channel.samples);
+	if (channel.resampler) {
+		resampler_free(channel.resampler);
+		free(channel.resampler);
+	}
 }
 
-int open_and_find_stream_info(const char *filepath, AVFormatContext **format_context) {
+static int open_input(const char *filepath, AVFormatContext **format_context) {
 	int ret = avformat_open_input(format_context, filepath, NULL, NULL);
 	switch (ret) {
 		case AVERROR(EINVAL):
@@ -60,6 +72,13 @@ int open_and_find_stream_info(const char *filepath, AVFormatContext **format_con
 	return SUCCESS;
 }
 
+int open_and_find_stream_info(const char *filepath, AVFormatContext **format_context) {
+	ProfileMark mark = profile_begin();
+	int ret = open_input(filepath, format_context);
+	profile_end("open_and_find_stream_info", mark);
+	return ret;
+}
+
 int audio_stream_index(AVFormatContext *format_context, int start_idx) {
 	for (unsigned int i = start_idx; i < format_context->nb_streams; i++) {
 		if (format_context->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
@@ -73,13 +92,46 @@ int sample_rate(AVFormatContext *format_context, int index) {
 	return format_context->streams[index]->codecpar->sample_rate;
 }
 
-int decode_audio(AVCodecContext *codec_context, AVPacket *packet, AVFrame *frame, float **samples_arr, int32_t *samples_cnt, int32_t channel_num) {
+static int reserve_samples(float **samples_arr, int32_t samples_cnt, int append_cnt, size_t *curr_capacity) {
+	size_t required_size = (samples_cnt + append_cnt) * sizeof(float);
+	if (required_size > *curr_capacity) {
+		size_t new_capacity = required_size * 2;
+		float *resized_samples = realloc(*samples_arr, new_capacity);
+		if (resized_samples == NULL) {
+			fprintf(stderr, "Failed to allocate memory for samples while decoding\n");
+			return ERROR_NOTENOUGH_MEMORY;
+		}
+		*samples_arr = resized_samples;
+		profile_alloc(new_capacity - *curr_capacity);
+		*curr_capacity = new_capacity;
+	}
+	return SUCCESS;
+}
+
+// Position of frame in the stream from its timestamp, or right after the previous frame when it has none; sets
+// *skip and *keep to the part of the frame inside the window and marks the window done once decoding passed it.
+static void window_frame(DecodeWindow *window, const AVFrame *frame, int *skip, int *keep) {
+	*skip = 0;
+	*keep = frame->nb_samples;
+	if (window->len <= 0) return;
+	int64_t first = window->next_sample;
+	if (frame->best_effort_timestamp != AV_NOPTS_VALUE) {
+		first = av_rescale_q(frame->best_effort_timestamp - window->start_pts, window->time_base, (AVRational){1, window->rate});
+	}
+	window->next_sample = first + frame->nb_samples;
+	window->done = window->next_sample >= window->end_sample;
+	int64_t from = first > window->first_sample ? first : window->first_sample;
+	int64_t to = window->next_sample < window->end_sample ? window->next_sample : window->end_sample;
+	*skip = (int)(from - first);
+	*keep = to > from ? (int)(to - from) : 0;
+}
+
+int decode_audio(AVCodecContext *codec_context, AVPacket *packet, AVFrame *frame, float **samples_arr, int32_t *samples_cnt, size_t *samples_capacity, int32_t channel_num, Resampler *resampler, DecodeWindow *window) {
 	int send_ret = avcodec_send_packet(codec_context, packet);
 	if (send_ret < 0) {
 		fprintf(stderr, "Error submitting packet to the decoder\n");
 		return ERROR_UNKNOWN;
 	}
-	size_t curr_capacity = 0;
 	while (true) {
 		send_ret = avcodec_receive_frame(codec_context, frame);
 		if (send_ret == AVERROR(EAGAIN)) {
@@ -90,20 +142,24 @@ int decode_audio(AVCodecContext *codec_context, AVPacket *packet, AVFrame *frame
 			fprintf(stderr, "Error during receiving frame\n");
 			return ERROR_FORMAT_INVALID;
 		}
-		size_t required_size = (*samples_cnt + frame->nb_samples) * sizeof(float);
-		if (required_size > curr_capacity) {
-			size_t new_capacity = required_size * 2;
-			float *resized_samples = realloc(*samples_arr, required_size * 2);
-			if (resized_samples == NULL) {
-				free(samples_arr);
-				fprintf(stderr, "Failed to allocate memory for samples while decoding\n");
-				return ERROR_NOTENOUGH_MEMORY;
-			}
-			*samples_arr = resized_samples;
-			curr_capacity = new_capacity;
+		int skip = 0;
+		int keep = 0;
+		window_frame(window, frame, &skip, &keep);
+		if (keep == 0) continue;
+		const float *input = (const float *)frame->data[channel_num] + skip;
+		int append_cnt = resampler ? resampler_max_output(resampler, keep) : keep;
+		if (reserve_samples(samples_arr, *samples_cnt, append_cnt, samples_capacity) != SUCCESS) {
+			return ERROR_NOTENOUGH_MEMORY;
+		}
+		if (resampler) {
+			int resampled_cnt = 0;
+			int ret = resampler_process(resampler, input, keep, *samples_arr + *samples_cnt, &resampled_cnt);
+			if (ret != SUCCESS) return ret;
+			*samples_cnt += resampled_cnt;
+		} else {
+			memcpy(*samples_arr + *samples_cnt, input, keep * sizeof(float));
+			*samples_cnt += keep;
 		}
-		memcpy(*samples_arr + *samples_cnt, frame->data[channel_num], frame->nb_samples * sizeof(float));
-		*samples_cnt += frame->nb_samples;
 	}
 	return SUCCESS;
 }
@@ -116,6 +172,23 @@ bool is_supported_codec(unsigned int codec) {
 	     || codec == AV_CODEC_ID_AAC);
 }
 
+// Seeks to a keyframe WINDOW_PREROLL before the window, so that decoders with inter-frame state have settled when
+// the window starts. Streams that cannot seek are decoded from the start; window_frame skips up to the window.
+static void seek_to_window(AudioInfo *audio_info, const AVStream *stream, int audio_stream_idx) {
+	DecodeWindow *window = &audio_info->window;
+	window->rate = stream->codecpar->sample_rate;
+	window->time_base = stream->time_base;
+	window->start_pts = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+	window->first_sample = llround(window->start * window->rate);
+	window->end_sample = window->first_sample + llround(window->len * window->rate);
+	int64_t target = window->first_sample - llround(WINDOW_PREROLL * window->rate);
+	if (target <= 0) return;
+	int64_t timestamp = window->start_pts + av_rescale_q(target, (AVRational){1, window->rate}, window->time_base);
+	if (av_seek_frame(audio_info->format_context, audio_stream_idx, timestamp, AVSEEK_FLAG_BACKWARD) >= 0) {
+		window->next_sample = target;
+	}
+}
+
 int process_audio_stream(AudioInfo *audio_info, int audio_stream_idx) {
 	unsigned int codec = audio_info->format_context->streams[audio_stream_idx]->codecpar->codec_id;
 	if (!is_supported_codec(codec)) {
@@ -134,33 +207,36 @@ int process_audio_stream(AudioInfo *audio_info, int audio_stream_idx) {
 	}
 	avcodec_parameters_to_context(audio_info->codec_context, audio_info->format_context->streams[audio_stream_idx]->codecpar);
 	if (avcodec_open2(audio_info->codec_context, audio_info->codec, NULL) < 0) {
-		free_resources(*audio_info);
 		fprintf(stderr, "Could not open codec\n");
 		return ERROR_NOTENOUGH_MEMORY;
 	}
 	audio_info->frame = av_frame_alloc();
 	audio_info->packet = av_packet_alloc();
 	if (!audio_info->frame || !audio_info->packet) {
-		free_resources(*audio_info);
 		fprintf(stderr, "Could not allocate memory for frame/packet\n");
 		return ERROR_NOTENOUGH_MEMORY;
 	}
+	if (audio_info->window.len > 0) seek_to_window(audio_info, audio_info->format_context->streams[audio_stream_idx], audio_stream_idx);
 	return SUCCESS;
 }
 
-int decode_into_samples(AudioInfo *channel1, AudioInfo *channel2, int audio_stream_idx_1, int audio_stream_idx_2, int channel_1_idx, int channel_2_idx, int argc) {
+static int decode_inputs(AudioInfo *channel1, AudioInfo *channel2, int audio_stream_idx_1, int audio_stream_idx_2, int channel_1_idx, int channel_2_idx, int argc) {
 	bool cond = argc == 2;
-	while (av_read_frame(channel1->format_context, channel1->packet) >= 0) {
+	if (cond) {
+		// both channels come out of the same frames, each keeps its own position
+		channel2->window = channel1->window;
+	}
+	while (!channel1->window.done && av_read_frame(channel1->format_context, channel1->packet) >= 0) {
 		if (channel1->packet->stream_index == audio_stream_idx_1) {
 			if (decode_audio(channel1->codec_context, channel1->packet, channel1->frame,
-							 &channel1->samples, &channel1->samples_cnt, channel_1_idx) != SUCCESS) {
+							 &channel1->samples, &channel1->samples_cnt, &channel1->samples_capacity, channel_1_idx, channel1->resampler, &channel1->window) != SUCCESS) {
 				av_packet_unref(channel1->packet);
 				fprintf(stderr, "Error while decoding file\n");
 				return ERROR_DATA_INVALID;
 			}
 			if (cond) {
 				if (decode_audio(channel1->codec_context, channel1->packet, channel1->frame,
-								 &channel2->samples, &channel2->samples_cnt, channel_2_idx) != SUCCESS) {
+								 &channel2->samples, &channel2->samples_cnt, &channel2->samples_capacity, channel_2_idx, channel2->resampler, &channel2->window) != SUCCESS) {
 					av_packet_unref(channel1->packet);
 					fprintf(stderr, "Error while decoding file\n");
 					return ERROR_DATA_INVALID;
@@ -169,11 +245,12 @@ int decode_into_samples(AudioInfo *channel1, AudioInfo *channel2, int audio_stre
 		}
 		av_packet_unref(channel1->packet);
 	}
-	if (cond) return SUCCESS;
-	while (av_read_frame(channel2->format_context, channel2->packet) >= 0) {
+	int ret = flush_resampler(channel1);
+	if (ret != SUCCESS || cond) return ret;
+	while (!channel2->window.done && av_read_frame(channel2->format_context, channel2->packet) >= 0) {
 		if (channel2->packet->stream_index == audio_stream_idx_2) {
 			if (decode_audio(channel2->codec_context, channel2->packet, channel2->frame,
-							 &channel2->samples, &channel2->samples_cnt, channel_2_idx) != SUCCESS) {
+							 &channel2->samples, &channel2->samples_cnt, &channel2->samples_capacity, channel_2_idx, channel2->resampler, &channel2->window) != SUCCESS) {
 				av_packet_unref(channel2->packet);
 				fprintf(stderr, "Error while decoding file\n");
 				return ERROR_DATA_INVALID;
@@ -181,109 +258,214 @@ int decode_into_samples(AudioInfo *channel1, AudioInfo *channel2, int audio_stre
 		}
 		av_packet_unref(channel2->packet);
 	}
-	return SUCCESS;
+	return flush_resampler(channel2);
 }
 
-int find_max_index(const float *array, int size) {
-	int max_index = 0;
-	for (int i = 1; i < size; i++) {
-		if (array[i] > array[max_index]) {
-			max_index = i;
-		}
-	}
-	return max_index;
-}
-
-int next_deg(int len) {
-	len--;
-	len |= len >> 1;
-	len |= len >> 2;
-	len |= len >> 4;
-	len |= len >> 8;
-	len |= len >> 16;
-	len++;
-	return len;
+int decode_into_samples(AudioInfo *channel1, AudioInfo *channel2, int audio_stream_idx_1, int audio_stream_idx_2, int channel_1_idx, int channel_2_idx, int argc) {
+	ProfileMark mark = profile_begin();
+	int ret = decode_inputs(channel1, channel2, audio_stream_idx_1, audio_stream_idx_2, channel_1_idx, channel_2_idx, argc);
+	profile_end("decode_into_samples", mark);
+	return ret;
 }
 
-int cross_correlation(const float *data1, const float *data2, int len1, int len2, float **correlation) {
-	int len_combined = next_deg(len1 + len2 - 1);
-	fftw_complex *memory_block;
-	size_t block_size = sizeof(fftw_complex) * len_combined;
-	int block_count = 5;
-	memory_block = (fftw_complex*)fftw_malloc(block_size * block_count);
-	if (!memory_block) {
-		fprintf(stderr, "Failed to allocate memory for FFTW complex arrays\n");
+int set_target_rate(AudioInfo *audio_info, int real_sample_rate, int target_sample_rate, int backend) {
+	audio_info->resampler = malloc(sizeof(Resampler));
+	if (!audio_info->resampler) {
+		fprintf(stderr, "Failed to allocate memory for resampler\n");
 		return ERROR_NOTENOUGH_MEMORY;
 	}
+	int ret = resampler_init(audio_info->resampler, real_sample_rate, target_sample_rate, backend);
+	if (ret != SUCCESS) {
+		free(audio_info->resampler);
+		audio_info->resampler = NULL;
+	}
+	return ret;
+}
 
-	fftw_complex *complex_in1 = memory_block;
-	fftw_complex *complex_in2 = memory_block + len_combined;
-	fftw_complex *complex_out1 = memory_block + 2 * len_combined;
-	fftw_complex *complex_out2 = memory_block + 3 * len_combined;
-	fftw_complex *result = memory_block + 4 * len_combined;
-
-	*correlation = (float*)malloc(sizeof(float) * len_combined);
-	if (!*correlation) {
-		fftw_free(memory_block);
-		fprintf(stderr, "Failed to allocate memory for correlation array\n");
+int flush_resampler(AudioInfo *audio_info) {
+	if (!audio_info->resampler) return SUCCESS;
+	int append_cnt = resampler_max_output(audio_info->resampler, audio_info->resampler->taps);
+	if (reserve_samples(&audio_info->samples, audio_info->samples_cnt, append_cnt, &audio_info->samples_capacity) != SUCCESS) {
 		return ERROR_NOTENOUGH_MEMORY;
 	}
+	int flushed_cnt = 0;
+	int ret = resampler_flush(audio_info->resampler, audio_info->samples + audio_info->samples_cnt, &flushed_cnt);
+	if (ret == SUCCESS) {
+		audio_info->samples_cnt += flushed_cnt;
+	}
+	return ret;
+}
 
-	memset(complex_in1, 0, block_size * 2);
-	memset(complex_out1, 0, block_size * 2);
-	memset(result, 0, block_size);
-
-	for (int i = 0; i < len1; i++) {
-		complex_in1[i + len2 - 1][0] = data1[i];
+int load_audio_file(const char *filepath, int channel_idx, int target_rate, int backend, AudioInfo *audio_info, int *rate) {
+	int ret = open_and_find_stream_info(filepath, &audio_info->format_context);
+	if (ret != SUCCESS) return ret;
+	int stream_idx = audio_stream_index(audio_info->format_context, 0);
+	if (stream_idx == -1) {
+		fprintf(stderr, "No audio streams found in file '%s'\n", filepath);
+		return ERROR_DATA_INVALID;
 	}
-	for (int i = 0; i < len2; i++) {
-		complex_in2[i][0] = data2[i];
+	ret = process_audio_stream(audio_info, stream_idx);
+	if (ret != SUCCESS) return ret;
+	*rate = sample_rate(audio_info->format_context, stream_idx);
+	if (target_rate > 0 && target_rate != *rate) {
+		ret = set_target_rate(audio_info, *rate, target_rate, backend);
+		if (ret != SUCCESS) return ret;
+		*rate = target_rate;
 	}
+	ProfileMark mark = profile_begin();
+	while (!audio_info->window.done && av_read_frame(audio_info->format_context, audio_info->packet) >= 0) {
+		if (audio_info->packet->stream_index == stream_idx) {
+			if (decode_audio(audio_info->codec_context, audio_info->packet, audio_info->frame,
+							 &audio_info->samples, &audio_info->samples_cnt, &audio_info->samples_capacity, channel_idx, audio_info->resampler, &audio_info->window) != SUCCESS) {
+				av_packet_unref(audio_info->packet);
+				fprintf(stderr, "Error while decoding file '%s'\n", filepath);
+				return ERROR_DATA_INVALID;
+			}
+		}
+		av_packet_unref(audio_info->packet);
+	}
+	ret = flush_resampler(audio_info);
+	profile_end("decode_into_samples", mark);
+	return ret;
+}
 
-	fftw_plan plan_forward_1 = fftw_plan_dft_1d(len_combined, complex_in1, complex_out1, FFTW_FORWARD, FFTW_ESTIMATE);
-	fftw_plan plan_forward_2 = fftw_plan_dft_1d(len_combined, complex_in2, complex_out2, FFTW_FORWARD, FFTW_ESTIMATE);
-	fftw_plan plan_backward = fftw_plan_dft_1d(len_combined, result, complex_in1, FFTW_BACKWARD, FFTW_ESTIMATE);
-
-	fftw_execute(plan_forward_1);
-	fftw_execute(plan_forward_2);
+static void frame_channel_to_float(const AVFrame *frame, int format, int channel, float *dst) {
+	if (format == AV_SAMPLE_FMT_S16P) {
+		kernel_s16_to_float((const int16_t *)frame->data[channel], dst, frame->nb_samples);
+	} else if (format == AV_SAMPLE_FMT_S32P) {
+		const int32_t *src = (const int32_t *)frame->data[channel];
+		for (int i = 0; i < frame->nb_samples; i++) {
+			dst[i] = (float)(src[i] / 2147483648.0);
+		}
+	} else {
+		memcpy(dst, frame->data[channel], frame->nb_samples * sizeof(float));
+	}
+}
 
-	for (int i = 0; i < len_combined; i++) {
-		result[i][0] = complex_out1[i][0] * complex_out2[i][0] + complex_out1[i][1] * complex_out2[i][1];
-		result[i][1] = complex_out1[i][1] * complex_out2[i][0] - complex_out1[i][0] * complex_out2[i][1];
+static int decode_channels(AudioInfo *audio_info, int format, float **channels, int channel_cnt, int32_t *samples_cnt, size_t *capacity) {
+	if (avcodec_send_packet(audio_info->codec_context, audio_info->packet) < 0) {
+		fprintf(stderr, "Error submitting packet to the decoder\n");
+		return ERROR_UNKNOWN;
 	}
+	while (avcodec_receive_frame(audio_info->codec_context, audio_info->frame) == 0) {
+		int nb_samples = audio_info->frame->nb_samples;
+		// every channel has the same length, so all of them grow in step with one capacity
+		size_t grown = *capacity;
+		for (int c = 0; c < channel_cnt; c++) {
+			grown = *capacity;
+			if (reserve_samples(&channels[c], *samples_cnt, nb_samples, &grown) != SUCCESS) {
+				return ERROR_NOTENOUGH_MEMORY;
+			}
+			frame_channel_to_float(audio_info->frame, format, c, channels[c] + *samples_cnt);
+		}
+		*capacity = grown;
+		*samples_cnt += nb_samples;
+	}
+	return SUCCESS;
+}
 
-	fftw_execute(plan_backward);
+// Decodes every channel of the first audio stream, sending each packet to the decoder once; *channels gets one
+// array per channel, all samples_cnt long, to be released with free_channels.
+int load_audio_channels(const char *filepath, AudioInfo *audio_info, float ***channels, int *channel_cnt, int32_t *samples_cnt, int *rate) {
+	*channels = NULL;
+	*channel_cnt = 0;
+	*samples_cnt = 0;
+	int ret = open_and_find_stream_info(filepath, &audio_info->format_context);
+	if (ret != SUCCESS) return ret;
+	int stream_idx = audio_stream_index(audio_info->format_context, 0);
+	if (stream_idx == -1) {
+		fprintf(stderr, "No audio streams found in file '%s'\n", filepath);
+		return ERROR_DATA_INVALID;
+	}
+	ret = process_audio_stream(audio_info, stream_idx);
+	if (ret != SUCCESS) return ret;
+	*rate = sample_rate(audio_info->format_context, stream_idx);
+	int format = audio_info->codec_context->sample_fmt;
+	if (format != AV_SAMPLE_FMT_FLTP && format != AV_SAMPLE_FMT_S16P && format != AV_SAMPLE_FMT_S32P) {
+		fprintf(stderr, "Unsupported sample format in file '%s'\n", filepath);
+		return ERROR_UNSUPPORTED;
+	}
+	*channels = calloc(audio_info->codec_context->ch_layout.nb_channels, sizeof(float*));
+	if (!*channels) {
+		fprintf(stderr, "Failed to allocate memory for channels\n");
+		return ERROR_NOTENOUGH_MEMORY;
+	}
+	*channel_cnt = audio_info->codec_context->ch_layout.nb_channels;
 
-	for (int i = 0; i < len_combined; i++) {
-		(*correlation)[i] = (float)complex_in1[i][0];
+	ProfileMark mark = profile_begin();
+	size_t capacity = 0;
+	while (ret == SUCCESS && av_read_frame(audio_info->format_context, audio_info->packet) >= 0) {
+		if (audio_info->packet->stream_index == stream_idx) {
+			ret = decode_channels(audio_info, format, *channels, *channel_cnt, samples_cnt, &capacity);
+		}
+		av_packet_unref(audio_info->packet);
 	}
+	profile_end("decode_into_samples", mark);
+	return ret;
+}
 
-	fftw_destroy_plan(plan_forward_1);
-	fftw_destroy_plan(plan_forward_2);
-	fftw_destroy_plan(plan_backward);
-	fftw_free(memory_block);
+void free_channels(float **channels, int channel_cnt) {
+	for (int c = 0; channels && c < channel_cnt; c++) {
+		free(channels[c]);
+	}
+	free(channels);
+}
 
-	return SUCCESS;
+int resampled_samples_cnt(int real_sample_rate, int target_sample_rate, int32_t samples_cnt) {
+	return (int)((int64_t)samples_cnt * target_sample_rate / real_sample_rate);
 }
 
 int resample(const float *input_samples, int real_sample_rate, int target_sample_rate, float **output_samples, int32_t samples_cnt) {
-	float ratio = (float)real_sample_rate / (float)target_sample_rate;
-	int output_cnt = (int)((float)samples_cnt / ratio);
+	Resampler resampler;
+	int ret = resampler_init(&resampler, real_sample_rate, target_sample_rate, RESAMPLER_POLYPHASE);
+	if (ret != SUCCESS) return ret;
+	int output_cnt = resampler_max_output(&resampler, samples_cnt) + resampler_max_output(&resampler, resampler.taps);
 	*output_samples = malloc(output_cnt * sizeof(float));
 	if (!*output_samples) {
+		resampler_free(&resampler);
 		fprintf(stderr, "Memory allocation for resampled array failed\n");
 		return ERROR_NOTENOUGH_MEMORY;
 	}
-	for (int i = 0; i < output_cnt; i++) {
-		float float_idx = (float)i * ratio;
-		int index = (int)roundf(float_idx);
-		float diff = float_idx - (float)index;
-		if (index + 1 < samples_cnt) {
-			(*output_samples)[i] = input_samples[index] * (1 - diff) + input_samples[index + 1] * diff;
-		} else {
-			(*output_samples)[i] = input_samples[samples_cnt - 1];
-		}
-	}
-	return SUCCESS;
+	int processed_cnt = 0;
+	int flushed_cnt = 0;
+	ret = resampler_process(&resampler, input_samples, samples_cnt, *output_samples, &processed_cnt);
+	if (ret == SUCCESS) ret = resampler_flush(&resampler, *output_samples + processed_cnt, &flushed_cnt);
+	resampler_free(&resampler);
+	return ret;
 }
 
+// Streams a source through the resampler chunk by chunk, so a mapped input is converted without a full-rate copy.
+int resample_source(const SampleSource *source, int real_sample_rate, int target_sample_rate, int backend, float **output_samples, int32_t *output_cnt) {
+	enum { CHUNK_LEN = 4096 };
+	Resampler resampler;
+	int ret = resampler_init(&resampler, real_sample_rate, target_sample_rate, backend);
+	if (ret != SUCCESS) return ret;
+	int chunk_cnt = (source->len + CHUNK_LEN - 1) / CHUNK_LEN;
+	int64_t capacity = (int64_t)chunk_cnt * resampler_max_output(&resampler, CHUNK_LEN) + resampler_max_output(&resampler, resampler.taps);
+	*output_samples = malloc(capacity * sizeof(float));
+	float *chunk = malloc(CHUNK_LEN * sizeof(float));
+	if (!*output_samples || !chunk) {
+		free(*output_samples);
+		free(chunk);
+		*output_samples = NULL;
+		resampler_free(&resampler);
+		fprintf(stderr, "Memory allocation for resampled array failed\n");
+		return ERROR_NOTENOUGH_MEMORY;
+	}
+	profile_alloc(capacity * sizeof(float));
+	*output_cnt = 0;
+	for (int start = 0; start < source->len && ret == SUCCESS; start += CHUNK_LEN) {
+		int cnt = source->len - start < CHUNK_LEN ? source->len - start : CHUNK_LEN;
+		const float *input = source->samples ? source->samples + start : chunk;
+		if (!source->samples) source->read(source->context, start, cnt, chunk);
+		int processed_cnt = 0;
+		ret = resampler_process(&resampler, input, cnt, *output_samples + *output_cnt, &processed_cnt);
+		*output_cnt += processed_cnt;
+	}
+	int flushed_cnt = 0;
+	if (ret == SUCCESS) ret = resampler_flush(&resampler, *output_samples + *output_cnt, &flushed_cnt);
+	*output_cnt += flushed_cnt;
+	free(chunk);
+	resampler_free(&resampler);
+	return ret;
+}
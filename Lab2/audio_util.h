@@ -1,7 +1,23 @@
+#include "correlation.h"
+#include "resampler.h"
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <stdbool.h>
 
+// Span of the stream to decode in seconds; len 0 decodes everything. The other fields are set by
+// process_audio_stream, which also seeks to the span, and track the decoding position in samples of the stream.
+typedef struct {
+	double start;
+	double len;
+	int64_t first_sample;
+	int64_t end_sample;
+	int64_t next_sample;
+	int64_t start_pts;
+	AVRational time_base;
+	int rate;
+	bool done;
+} DecodeWindow;
+
 typedef struct {
 	AVFormatContext *format_context;
 	AVCodecContext *codec_context;
@@ -10,10 +26,16 @@ typedef struct {
 	AVFrame *frame;
 	float *samples;
 	int32_t samples_cnt;
+	// bytes allocated for samples, kept across packets so the buffer grows geometrically
+	size_t samples_capacity;
+	Resampler *resampler;
+	DecodeWindow window;
 } AudioInfo;
 
 void init_audio_info(AudioInfo *channel);
 
+void set_decode_window(AudioInfo *audio_info, double start, double len);
+
 void free_samples_mem(float **samples);
 
 void free_resources(AudioInfo channel);
@@ -28,8 +50,18 @@ int process_audio_stream(AudioInfo *audio_info, int audio_stream_idx);
 
 int decode_into_samples(AudioInfo *channel1, AudioInfo *channel2, int audio_stream_idx_1, int audio_stream_idx_2, int channel_1_idx, int channel_2_idx, int argc);
 
-int find_max_index(const float *array, int size);
+int set_target_rate(AudioInfo *audio_info, int real_sample_rate, int target_sample_rate, int backend);
+
+int flush_resampler(AudioInfo *audio_info);
 
-int cross_correlation(const float *data1, const float *data2, int len1, int len2, float **correlation);
+int load_audio_file(const char *filepath, int channel_idx, int target_rate, int backend, AudioInfo *audio_info, int *rate);
+
+int load_audio_channels(const char *filepath, AudioInfo *audio_info, float ***channels, int *channel_cnt, int32_t *samples_cnt, int *rate);
+
+void free_channels(float **channels, int channel_cnt);
+
+int resampled_samples_cnt(int real_sample_rate, int target_sample_rate, int32_t samples_cnt);
 
 int resample(const float *input_samples, int real_sample_rate, int target_sample_rate, float **output_samples, int32_t samples_cnt);
+
+int resample_source(const SampleSource *source, int real_sample_rate, int target_sample_rate, int backend, float **output_samples, int32_t *output_cnt);
@@ -0,0 +1,267 @@
+#include "batch.h"
+#include "audio_util.h"
+#include "correlation.h"
+#include "return_codes.h"
+#include <dirent.h>
+#include <fftw3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define MAX_FFT_DEG 31
+#define MAX_PATH_LEN 4096
+
+typedef struct {
+	char *path;
+	int status;
+	int delay;
+	double delay_ms;
+	float peak;
+	double confidence;
+} BatchResult;
+
+// Reference spectra keyed by log2 of the transform size, filled lazily by whichever candidate needs one first.
+typedef struct {
+	const float *samples;
+	int samples_cnt;
+	int rate;
+	double energy;
+	int resampler;
+	int weighting;
+	fftw_complex *spectra[MAX_FFT_DEG];
+} Reference;
+
+static int compare_paths(const void *lhs, const void *rhs) {
+	return strcmp(*(char *const *)lhs, *(char *const *)rhs);
+}
+
+static int append_path(char ***paths, int *count, int *capacity, const char *dir, const char *name) {
+	if (*count == *capacity) {
+		int new_capacity = *capacity ? *capacity * 2 : 16;
+		char **resized = realloc(*paths, sizeof(char *) * new_capacity);
+		if (!resized) {
+			fprintf(stderr, "Failed to allocate memory for candidate list\n");
+			return ERROR_NOTENOUGH_MEMORY;
+		}
+		*paths = resized;
+		*capacity = new_capacity;
+	}
+	size_t len = (dir ? strlen(dir) + 1 : 0) + strlen(name) + 1;
+	char *path = malloc(len);
+	if (!path) {
+		fprintf(stderr, "Failed to allocate memory for candidate list\n");
+		return ERROR_NOTENOUGH_MEMORY;
+	}
+	if (dir) {
+		snprintf(path, len, "%s/%s", dir, name);
+	} else {
+		snprintf(path, len, "%s", name);
+	}
+	(*paths)[(*count)++] = path;
+	return SUCCESS;
+}
+
+// Candidates are either the regular files of a directory, sorted by name, or the non-empty lines of a list file.
+static int collect_candidates(const char *source, char ***paths, int *count) {
+	struct stat info;
+	int capacity = 0;
+	*paths = NULL;
+	*count = 0;
+	if (stat(source, &info) != 0) {
+		fprintf(stderr, "Cannot open candidate list '%s'\n", source);
+		return ERROR_CANNOT_OPEN_FILE;
+	}
+	int ret = SUCCESS;
+	if (S_ISDIR(info.st_mode)) {
+		DIR *dir = opendir(source);
+		if (!dir) {
+			fprintf(stderr, "Cannot open candidate directory '%s'\n", source);
+			return ERROR_CANNOT_OPEN_FILE;
+		}
+		struct dirent *entry;
+		while (ret == SUCCESS && (entry = readdir(dir)) != NULL) {
+			char full_path[MAX_PATH_LEN];
+			snprintf(full_path, sizeof(full_path), "%s/%s", source, entry->d_name);
+			if (entry->d_name[0] == '.' || stat(full_path, &info) != 0 || !S_ISREG(info.st_mode)) continue;
+			ret = append_path(paths, count, &capacity, source, entry->d_name);
+		}
+		closedir(dir);
+		if (ret == SUCCESS && *count > 1) {
+			qsort(*paths, *count, sizeof(char *), compare_paths);
+		}
+		return ret;
+	}
+	FILE *list = fopen(source, "r");
+	if (!list) {
+		fprintf(stderr, "Cannot open candidate list '%s'\n", source);
+		return ERROR_CANNOT_OPEN_FILE;
+	}
+	char line[MAX_PATH_LEN];
+	while (ret == SUCCESS && fgets(line, sizeof(line), list)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '\0') continue;
+		ret = append_path(paths, count, &capacity, NULL, line);
+	}
+	fclose(list);
+	return ret;
+}
+
+static int cached_spectrum(Reference *reference, int fft_len, const fftw_complex **spectrum) {
+	int deg = 0;
+	while ((1 << deg) < fft_len) {
+		deg++;
+	}
+	int ret = SUCCESS;
+#pragma omp critical(reference_spectrum)
+	{
+		if (!reference->spectra[deg]) {
+			ret = reference_spectrum(reference->samples, reference->samples_cnt, fft_len, &reference->spectra[deg]);
+		}
+		*spectrum = reference->spectra[deg];
+	}
+	return ret;
+}
+
+static void align_candidate(Reference *reference, BatchResult *result) {
+	AudioInfo candidate;
+	int rate = 0;
+	float *correlation = NULL;
+	init_audio_info(&candidate);
+	result->status = load_audio_file(result->path, 0, reference->rate, reference->resampler, &candidate, &rate);
+	if (result->status == SUCCESS && candidate.samples_cnt == 0) {
+		fprintf(stderr, "No samples decoded from '%s'\n", result->path);
+		result->status = ERROR_DATA_INVALID;
+	}
+	if (result->status == SUCCESS) {
+		const fftw_complex *spectrum = NULL;
+		int fft_len = next_deg(reference->samples_cnt + candidate.samples_cnt - 1);
+		result->status = cached_spectrum(reference, fft_len, &spectrum);
+		if (result->status == SUCCESS) {
+			result->status = cross_correlation_spectrum(spectrum, reference->samples_cnt, fft_len,
+														candidate.samples, candidate.samples_cnt, reference->weighting, &correlation);
+		}
+	}
+	if (result->status == SUCCESS) {
+		int peak = find_max_index(correlation, reference->samples_cnt + candidate.samples_cnt - 1);
+		result->delay = peak - candidate.samples_cnt + 1;
+		result->delay_ms = (double)result->delay * 1000.0 / reference->rate;
+		result->peak = correlation[peak];
+		result->confidence = correlation_confidence(correlation[peak], reference->energy,
+													signal_energy(candidate.samples, candidate.samples_cnt), reference->weighting);
+	}
+	free(correlation);
+	free_resources(candidate);
+}
+
+static void write_json_string(FILE *out, const char *str) {
+	fputc('"', out);
+	for (; *str; str++) {
+		unsigned char c = (unsigned char)*str;
+		if (c == '"' || c == '\\') {
+			fprintf(out, "\\%c", c);
+		} else if (c < 0x20) {
+			fprintf(out, "\\u%04x", c);
+		} else {
+			fputc(c, out);
+		}
+	}
+	fputc('"', out);
+}
+
+// RFC 4180 field: quoted, with embedded quotes doubled.
+static void write_csv_string(FILE *out, const char *str) {
+	fputc('"', out);
+	for (; *str; str++) {
+		if (*str == '"') {
+			fputc('"', out);
+		}
+		fputc(*str, out);
+	}
+	fputc('"', out);
+}
+
+static void write_results(FILE *out, int format, const BatchResult *results, int count) {
+	if (format == OUTPUT_JSON) {
+		fprintf(out, "[\n");
+		for (int i = 0; i < count; i++) {
+			fprintf(out, "  {\"file\": ");
+			write_json_string(out, results[i].path);
+			if (results[i].status == SUCCESS) {
+				fprintf(out, ", \"delay_samples\": %d, \"delay_ms\": %.3f, \"peak\": %g, \"confidence\": %.6f, \"status\": 0}",
+						results[i].delay, results[i].delay_ms, results[i].peak, results[i].confidence);
+			} else {
+				fprintf(out, ", \"delay_samples\": null, \"delay_ms\": null, \"peak\": null, \"confidence\": null, \"status\": %d}",
+						results[i].status);
+			}
+			fprintf(out, i + 1 < count ? ",\n" : "\n");
+		}
+		fprintf(out, "]\n");
+		return;
+	}
+	fprintf(out, "file,delay_samples,delay_ms,peak,confidence,status\n");
+	for (int i = 0; i < count; i++) {
+		write_csv_string(out, results[i].path);
+		fputc(',', out);
+		if (results[i].status == SUCCESS) {
+			fprintf(out, "%d,%.3f,%g,%.6f,0\n", results[i].delay, results[i].delay_ms, results[i].peak, results[i].confidence);
+		} else {
+			fprintf(out, ",,,,%d\n", results[i].status);
+		}
+	}
+}
+
+int run_batch(const Options *options) {
+	AudioInfo reference_info;
+	Reference reference;
+	char **paths = NULL;
+	int count = 0;
+	BatchResult *results = NULL;
+	init_audio_info(&reference_info);
+	memset(&reference, 0, sizeof(Reference));
+
+	reference.resampler = options->resampler;
+	reference.weighting = options->weighting;
+	int ret = load_audio_file(options->files[0], 0, 0, options->resampler, &reference_info, &reference.rate);
+	if (ret == SUCCESS && reference_info.samples_cnt == 0) {
+		fprintf(stderr, "No samples decoded from reference '%s'\n", options->files[0]);
+		ret = ERROR_DATA_INVALID;
+	}
+	if (ret == SUCCESS) ret = collect_candidates(options->batch, &paths, &count);
+	if (ret == SUCCESS) {
+		results = calloc(count ? count : 1, sizeof(BatchResult));
+		if (!results) {
+			fprintf(stderr, "Failed to allocate memory for batch results\n");
+			ret = ERROR_NOTENOUGH_MEMORY;
+		}
+	}
+	if (ret == SUCCESS) {
+		reference.samples = reference_info.samples;
+		reference.samples_cnt = reference_info.samples_cnt;
+		reference.energy = signal_energy(reference.samples, reference.samples_cnt);
+#pragma omp parallel for schedule(dynamic)
+		for (int i = 0; i < count; i++) {
+			results[i].path = paths[i];
+			align_candidate(&reference, &results[i]);
+		}
+		FILE *out = options->output ? fopen(options->output, "w") : stdout;
+		if (!out) {
+			fprintf(stderr, "Cannot open output file '%s'\n", options->output);
+			ret = ERROR_CANNOT_OPEN_FILE;
+		} else {
+			write_results(out, options->output_format, results, count);
+			if (out != stdout) fclose(out);
+		}
+	}
+
+	for (int i = 0; i < MAX_FFT_DEG; i++) {
+		fftw_free(reference.spectra[i]);
+	}
+	for (int i = 0; i < count; i++) {
+		free(paths[i]);
+	}
+	free(paths);
+	free(results);
+	free_resources(reference_info);
+	return ret;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "options.h"
+
+int run_batch(const Options *options);
@@ -0,0 +1,188 @@
+#include "../correlation.h"
+#include "../kernels.h"
+#include "../return_codes.h"
+#include <fftw3.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Checks the dispatched argmax against a plain scan, then microbenchmarks the
+// dispatched kernels and the correlation FFTs at increasing thread counts:
+//   bench_kernels [max_log2_len]
+
+#define REPEATS 5
+
+static double wall_time(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static uint32_t rng_state = 1;
+
+static float rng_float(void) {
+	rng_state = rng_state * 1664525u + 1013904223u;
+	return (float)(rng_state >> 8) * 0x1.0p-24f - 0.5f;
+}
+
+// First index of the largest value; NaN never compares greater, so a leading NaN wins.
+static int argmax_reference(const float *array, int size) {
+	int max_index = 0;
+	for (int i = 1; i < size; i++) {
+		if (array[i] > array[max_index]) {
+			max_index = i;
+		}
+	}
+	return max_index;
+}
+
+static int check_argmax_case(const float *values, int len) {
+	int expected = argmax_reference(values, len);
+	int actual = kernel_argmax(values, len);
+	if (actual != expected) {
+		fprintf(stderr, "argmax mismatch at len %d: %d instead of %d\n", len, actual, expected);
+		return ERROR_DATA_INVALID;
+	}
+	return SUCCESS;
+}
+
+// Short arrays with ties and NaNs anywhere, including inside the first vector.
+static int check_argmax(void) {
+	float values[64] = {0};
+	values[3] = NAN;
+	values[11] = 5.0f;
+	values[20] = 1.0f;
+	int ret = check_argmax_case(values, 32);
+	for (int trial = 0; ret == SUCCESS && trial < 100000; trial++) {
+		int len = 1 + (int)((rng_state >> 16) % 64);
+		for (int i = 0; i < len; i++) {
+			float r = rng_float();
+			values[i] = r < -0.4f ? NAN : r < -0.2f ? 0.25f : roundf(r * 8.0f);
+		}
+		ret = check_argmax_case(values, len);
+	}
+	return ret;
+}
+
+static int bench_kernels(int max_deg) {
+	printf("kernels: %s\n", kernels_name());
+	printf("%8s %14s %14s %14s\n", "len", "argmax ns/el", "mul_conj ns/el", "s16->f ns/el");
+	for (int deg = 16; deg <= max_deg; deg += 2) {
+		int len = 1 << deg;
+		float *values = malloc(sizeof(float) * len);
+		int16_t *pcm = malloc(sizeof(int16_t) * len);
+		fftw_complex *a = fftw_malloc(sizeof(fftw_complex) * len);
+		fftw_complex *b = fftw_malloc(sizeof(fftw_complex) * len);
+		fftw_complex *out = fftw_malloc(sizeof(fftw_complex) * len);
+		if (!values || !pcm || !a || !b || !out) {
+			free(values);
+			free(pcm);
+			fftw_free(a);
+			fftw_free(b);
+			fftw_free(out);
+			fprintf(stderr, "Not enough memory");
+			return ERROR_NOTENOUGH_MEMORY;
+		}
+		for (int i = 0; i < len; i++) {
+			values[i] = rng_float();
+			pcm[i] = (int16_t)(rng_float() * 65535.0f);
+			a[i][0] = rng_float();
+			a[i][1] = rng_float();
+			b[i][0] = rng_float();
+			b[i][1] = rng_float();
+		}
+
+		double best[3] = {1e30, 1e30, 1e30};
+		volatile int sink = 0;
+		for (int r = 0; r < REPEATS; r++) {
+			double start = wall_time();
+			sink += kernel_argmax(values, len);
+			double t1 = wall_time();
+			kernel_multiply_conj(a, b, out, len);
+			double t2 = wall_time();
+			kernel_s16_to_float(pcm, values, len);
+			double t3 = wall_time();
+			best[0] = t1 - start < best[0] ? t1 - start : best[0];
+			best[1] = t2 - t1 < best[1] ? t2 - t1 : best[1];
+			best[2] = t3 - t2 < best[2] ? t3 - t2 : best[2];
+		}
+		printf("%8d %14.3f %14.3f %14.3f\n", len, best[0] * 1e9 / len, best[1] * 1e9 / len, best[2] * 1e9 / len);
+		free(values);
+		free(pcm);
+		fftw_free(a);
+		fftw_free(b);
+		fftw_free(out);
+	}
+	return SUCCESS;
+}
+
+static int bench_fft_threads(int max_deg) {
+	int max_threads = 1;
+#ifdef _OPENMP
+	max_threads = omp_get_num_procs();
+#endif
+	printf("\n%8s %8s %12s %10s\n", "len", "threads", "seconds", "speedup");
+	for (int deg = 16; deg <= max_deg; deg += 4) {
+		// the correlation runs at next_deg(2 * len - 1), so each input is half of that
+		int len = 1 << (deg - 1);
+		float *data1 = malloc(sizeof(float) * len);
+		float *data2 = malloc(sizeof(float) * len);
+		if (!data1 || !data2) {
+			free(data1);
+			free(data2);
+			fprintf(stderr, "Not enough memory");
+			return ERROR_NOTENOUGH_MEMORY;
+		}
+		for (int i = 0; i < len; i++) {
+			data1[i] = rng_float();
+			data2[i] = rng_float();
+		}
+		double single = 0.0;
+		for (int threads = 1; threads <= max_threads; threads *= 2) {
+			int ret = init_fft_threads(threads);
+			if (ret != SUCCESS) {
+				free(data1);
+				free(data2);
+				return ret;
+			}
+			double best = 1e30;
+			for (int r = 0; r < REPEATS; r++) {
+				float *correlation = NULL;
+				double start = wall_time();
+				ret = cross_correlation(data1, data2, len, len, &correlation);
+				double elapsed = wall_time() - start;
+				free(correlation);
+				if (ret != SUCCESS) {
+					free(data1);
+					free(data2);
+					return ret;
+				}
+				best = elapsed < best ? elapsed : best;
+			}
+			if (threads == 1) single = best;
+			printf("%8d %8d %12.4f %10.2f\n", 1 << deg, threads, best, single / best);
+		}
+		free(data1);
+		free(data2);
+	}
+	return SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+	int max_deg = argc > 1 ? atoi(argv[1]) : 24;
+	if (max_deg < 16 || max_deg > 28) {
+		fprintf(stderr, "max_log2_len must be between 16 and 28\n");
+		return ERROR_ARGUMENTS_INVALID;
+	}
+	init_kernels();
+	int ret = check_argmax();
+	if (ret != SUCCESS) return ret;
+	ret = bench_kernels(max_deg);
+	if (ret != SUCCESS) return ret;
+	return bench_fft_threads(max_deg);
+}
@@ -0,0 +1,133 @@
+#include "../return_codes.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Runs the tool on every pair from manifest.csv and compares the reported
+// delay with the ground truth:
+//   bench_pipeline <cpp_lab_2> <manifest> [tolerance_ms] [-- tool options...]
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+#define FIELD_CNT 8
+
+static double wall_time(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int split_fields(char *line, char *fields[FIELD_CNT]) {
+	line[strcspn(line, "\r\n")] = '\0';
+	int cnt = 0;
+	for (char *field = strtok(line, ","); field && cnt < FIELD_CNT; field = strtok(NULL, ",")) {
+		fields[cnt++] = field;
+	}
+	return cnt;
+}
+
+static int run_tool(const char *command, int *delta, int *rate) {
+	FILE *pipe = popen(command, "r");
+	if (!pipe) {
+		fprintf(stderr, "Cannot run: %s\n", command);
+		return ERROR_UNKNOWN;
+	}
+	char line[256];
+	int found = 0;
+	while (fgets(line, sizeof(line), pipe)) {
+		found += sscanf(line, "delta: %d samples", delta) == 1;
+		found += sscanf(line, "sample rate: %d Hz", rate) == 1;
+	}
+	int status = pclose(pipe);
+	return status == 0 && found == 2 ? SUCCESS : ERROR_DATA_INVALID;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <cpp_lab_2> <manifest> [tolerance_ms] [-- tool options...]\n", argv[0]);
+		return ERROR_ARGUMENTS_INVALID;
+	}
+	const char *tool = argv[1];
+	double tolerance = 1.0;
+	int extra_idx = 3;
+	if (argc > 3 && strcmp(argv[3], "--") != 0) {
+		tolerance = atof(argv[3]);
+		extra_idx = 4;
+	}
+	if (extra_idx < argc && strcmp(argv[extra_idx], "--") == 0) extra_idx++;
+
+	char extra[1024] = "";
+	for (int i = extra_idx; i < argc; i++) {
+		size_t used = strlen(extra);
+		snprintf(extra + used, sizeof(extra) - used, " %s", argv[i]);
+	}
+
+	FILE *manifest = fopen(argv[2], "r");
+	if (!manifest) {
+		fprintf(stderr, "Cannot open file: %s\n", argv[2]);
+		return ERROR_CANNOT_OPEN_FILE;
+	}
+
+	char line[8192];
+	if (!fgets(line, sizeof(line), manifest)) {
+		fclose(manifest);
+		fprintf(stderr, "Empty manifest: %s\n", argv[2]);
+		return ERROR_DATA_INVALID;
+	}
+
+	printf("%-6s %-12s %6s %10s %10s %8s %8s %10s\n", "codec", "rates", "snr", "expected", "measured", "error", "wall_s", "audio_x");
+	int total = 0;
+	int passed = 0;
+	int failed_runs = 0;
+	double audio_seconds = 0.0;
+	double wall_seconds = 0.0;
+	double error_sum = 0.0;
+	double error_max = 0.0;
+	while (fgets(line, sizeof(line), manifest)) {
+		char *fields[FIELD_CNT];
+		if (split_fields(line, fields) != FIELD_CNT) continue;
+		double seconds = atof(fields[6]);
+		double expected = atof(fields[7]);
+
+		char command[20000];
+		snprintf(command, sizeof(command), "\"%s\"%s \"%s\" \"%s\"", tool, extra, fields[0], fields[1]);
+		int delta = 0;
+		int rate = 0;
+		double start = wall_time();
+		int ret = run_tool(command, &delta, &rate);
+		double elapsed = wall_time() - start;
+
+		char rates[32];
+		snprintf(rates, sizeof(rates), "%s/%s", fields[3], fields[4]);
+		total++;
+		if (ret != SUCCESS) {
+			failed_runs++;
+			printf("%-6s %-12s %6s %10.2f %10s\n", fields[2], rates, fields[5], expected, "failed");
+			continue;
+		}
+		double measured = (double)delta * 1000.0 / rate;
+		double error = fabs(measured - expected);
+		passed += error <= tolerance;
+		error_sum += error;
+		error_max = error > error_max ? error : error_max;
+		// both inputs are decoded, so a pair counts as twice its duration
+		audio_seconds += 2.0 * seconds;
+		wall_seconds += elapsed;
+		printf("%-6s %-12s %6s %10.2f %10.2f %8.3f %8.3f %10.1f\n", fields[2], rates, fields[5], expected, measured,
+		       error, elapsed, 2.0 * seconds / elapsed);
+	}
+	fclose(manifest);
+
+	int measured_cnt = total - failed_runs;
+	printf("\npairs: %d, within %.2f ms: %d, failed runs: %d\n", total, tolerance, passed, failed_runs);
+	if (measured_cnt > 0) {
+		printf("mean error: %.3f ms, max error: %.3f ms\n", error_sum / measured_cnt, error_max);
+		printf("throughput: %.1f s of audio per second\n", audio_seconds / wall_seconds);
+	}
+	return failed_runs == 0 ? SUCCESS : ERROR_DATA_INVALID;
+}
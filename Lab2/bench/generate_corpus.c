@@ -0,0 +1,238 @@
+#include "../return_codes.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Writes mono test pairs with a known delay, encodes them with the ffmpeg
+// command line tool and records the ground truth in manifest.csv. The second
+// file lags the first one, so expected_ms is what the tool should report:
+//   generate_corpus <ffmpeg> <out_dir> [seconds] [seed]
+
+#define PARTIALS 96
+#define BLOCK_LEN 4096
+
+typedef struct {
+	const char *name;
+	const char *encoder;
+	const char *extension;
+	const char *extra;
+} Codec;
+
+static const Codec codecs[] = {
+	{"flac", "flac", "flac", ""},
+	{"mp3", "libmp3lame", "mp3", "-b:a 192k"},
+	{"aac", "aac", "m4a", "-b:a 160k"},
+	{"opus", "libopus", "opus", "-b:a 128k"},
+	{"wav", "pcm_s24le", "wav", ""},
+};
+
+static const int rates[][2] = {{48000, 48000}, {44100, 48000}, {48000, 22050}};
+static const double delays_ms[] = {12.5, -250.0, 1500.0, -3.2};
+static const double snr_db[] = {40.0, 10.0, 0.0};
+
+typedef struct {
+	double freq[PARTIALS];
+	double phase[PARTIALS];
+	double amp[PARTIALS];
+	double env_freq;
+	double env_phase;
+} Signal;
+
+static uint64_t rng_state;
+
+// splitmix64, so the corpus is identical on every platform for a given seed
+static uint64_t rng_next(void) {
+	uint64_t z = (rng_state += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+static double rng_uniform(void) {
+	return (double)(rng_next() >> 11) * 0x1.0p-53;
+}
+
+static double rng_gauss(void) {
+	double u1 = rng_uniform();
+	double u2 = rng_uniform();
+	return sqrt(-2.0 * log(u1 + 0x1.0p-60)) * cos(2.0 * M_PI * u2);
+}
+
+static void init_signal(Signal *signal) {
+	double total = 0.0;
+	for (int k = 0; k < PARTIALS; k++) {
+		// log-uniform between 60 Hz and 9 kHz, below Nyquist of every rate used
+		signal->freq[k] = 60.0 * pow(150.0, rng_uniform());
+		signal->phase[k] = 2.0 * M_PI * rng_uniform();
+		signal->amp[k] = 1.0 / sqrt(1.0 + signal->freq[k] / 500.0);
+		total += signal->amp[k] * signal->amp[k];
+	}
+	for (int k = 0; k < PARTIALS; k++) {
+		signal->amp[k] *= 0.25 / sqrt(total / 2.0);
+	}
+	signal->env_freq = 0.5 + rng_uniform();
+	signal->env_phase = 2.0 * M_PI * rng_uniform();
+}
+
+// The signal is analytic in t, so any rate and any fractional delay is exact
+static void render(const Signal *signal, int rate, double delay, double snr, int len, float *out) {
+	for (int i = 0; i < len; i++) out[i] = 0.0f;
+	for (int k = 0; k < PARTIALS; k++) {
+		double step = 2.0 * M_PI * signal->freq[k] / rate;
+		double start = signal->phase[k] - 2.0 * M_PI * signal->freq[k] * delay;
+		for (int i = 0; i < len; i += BLOCK_LEN) {
+			// phasor recurrence, re-anchored every block to keep the error bounded
+			double re = cos(start + step * i);
+			double im = sin(start + step * i);
+			double step_re = cos(step);
+			double step_im = sin(step);
+			int end = i + BLOCK_LEN < len ? i + BLOCK_LEN : len;
+			for (int j = i; j < end; j++) {
+				out[j] += (float)(signal->amp[k] * im);
+				double next_re = re * step_re - im * step_im;
+				im = re * step_im + im * step_re;
+				re = next_re;
+			}
+		}
+	}
+	double noise_rms = 0.25 / sqrt(2.0) * pow(10.0, -snr / 20.0);
+	for (int i = 0; i < len; i++) {
+		double t = (double)i / rate - delay;
+		double envelope = 0.55 + 0.45 * sin(2.0 * M_PI * signal->env_freq * t + signal->env_phase);
+		out[i] = (float)(out[i] * envelope + noise_rms * rng_gauss());
+	}
+}
+
+static void put_u32(FILE *file, uint32_t value) {
+	unsigned char bytes[4] = {value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, value >> 24};
+	fwrite(bytes, 1, 4, file);
+}
+
+static void put_u16(FILE *file, uint16_t value) {
+	unsigned char bytes[2] = {value & 0xFF, value >> 8};
+	fwrite(bytes, 1, 2, file);
+}
+
+static int write_wav(const char *path, const float *samples, int len, int rate) {
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		fprintf(stderr, "Cannot create file: %s\n", path);
+		return ERROR_CANNOT_OPEN_FILE;
+	}
+	uint32_t data_size = (uint32_t)len * 4;
+	fwrite("RIFF", 1, 4, file);
+	put_u32(file, 36 + data_size);
+	fwrite("WAVEfmt ", 1, 8, file);
+	put_u32(file, 16);
+	put_u16(file, 3);
+	put_u16(file, 1);
+	put_u32(file, rate);
+	put_u32(file, rate * 4);
+	put_u16(file, 4);
+	put_u16(file, 32);
+	fwrite("data", 1, 4, file);
+	put_u32(file, data_size);
+	for (int i = 0; i < len; i++) {
+		uint32_t bits;
+		memcpy(&bits, &samples[i], 4);
+		put_u32(file, bits);
+	}
+	int ret = ferror(file) ? ERROR_UNKNOWN : SUCCESS;
+	fclose(file);
+	return ret;
+}
+
+static int encode(const char *ffmpeg, const char *wav, const Codec *codec, const char *out) {
+	char command[16384];
+	snprintf(command, sizeof(command), "\"%s\" -y -nostdin -loglevel error -i \"%s\" -c:a %s %s \"%s\"",
+		 ffmpeg, wav, codec->encoder, codec->extra, out);
+	if (system(command) != 0) {
+		fprintf(stderr, "Encoding failed: %s\n", command);
+		return ERROR_UNKNOWN;
+	}
+	return SUCCESS;
+}
+
+static int write_file(const char *ffmpeg, const char *dir, const char *name, const Codec *codec,
+		      const float *samples, int len, int rate, char *path, size_t path_size) {
+	char wav[4096];
+	snprintf(wav, sizeof(wav), "%s/%s.wav", dir, name);
+	snprintf(path, path_size, "%s/%s.%s", dir, name, codec->extension);
+	int ret = write_wav(wav, samples, len, rate);
+	if (ret == SUCCESS) ret = encode(ffmpeg, wav, codec, path);
+	remove(wav);
+	return ret;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 3 || argc > 5) {
+		fprintf(stderr, "Usage: %s <ffmpeg> <out_dir> [seconds] [seed]\n", argv[0]);
+		return ERROR_ARGUMENTS_INVALID;
+	}
+	const char *ffmpeg = argv[1];
+	const char *dir = argv[2];
+	double seconds = argc > 3 ? atof(argv[3]) : 20.0;
+	rng_state = argc > 4 ? strtoull(argv[4], NULL, 10) : 1;
+	if (seconds <= 0) {
+		fprintf(stderr, "Invalid duration: %s\n", argv[3]);
+		return ERROR_ARGUMENTS_INVALID;
+	}
+
+	char manifest_path[4096];
+	snprintf(manifest_path, sizeof(manifest_path), "%s/manifest.csv", dir);
+	FILE *manifest = fopen(manifest_path, "w");
+	if (!manifest) {
+		fprintf(stderr, "Cannot create file: %s\n", manifest_path);
+		return ERROR_CANNOT_OPEN_FILE;
+	}
+	fprintf(manifest, "file1,file2,codec,rate1,rate2,snr_db,seconds,expected_ms\n");
+
+	int max_len = (int)ceil(seconds * 48000);
+	float *samples = malloc(sizeof(float) * max_len);
+	if (!samples) {
+		fclose(manifest);
+		fprintf(stderr, "Not enough memory");
+		return ERROR_NOTENOUGH_MEMORY;
+	}
+
+	int ret = SUCCESS;
+	int case_idx = 0;
+	int codec_cnt = sizeof(codecs) / sizeof(codecs[0]);
+	int rate_cnt = sizeof(rates) / sizeof(rates[0]);
+	int snr_cnt = sizeof(snr_db) / sizeof(snr_db[0]);
+	int delay_cnt = sizeof(delays_ms) / sizeof(delays_ms[0]);
+	for (int c = 0; c < codec_cnt && ret == SUCCESS; c++) {
+		for (int r = 0; r < rate_cnt && ret == SUCCESS; r++) {
+			for (int s = 0; s < snr_cnt && ret == SUCCESS; s++, case_idx++) {
+				Signal signal;
+				init_signal(&signal);
+				double delay = delays_ms[case_idx % delay_cnt] / 1000.0;
+				char name[64];
+				char path1[4096];
+				char path2[4096];
+
+				int len1 = (int)(seconds * rates[r][0]);
+				render(&signal, rates[r][0], 0.0, snr_db[s], len1, samples);
+				snprintf(name, sizeof(name), "case%03d_a", case_idx);
+				ret = write_file(ffmpeg, dir, name, &codecs[c], samples, len1, rates[r][0], path1, sizeof(path1));
+				if (ret != SUCCESS) break;
+
+				int len2 = (int)(seconds * rates[r][1]);
+				render(&signal, rates[r][1], delay, snr_db[s], len2, samples);
+				snprintf(name, sizeof(name), "case%03d_b", case_idx);
+				ret = write_file(ffmpeg, dir, name, &codecs[c], samples, len2, rates[r][1], path2, sizeof(path2));
+				if (ret != SUCCESS) break;
+
+				fprintf(manifest, "%s,%s,%s,%d,%d,%g,%g,%g\n", path1, path2, codecs[c].name,
+					rates[r][0], rates[r][1], snr_db[s], seconds, -delay * 1000.0);
+				printf("case %03d: %s %d/%d Hz, %g dB SNR, %g ms\n", case_idx, codecs[c].name,
+				       rates[r][0], rates[r][1], snr_db[s], delay * 1000.0);
+			}
+		}
+	}
+	free(samples);
+	fclose(manifest);
+	return ret;
+}
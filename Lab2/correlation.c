@@ -0,0 +1,1013 @@
+#include "correlation.h"
+#include "kernels.h"
+#include "profile.h"
+#include "return_codes.h"
+#include <fftw3.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+// Samples converted per read callback call when loading a SampleSource without a samples array.
+#define SOURCE_CHUNK_LEN 4096
+
+// Block length of the refinement step of find_delay_coarse_to_fine when a spectral weighting is used.
+#define WEIGHTED_FINE_BLOCK_LEN 4096
+
+// Transforms shorter than this are planned single-threaded: below it thread start-up outweighs the transform itself.
+#define FFT_THREADS_MIN_LEN (1 << 16)
+
+// Lean buffers at least this large are aligned for transparent huge pages.
+#define HUGE_PAGE_LEN (2 << 20)
+
+static int fft_thread_cnt = 1;
+// Once FFTW threads are initialized its planner keeps the last thread count, so going back to one thread
+// has to be set explicitly.
+static bool fft_threads_ready = false;
+
+int init_fft_threads(int thread_cnt) {
+	if (thread_cnt > 1 && !fft_threads_ready) {
+		if (!fftw_init_threads() || !fftwf_init_threads()) {
+			fprintf(stderr, "Could not initialize FFTW threads\n");
+			return ERROR_UNKNOWN;
+		}
+		fft_threads_ready = true;
+	}
+	fft_thread_cnt = thread_cnt;
+	if (fft_threads_ready && thread_cnt == 1) {
+		fftw_plan_with_nthreads(1);
+		fftwf_plan_with_nthreads(1);
+	}
+#ifdef _OPENMP
+	omp_set_num_threads(thread_cnt);
+	omp_set_max_active_levels(2);
+#endif
+	return SUCCESS;
+}
+
+// Called inside the fftw_planner critical section before planning; share is the number of transforms that will
+// run at the same time and split the threads. Nested inside an OpenMP region every plan stays single-threaded.
+static void plan_with_threads(int fft_len, int share) {
+	if (!fft_threads_ready) return;
+	int thread_cnt = fft_len >= FFT_THREADS_MIN_LEN ? fft_thread_cnt / share : 1;
+#ifdef _OPENMP
+	if (omp_in_parallel()) thread_cnt = 1;
+#endif
+	fftw_plan_with_nthreads(thread_cnt > 1 ? thread_cnt : 1);
+	fftwf_plan_with_nthreads(thread_cnt > 1 ? thread_cnt : 1);
+}
+
+SampleSource array_source(const float *samples, int len) {
+	SampleSource source = {samples, NULL, NULL, len};
+	return source;
+}
+
+int source_to_array(const SampleSource *source, float **samples) {
+	*samples = (float*)malloc(sizeof(float) * (source->len > 0 ? source->len : 1));
+	if (!*samples) {
+		fprintf(stderr, "Failed to allocate memory for samples\n");
+		return ERROR_NOTENOUGH_MEMORY;
+	}
+	profile_alloc(sizeof(float) * source->len);
+	if (source->samples) {
+		memcpy(*samples, source->samples, sizeof(float) * source->len);
+	} else {
+		source->read(source->context, 0, source->len, *samples);
+	}
+	return SUCCESS;
+}
+
+static void source_to_complex(const SampleSource *source, int start, int count, fftw_complex *dst) {
+	if (source->samples) {
+		kernel_float_to_complex(source->samples + start, dst, count);
+		return;
+	}
+	float chunk[SOURCE_CHUNK_LEN];
+	for (int done = 0; done < count; done += SOURCE_CHUNK_LEN) {
+		int cnt = count - done < SOURCE_CHUNK_LEN ? count - done : SOURCE_CHUNK_LEN;
+		source->read(source->context, start + done, cnt, chunk);
+		kernel_float_to_complex(chunk, dst + done, cnt);
+	}
+}
+
+static void source_to_double(const SampleSource *source, int start, int count, double *dst) {
+	if (source->samples) {
+		kernel_float_to_double(source->samples + start, dst, count);
+		return;
+	}
+	float chunk[SOURCE_CHUNK_LEN];
+	for (int done = 0; done < count; done += SOURCE_CHUNK_LEN) {
+		int cnt = count - done < SOURCE_CHUNK_LEN ? count - done : SOURCE_CHUNK_LEN;
+		source->read(source->context, start + done, cnt, chunk);
+		kernel_float_to_double(chunk, dst + done, cnt);
+	}
+}
+
+int find_max_index(const float *array, int size) {
+	ProfileMark mark = profile_begin();
+	int max_index = kernel_argmax(array, size);
+	profile_end("find_max_index", mark);
+	return max_index;
+}
+
+int next_deg(int len) {
+	len--;
+	len |= len >> 1;
+	len |= len >> 2;
+	len |= len >> 4;
+	len |= len >> 8;
+	len |= len >> 16;
+	len++;
+	return len;
+}
+
+int cross_correlation(const float *data1, const float *data2, int len1, int len2, float **correlation) {
+	SampleSource source1 = array_source(data1, len1);
+	SampleSource source2 = array_source(data2, len2);
+	return cross_correlation_source(&source1, &source2, WEIGHTING_NONE, correlation);
+}
+
+static void multiply_weighted(const fftw_complex *a, const fftw_complex *b, fftw_complex *out, int size, int weighting) {
+	if (weighting == WEIGHTING_PHAT || weighting == WEIGHTING_SCOT) {
+		kernel_multiply_conj_phat(a, b, out, size);
+	} else if (weighting == WEIGHTING_ROTH) {
+		kernel_multiply_conj_roth(a, b, out, size);
+	} else {
+		kernel_multiply_conj(a, b, out, size);
+	}
+}
+
+int cross_correlation_source(const SampleSource *source1, const SampleSource *source2, int weighting, float **correlation) {
+	int len1 = source1->len;
+	int len2 = source2->len;
+	int len_combined = next_deg(len1 + len2 - 1);
+	fftw_complex *memory_block;
+	size_t block_size = sizeof(fftw_complex) * len_combined;
+	int block_count = 5;
+	memory_block = (fftw_complex*)fftw_malloc(block_size * block_count);
+	profile_alloc(block_size * block_count + sizeof(float) * len_combined);
+	if (!memory_block) {
+		fprintf(stderr, "Failed to allocate memory for FFTW complex arrays\n");
+		return ERROR_NOTENOUGH_MEMORY;
+	}
+
+	fftw_complex *complex_in1 = memory_block;
+	fftw_complex *complex_in2 = memory_block + len_combined;
+	fftw_complex *complex_out1 = memory_block + 2 * len_combined;
+	fftw_complex *complex_out2 = memory_block + 3 * len_combined;
+	fftw_complex *result = memory_block + 4 * len_combined;
+
+	*correlation = (float*)malloc(sizeof(float) * len_combined);
+	if (!*correlation) {
+		fftw_free(memory_block);
+		fprintf(stderr, "Failed to allocate memory for correlation array\n");
+		return ERROR_NOTENOUGH_MEMORY;
+	}
+
+	memset(complex_in1, 0, block_size * 2);
+	memset(complex_out1, 0, block_size * 2);
+	memset(result, 0, block_size);
+
+	source_to_complex(source1, 0, len1, complex_in1 + len2 - 1);
+	source_to_complex(source2, 0, len2, complex_in2);
+
+	fftw_plan plan_forward_1;
+	fftw_plan plan_forward_2;
+	fftw_plan plan_backward;
+	ProfileMark mark = profile_begin();
+#pragma omp critical(fftw_planner)
+	{
+		plan_with_threads(len_combined, 2);
+		plan_forward_1 = fftw_plan_dft_1d(len_combined, complex_in1, complex_out1, FFTW_FORWARD, FFTW_ESTIMATE);
+		plan_forward_2 = fftw_plan_dft_1d(len_combined, complex_in2, complex_out2, FFTW_FORWARD, FFTW_ESTIMATE);
+		plan_with_threads(len_combined, 1);
+		plan_backward = fftw_plan_dft_1d(len_combined, result, complex_in1, FFTW_BACKWARD, FFTW_ESTIMATE);
+	}
+	profile_end("fft_plan", mark);
+
+	// The two forward transforms are independent, each gets half of the FFTW threads.
+	bool concurrent = fft_thread_cnt > 1 && len_combined >= FFT_THREADS_MIN_LEN;
+	mark = profile_begin();
+#pragma omp parallel sections num_threads(2) if (concurrent)
+	{
+#pragma omp section
+		fftw_execute(plan_forward_1);
+#pragma omp section
+		fftw_execute(plan_forward_2);
+	}
+	profile_end("fft_forward", mark);
+
+	mark = profile_begin();
+	multiply_weighted(complex_out1, complex_out2, result, len_combined, weighting);
+	profile_end("spectrum_product", mark);
+
+	mark = profile_begin();
+	fftw_execute(plan_backward);
+	profile_end("fft_backward", mark);
+
+	kernel_complex_to_float(complex_in1, 1.0 / len_combined, *correlation, len_combined);
+
+#pragma omp critical(fftw_planner)
+	{
+		fftw_destroy_plan(plan_forward_1);
+		fftw_destroy_plan(plan_forward_2);
+		fftw_destroy_plan(plan_backward);
+	}
+	fftw_free(memory_block);
+
+	return SUCCESS;
+}
+
+// Allocations of the lean correlation: aligned to the huge page size once they span one, so that transparent huge
+// pages can back them, and released with lean_free.
+static void *lean_alloc(size_t bytes) {
+	size_t alignment = bytes >= HUGE_PAGE_LEN ? HUGE_PAGE_LEN : 64;
+#ifdef _WIN32
+	return _aligned_malloc(bytes, alignment);
+#else
+	void *memory = NULL;
+	if (posix_memalign(&memory, alignment, bytes) != 0) return NULL;
+#ifdef MADV_HUGEPAGE
+	if (alignment == HUGE_PAGE_LEN) madvise(memory, bytes, MADV_HUGEPAGE);
+#endif
+	return memory;
+#endif
+}
+
+static void lean_free(void *memory) {
+#ifdef _WIN32
+	_aligned_free(memory);
+#else
+	free(memory);
+#endif
+}
+
+// Fills size floats of buffer with the samples of source placed at offset and zeros around them. Chunks are
+// written in parallel, so the pages are faulted in by all threads instead of one memset-ing the whole buffer.
+static void first_touch(const SampleSource *source, int offset, float *buffer, int size) {
+	int chunk_cnt = (size + SOURCE_CHUNK_LEN - 1) / SOURCE_CHUNK_LEN;
+#pragma omp parallel for schedule(static) if (size >= FFT_THREADS_MIN_LEN)
+	for (int chunk = 0; chunk < chunk_cnt; chunk++) {
+		int start = chunk * SOURCE_CHUNK_LEN;
+		int end = start + SOURCE_CHUNK_LEN < size ? start + SOURCE_CHUNK_LEN : size;
+		int data_start = offset > start ? offset : start;
+		int data_end = offset + source->len < end ? offset + source->len : end;
+		if (data_end <= data_start) {
+			memset(buffer + start, 0, sizeof(float) * (end - start));
+			continue;
+		}
+		memset(buffer + start, 0, sizeof(float) * (data_start - start));
+		if (source->samples) {
+			memcpy(buffer + data_start, source->samples + data_start - offset, sizeof(float) * (data_end - data_start));
+		} else {
+			source->read(source->context, data_start - offset, data_end - data_start, buffer + data_start);
+		}
+		memset(buffer + data_end, 0, sizeof(float) * (end - data_end));
+	}
+}
+
+// a = a * conj(b), weighted like multiply_weighted.
+static void multiply_weighted_float(fftwf_complex *a, const fftwf_complex *b, int size, int weighting) {
+#pragma omp parallel for simd schedule(static) if (size >= FFT_THREADS_MIN_LEN)
+	for (int i = 0; i < size; i++) {
+		float re = a[i][0] * b[i][0] + a[i][1] * b[i][1];
+		float im = a[i][1] * b[i][0] - a[i][0] * b[i][1];
+		float weight = 1.0f;
+		if (weighting == WEIGHTING_PHAT || weighting == WEIGHTING_SCOT) {
+			float norm = sqrtf(re * re + im * im);
+			weight = norm > 0.0f ? 1.0f / norm : 0.0f;
+		} else if (weighting == WEIGHTING_ROTH) {
+			float norm = a[i][0] * a[i][0] + a[i][1] * a[i][1];
+			weight = norm > 0.0f ? 1.0f / norm : 0.0f;
+		}
+		a[i][0] = re * weight;
+		a[i][1] = im * weight;
+	}
+}
+
+// Same output as cross_correlation_source in single precision and about a tenth of the memory: both signals are
+// transformed in place, the product overwrites the first spectrum and is transformed back in place, so only two
+// padded float buffers of the transform size are alive, plus the result.
+int cross_correlation_source_lean(const SampleSource *source1, const SampleSource *source2, int weighting, float **correlation) {
+	int len1 = source1->len;
+	int len2 = source2->len;
+	int len_out = len1 + len2 - 1;
+	int fft_len = next_deg(len_out);
+	int half_len = fft_len / 2 + 1;
+	size_t buffer_size = sizeof(fftwf_complex) * half_len;
+	float *buffer1 = lean_alloc(buffer_size);
+	float *buffer2 = lean_alloc(buffer_size);
+	if (!buffer1 || !buffer2) {
+		lean_free(buffer1);
+		lean_free(buffer2);
+		fprintf(stderr, "Failed to allocate memory for FFTW buffers\n");
+		return ERROR_NOTENOUGH_MEMORY;
+	}
+	profile_alloc(2 * buffer_size + sizeof(float) * len_out);
+
+	fftwf_plan plan_forward_1;
+	fftwf_plan plan_forward_2;
+	fftwf_plan plan_backward;
+	ProfileMark mark = profile_begin();
+#pragma omp critical(fftw_planner)
+	{
+		plan_with_threads(fft_len, 2);
+		plan_forward_1 = fftwf_plan_dft_r2c_1d(fft_len, buffer1, (fftwf_complex*)buffer1, FFTW_ESTIMATE);
+		plan_forward_2 = fftwf_plan_dft_r2c_1d(fft_len, buffer2, (fftwf_complex*)buffer2, FFTW_ESTIMATE);
+		plan_with_threads(fft_len, 1);
+		plan_backward = fftwf_plan_dft_c2r_1d(fft_len, (fftwf_complex*)buffer1, buffer1, FFTW_ESTIMATE);
+	}
+	profile_end("fft_plan", mark);
+
+	mark = profile_begin();
+	first_touch(source1, len2 - 1, buffer1, 2 * half_len);
+	first_touch(source2, 0, buffer2, 2 * half_len);
+	profile_end("first_touch", mark);
+
+	bool concurrent = fft_thread_cnt > 1 && fft_len >= FFT_THREADS_MIN_LEN;
+	mark = profile_begin();
+#pragma omp parallel sections num_threads(2) if (concurrent)
+	{
+#pragma omp section
+		fftwf_execute(plan_forward_1);
+#pragma omp section
+		fftwf_execute(plan_forward_2);
+	}
+	profile_end("fft_forward", mark);
+
+	mark = profile_begin();
+	multiply_weighted_float((fftwf_complex*)buffer1, (const fftwf_complex*)buffer2, half_len, weighting);
+	profile_end("spectrum_product", mark);
+	lean_free(buffer2);
+
+	mark = profile_begin();
+	fftwf_execute(plan_backward);
+	profile_end("fft_backward", mark);
+
+	*correlation = (float*)malloc(sizeof(float) * len_out);
+	if (*correlation) {
+		float scale = 1.0f / fft_len;
+#pragma omp parallel for simd schedule(static) if (len_out >= FFT_THREADS_MIN_LEN)
+		for (int i = 0; i < len_out; i++) {
+			(*correlation)[i] = buffer1[i] * scale;
+		}
+	}
+#pragma omp critical(fftw_planner)
+	{
+		fftwf_destroy_plan(plan_forward_1);
+		fftwf_destroy_plan(plan_forward_2);
+		fftwf_destroy_plan(plan_backward);
+	}
+	lean_free(buffer1);
+	if (!*correlation) {
+		fprintf(stderr, "Failed to allocate memory for correlation array\n");
+		return ERROR_NOTENOUGH_MEMORY;
+	}
+	return SUCCESS;
+}
+
+// Overlap-save correlation restricted to lags [lag_min, lag_max]: data2 is cut into blocks of block_len samples,
+// every block is correlated against the matching (block_len + window - 1)-sample segment of data1 and the
+// spectral products are summed, so a single inverse transform of a small size yields the whole lag window.
+// correlation[k] = sum(data1[n + lag_min + k] * data2[n]), the same values cross_correlation gives for these lags.
+int cross_correlation_blocked(const float *data1, const float *data2, int len1, int len2, int lag_min, int lag_max, int block_len, float **correlation) {
+	SampleSource source1 = array_source(data1, len1);
+	SampleSource source2 = array_source(data2, len2);
+	return cross_correlation_blocked_source(&source1, &source2, lag_min, lag_max, block_len, WEIGHTING_NONE, correlation);
+}
+
+static void accumulate_power(const fftw_complex *spectrum, double *power, int size) {
+#pragma omp simd
+	for (int i = 0; i < size; i++) {
+		power[i] += spectrum[i][0] * spectrum[i][0] + spectrum[i][1] * spectrum[i][1];
+	}
+}
+
+// Weighting of the block-averaged cross-spectrum: PHAT by its own magnitude, SCOT by the geometric mean of the
+// averaged auto-spectra and Roth by the averaged auto-spectrum of the first signal.
+static void weight_accumulated(fftw_complex *spectrum, const double *power1, const double *power2, int size, int weighting) {
+	for (int i = 0; i < size; i++) {
+		double norm;
+		if (weighting == WEIGHTING_PHAT) {
+			norm = sqrt(spectrum[i][0] * spectrum[i][0] + spectrum[i][1] * spectrum[i][1]);
+		} else if (weighting == WEIGHTING_SCOT) {
+			norm = sqrt(power1[i] * power2[i]);
+		} else {
+			norm = power1[i];
+		}
+		double weight = norm > 0.0 ? 1.0 / norm : 0.0;
+		spectrum[i][0] *= weight;
+		spectrum[i][1] *= weight;
+	}
+}
+
+int cross_correlation_blocked_source(const SampleSource *source1, const SampleSource *source2, int lag_min, int lag_max, int block_len, int weighting, float **correlation) {
+	int len1 = source1->len;
+	int len2 = source2->len;
+	if (lag_min > lag_max || len1 <= 0 || len2 <= 0) {
+		fprintf(stderr, "Invalid lag window for block correlation\n");
+		return ERROR_ARGUMENTS_INVALID;
+	}
+	int window = lag_max - lag_min + 1;
+	if (block_len <= 0) {
+		block_len = next_deg(window);
+	}
+	if (block_len > len2) {
+		block_len = len2;
+	}
+	int fft_len = next_deg(block_len + window - 1);
+	int half_len = fft_len / 2 + 1;
+	int block_cnt = (len2 + block_len - 1) / block_len;
+	int thread_cnt = 1;
+#ifdef _OPENMP
+	thread_cnt = omp_get_max_threads();
+	if (thread_cnt > block_cnt) {
+		thread_cnt = block_cnt;
+	}
+#endif
+
+	size_t real_size = sizeof(double) * fft_len;
+	size_t complex_size = sizeof(fftw_complex) * half_len;
+	// SCOT and Roth need the auto-spectra averaged over the blocks as well
+	bool auto_spectra = weighting == WEIGHTING_SCOT || weighting == WEIGHTING_ROTH;
+	size_t power_size = auto_spectra ? sizeof(double) * half_len : 0;
+	size_t set_size = 2 * real_size + 3 * complex_size + 2 * power_size;
+	char *memory_block = fftw_malloc(set_size * thread_cnt);
+	profile_alloc(set_size * thread_cnt + sizeof(float) * window);
+	if (!memory_block) {
+		fprintf(stderr, "Failed to allocate memory for block correlation buffers\n");
+		return ERROR_NOTENOUGH_MEMORY;
+	}
+	*correlation = (float*)malloc(sizeof(float) * window);
+	if (!*correlation) {
+		fftw_free(memory_block);
+		fprintf(stderr, "Failed to allocate memory for correlation array\n");
+		return ERROR_NOTENOUGH_MEMORY;
+	}
+	memset(memory_block, 0, set_size * thread_cnt);
+
+	double *plan_in = (double*)memory_block;
+	fftw_complex *plan_out = (fftw_complex*)(memory_block + 2 * real_size);
+	fftw_plan plan_forward;
+	fftw_plan plan_backward;
+	ProfileMark mark = profile_begin();
+#pragma omp critical(fftw_planner)
+	{
+		plan_with_threads(1, 1);
+		plan_forward = fftw_plan_dft_r2c_1d(fft_len, plan_in, plan_out, FFTW_ESTIMATE);
+		plan_backward = fftw_plan_dft_c2r_1d(fft_len, plan_out, plan_in, FFTW_ESTIMATE);
+	}
+	profile_end("fft_plan", mark);
+
+	mark = profile_begin();
+
+#pragma omp parallel num_threads(thread_cnt)
+	{
+		int thread_idx = 0;
+#ifdef _OPENMP
+		thread_idx = omp_get_thread_num();
+#endif
+		char *set = memory_block + set_size * thread_idx;
+		double *segment1 = (double*)set;
+		double *segment2 = (double*)(set + real_size);
+		fftw_complex *spectrum1 = (fftw_complex*)(set + 2 * real_size);
+		fftw_complex *spectrum2 = spectrum1 + half_len;
+		fftw_complex *accumulated = spectrum2 + half_len;
+		double *power1 = (double*)(accumulated + half_len);
+		double *power2 = power1 + half_len;
+
+#pragma omp for schedule(static)
+		for (int block = 0; block < block_cnt; block++) {
+			int start2 = block * block_len;
+			int cnt2 = len2 - start2 < block_len ? len2 - start2 : block_len;
+			int start1 = start2 + lag_min;
+			int first1 = start1 < 0 ? -start1 : 0;
+			int end1 = start1 + cnt2 + window - 1 < len1 ? cnt2 + window - 1 : len1 - start1;
+			memset(segment1, 0, real_size);
+			if (end1 > first1) {
+				source_to_double(source1, start1 + first1, end1 - first1, segment1 + first1);
+			}
+			memset(segment2 + cnt2, 0, sizeof(double) * (fft_len - cnt2));
+			source_to_double(source2, start2, cnt2, segment2);
+			fftw_execute_dft_r2c(plan_forward, segment1, spectrum1);
+			fftw_execute_dft_r2c(plan_forward, segment2, spectrum2);
+			kernel_multiply_conj_add(spectrum1, spectrum2, accumulated, half_len);
+			if (auto_spectra) {
+				accumulate_power(spectrum1, power1, half_len);
+				accumulate_power(spectrum2, power2, half_len);
+			}
+		}
+	}
+	profile_end("fft_blocks", mark);
+
+	fftw_complex *total = (fftw_complex*)(memory_block + 2 * real_size + 2 * complex_size);
+	double *total_power = (double*)(total + half_len);
+	for (int thread = 1; thread < thread_cnt; thread++) {
+		fftw_complex *partial = (fftw_complex*)(memory_block + set_size * thread + 2 * real_size + 2 * complex_size);
+		for (int i = 0; i < half_len; i++) {
+			total[i][0] += partial[i][0];
+			total[i][1] += partial[i][1];
+		}
+		double *partial_power = (double*)(partial + half_len);
+		for (int i = 0; auto_spectra && i < 2 * half_len; i++) {
+			total_power[i] += partial_power[i];
+		}
+	}
+	if (weighting != WEIGHTING_NONE) {
+		weight_accumulated(total, total_power, total_power + half_len, half_len, weighting);
+	}
+	double *result = (double*)memory_block;
+	mark = profile_begin();
+	fftw_execute_dft_c2r(plan_backward, total, result);
+	profile_end("fft_backward", mark);
+	kernel_double_to_float(result, 1.0 / fft_len, *correlation, window);
+
+#pragma omp critical(fftw_planner)
+	{
+		fftw_destroy_plan(plan_forward);
+		fftw_destroy_plan(plan_backward);
+	}
+	fftw_free(memory_block);
+
+	return SUCCESS;
+}
+
+// Spectra and scratch arrays are padded to whole cache lines so that every one keeps the alignment FFTW planned for.
+static int aligned_half_len(int fft_len) {
+	return (fft_len / 2 + 1 + 3) & ~3;
+}
+
+// Channels (i, j), i < j, of the pair-th entry of the upper triangle of a channel_cnt x channel_cnt matrix.
+static void pair_channels(int pair, int channel_cnt, int *i, int *j) {
+	int row = 0;
+	while (pair >= channel_cnt - 1 - row) {
+		pair -= channel_cnt - 1 - row;
+		row++;
+	}
+	*i = row;
+	*j = row + 1 + pair;
+}
+
+static void store_pair(int *delays, float *peaks, int channel_cnt, int i, int j, int delay, float peak) {
+	delays[i * channel_cnt + j] = delay;
+	delays[j * channel_cnt + i] = -delay;
+	peaks[i * channel_cnt + j] = peaks[j * channel_cnt + i] = peak;
+}
+
+static int matrix_thread_cnt(int work_cnt) {
+	int thread_cnt = 1;
+#ifdef _OPENMP
+	thread_cnt = omp_get_max_threads();
+#endif
+	return thread_cnt < work_cnt ? thread_cnt : work_cnt;
+}
+
+// Delay matrix of channel_cnt equally long sources: every channel is transformed once at the full correlation
+// length and the N(N-1)/2 spectral products run in parallel. delays[i * channel_cnt + j] is the lag of the peak
+// of cross_correlation(source i, source j) and peaks[] its value; delays are antisymmetric, the diagonal is 0.
+int cross_correlation_matrix(const SampleSource *sources, int channel_cnt, int weighting, int *delays, float *peaks) {
+	int len = sources[0].len;
+	if (channel_cnt < 2 || len <= 0) {
+		fprintf(stderr, "Delay matrix needs at least two non-empty channels\n");
+		return ERROR_ARGUMENTS_INVALID;
+	}
+	int window = 2 * len - 1;
+	int fft_len = next_deg(window);
+	int half_len = fft_len / 2 + 1;
+	int stride = aligned_half_len(fft_len);
+	int pair_cnt = channel_cnt * (channel_cnt - 1) / 2;
+	int thread_cnt = matrix_thread_cnt(pair_cnt > channel_cnt ? pair_cnt : channel_cnt);
+
+	size_t spectra_size = sizeof(fftw_complex) * stride * channel_cnt;
+	size_t set_size = sizeof(fftw_complex) * stride + sizeof(double) * fft_len;
+	fftw_complex *spectra = fftw_malloc(spectra_size);
+	char *scratch = fftw_malloc(set_size * thread_cnt);
+	float *correlations = malloc(sizeof(float) * window * thread_cnt);
+	if (!spectra || !scratch || !correlations) {
+		fftw_free(spectra);
+		fftw_free(scratch);
+		free(correlations);
+		fprintf(stderr, "Failed to allocate memory for the delay matrix\n");
+		return ERROR_NOTENOUGH_MEMORY;
+	}
+	profile_alloc(spectra_size + (set_size + sizeof(float) * window) * thread_cnt);
+
+	fftw_plan plan_forward;
+	fftw_plan plan_backward;
+	ProfileMark mark = profile_begin();
+#pragma omp critical(fftw_planner)
+	{
+		plan_with_threads(fft_len, thread_cnt);
+		plan_forward = fftw_plan_dft_r2c_1d(fft_len, (double*)(scratch + sizeof(fftw_complex) * stride), (fftw_complex*)scratch, FFTW_ESTIMATE);
+		plan_backward = fftw_plan_dft_c2r_1d(fft_len, (fftw_complex*)scratch, (double*)(scratch + sizeof(fftw_complex) * stride), FFTW_ESTIMATE);
+	}
+	profile_end("fft_plan", mark);
+
+	for (int i = 0; i < channel_cnt; i++) {
+		delays[i * channel_cnt + i] = 0;
+		peaks[i * channel_cnt + i] = 0.0f;
+	}
+	mark = profile_begin();
+#pragma omp parallel num_threads(thread_cnt)
+	{
+		int thread_idx = 0;
+#ifdef _OPENMP
+		thread_idx = omp_get_thread_num();
+#endif
+		fftw_complex *product = (fftw_complex*)(scratch + set_size * thread_idx);
+		double *real = (double*)(product + stride);
+		float *correlation = correlations + (size_t)window * thread_idx;
+
+#pragma omp for schedule(dynamic)
+		for (int channel = 0; channel < channel_cnt; channel++) {
+			source_to_double(&sources[channel], 0, len, real);
+			memset(real + len, 0, sizeof(double) * (fft_len - len));
+			fftw_execute_dft_r2c(plan_forward, real, spectra + (size_t)stride * channel);
+		}
+
+#pragma omp for schedule(dynamic)
+		for (int pair = 0; pair < pair_cnt; pair++) {
+			int i, j;
+			pair_channels(pair, channel_cnt, &i, &j);
+			multiply_weighted(spectra + (size_t)stride * i, spectra + (size_t)stride * j, product, half_len, weighting);
+			fftw_execute_dft_c2r(plan_backward, product, real);
+			// Negative lags wrap around to the end of the circular result.
+			kernel_double_to_float(real + fft_len - len + 1, 1.0 / fft_len, correlation, len - 1);
+			kernel_double_to_float(real, 1.0 / fft_len, correlation + len - 1, len);
+			int peak = kernel_argmax(correlation, window);
+			store_pair(delays, peaks, channel_cnt, i, j, peak - len + 1, correlation[peak]);
+		}
+	}
+	profile_end("matrix_products", mark);
+
+#pragma omp critical(fftw_planner)
+	{
+		fftw_destroy_plan(plan_forward);
+		fftw_destroy_plan(plan_backward);
+	}
+	fftw_free(spectra);
+	fftw_free(scratch);
+	free(correlations);
+	return SUCCESS;
+}
+
+// Block version of cross_correlation_matrix for lags [-max_lag, max_lag], with the memory of
+// cross_correlation_blocked_source: blocks are processed one after another, each channel transforms its block and
+// its lag-extended segment once per block, and every pair accumulates its spectral product in parallel.
+int cross_correlation_matrix_blocked(const SampleSource *sources, int channel_cnt, int max_lag, int block_len, int weighting, int *delays, float *peaks) {
+	int len = sources[0].len;
+	if (channel_cnt < 2 || len <= 0 || max_lag < 0) {
+		fprintf(stderr, "Delay matrix needs at least two non-empty channels\n");
+		return ERROR_ARGUMENTS_INVALID;
+	}
+	if (max_lag > len - 1) {
+		max_lag = len - 1;
+	}
+	int window = 2 * max_lag + 1;
+	if (block_len <= 0) {
+		block_len = next_deg(window);
+	}
+	if (block_len > len) {
+		block_len = len;
+	}
+	int fft_len = next_deg(block_len + window - 1);
+	int half_len = fft_len / 2 + 1;
+	int stride = aligned_half_len(fft_len);
+	int block_cnt = (len + block_len - 1) / block_len;
+	int pair_cnt = channel_cnt * (channel_cnt - 1) / 2;
+	int thread_cnt = matrix_thread_cnt(pair_cnt > channel_cnt ? pair_cnt : channel_cnt);
+	bool auto_spectra = weighting == WEIGHTING_SCOT || weighting == WEIGHTING_ROTH;
+
+	// per channel: segment and block spectra (and their averaged auto-spectra); per pair: the accumulated product
+	size_t complex_size = sizeof(fftw_complex) * stride;
+	size_t power_size = auto_spectra ? sizeof(double) * stride : 0;
+	size_t channel_size = 2 * complex_size + 2 * power_size;
+	size_t spectra_size = channel_size * channel_cnt + complex_size * pair_cnt;
+	size_t set_size = sizeof(double) * fft_len;
+	char *spectra = fftw_malloc(spectra_size);
+	char *scratch = fftw_malloc(set_size * thread_cnt);
+	float *correlations = malloc(sizeof(float) * window * thread_cnt);
+	if (!spectra || !scratch || !correlations) {
+		fftw_free(spectra);
+		fftw_free(scratch);
+		free(correlations);
+		fprintf(stderr, "Failed to allocate memory for the delay matrix\n");
+		return ERROR_NOTENOUGH_MEMORY;
+	}
+	profile_alloc(spectra_size + (set_size + sizeof(float) * window) * thread_cnt);
+	memset(spectra, 0, spectra_size);
+	fftw_complex *accumulated = (fftw_complex*)(spectra + channel_size * channel_cnt);
+
+	fftw_plan plan_forward;
+	fftw_plan plan_backward;
+	ProfileMark mark = profile_begin();
+#pragma omp critical(fftw_planner)
+	{
+		plan_with_threads(1, 1);
+		plan_forward = fftw_plan_dft_r2c_1d(fft_len, (double*)scratch, accumulated, FFTW_ESTIMATE);
+		plan_backward = fftw_plan_dft_c2r_1d(fft_len, accumulated, (double*)scratch, FFTW_ESTIMATE);
+	}
+	profile_end("fft_plan", mark);
+
+	for (int i = 0; i < channel_cnt; i++) {
+		delays[i * channel_cnt + i] = 0;
+		peaks[i * channel_cnt + i] = 0.0f;
+	}
+	mark = profile_begin();
+#pragma omp parallel num_threads(thread_cnt)
+	{
+		int thread_idx = 0;
+#ifdef _OPENMP
+		thread_idx = omp_get_thread_num();
+#endif
+		double *real = (double*)(scratch + set_size * thread_idx);
+		float *correlation = correlations + (size_t)window * thread_idx;
+
+		for (int block = 0; block < block_cnt; block++) {
+			int start = block * block_len;
+			int cnt = len - start < block_len ? len - start : block_len;
+			int start1 = start - max_lag;
+			int first1 = start1 < 0 ? -start1 : 0;
+			int end1 = start1 + cnt + window - 1 < len ? cnt + window - 1 : len - start1;
+
+#pragma omp for schedule(dynamic)
+			for (int channel = 0; channel < channel_cnt; channel++) {
+				char *set = spectra + channel_size * channel;
+				fftw_complex *segment = (fftw_complex*)set;
+				fftw_complex *samples = (fftw_complex*)(set + complex_size);
+				memset(real, 0, set_size);
+				if (end1 > first1) {
+					source_to_double(&sources[channel], start1 + first1, end1 - first1, real + first1);
+				}
+				fftw_execute_dft_r2c(plan_forward, real, segment);
+				memset(real + cnt, 0, sizeof(double) * (fft_len - cnt));
+				source_to_double(&sources[channel], start, cnt, real);
+				fftw_execute_dft_r2c(plan_forward, real, samples);
+				if (auto_spectra) {
+					double *power = (double*)(set + 2 * complex_size);
+					accumulate_power(segment, power, half_len);
+					accumulate_power(samples, power + stride, half_len);
+				}
+			}
+
+#pragma omp for schedule(dynamic)
+			for (int pair = 0; pair < pair_cnt; pair++) {
+				int i, j;
+				pair_channels(pair, channel_cnt, &i, &j);
+				fftw_complex *segment = (fftw_complex*)(spectra + channel_size * i);
+				fftw_complex *samples = (fftw_complex*)(spectra + channel_size * j + complex_size);
+				kernel_multiply_conj_add(segment, samples, accumulated + (size_t)stride * pair, half_len);
+			}
+		}
+
+#pragma omp for schedule(dynamic)
+		for (int pair = 0; pair < pair_cnt; pair++) {
+			int i, j;
+			pair_channels(pair, channel_cnt, &i, &j);
+			fftw_complex *total = accumulated + (size_t)stride * pair;
+			if (weighting != WEIGHTING_NONE) {
+				double *power1 = (double*)(spectra + channel_size * i + 2 * complex_size);
+				double *power2 = (double*)(spectra + channel_size * j + 2 * complex_size) + stride;
+				weight_accumulated(total, power1, power2, half_len, weighting);
+			}
+			fftw_execute_dft_c2r(plan_backward, total, real);
+			kernel_double_to_float(real, 1.0 / fft_len, correlation, window);
+			int peak = kernel_argmax(correlation, window);
+			store_pair(delays, peaks, channel_cnt, i, j, peak - max_lag, correlation[peak]);
+		}
+	}
+	profile_end("matrix_blocks", mark);
+
+#pragma omp critical(fftw_planner)
+	{
+		fftw_destroy_plan(plan_forward);
+		fftw_destroy_plan(plan_backward);
+	}
+	fftw_free(spectra);
+	fftw_free(scratch);
+	free(correlations);
+	return SUCCESS;
+}
+
+// Sub-sample offset of the peak at index from the parabola through it and its two neighbours, in [-0.5, 0.5].
+double parabolic_offset(const float *array, int size, int index) {
+	if (index <= 0 || index >= size - 1) {
+		return 0.0;
+	}
+	double left = array[index - 1];
+	double centre = array[index];
+	double right = array[index + 1];
+	double denominator = left - 2.0 * centre + right;
+	if (denominator >= 0.0) {
+		return 0.0;
+	}
+	return 0.5 * (left - right) / denominator;
+}
+
+static int decimate(const float *input, int len, int factor, float **output, int *output_len) {
+	*output_len = len / factor;
+	if (*output_len == 0) {
+		*output_len = 1;
+	}
+	*output = (float*)malloc(sizeof(float) * *output_len);
+	if (!*output) {
+		fprintf(stderr, "Failed to allocate memory for decimated signal\n");
+		return ERROR_NOTENOUGH_MEMORY;
+	}
+	for (int i = 0; i < *output_len; i++) {
+		int end = (i + 1) * factor < len ? (i + 1) * factor : len;
+		float sum = 0.0f;
+		for (int j = i * factor; j < end; j++) {
+			sum += input[j];
+		}
+		(*output)[i] = sum;
+	}
+	return SUCCESS;
+}
+
+// Delay search on signals box-filtered and decimated by factor, followed by a full-rate block correlation over
+// a few samples around each of the strongest coarse peaks. The result is the lag of data2 relative to data1
+// with a parabolic sub-sample correction, or the nearest sample if no neighbours are available. Only lags in
+// [lag_min, lag_max] are reported: coarse peaks further than one decimation step outside are skipped and the
+// refinement is clipped to the range.
+int find_delay_coarse_to_fine(const float *data1, const float *data2, int len1, int len2, int lag_min, int lag_max, int factor, int weighting, double *delay, double *peak_value) {
+	enum { CANDIDATE_CNT = 4 };
+	float *coarse1 = NULL;
+	float *coarse2 = NULL;
+	float *coarse = NULL;
+	int coarse_len1 = 0;
+	int coarse_len2 = 0;
+	int ret = decimate(data1, len1, factor, &coarse1, &coarse_len1);
+	if (ret == SUCCESS) ret = decimate(data2, len2, factor, &coarse2, &coarse_len2);
+	if (ret == SUCCESS) {
+		SampleSource source1 = array_source(coarse1, coarse_len1);
+		SampleSource source2 = array_source(coarse2, coarse_len2);
+		ret = cross_correlation_source(&source1, &source2, weighting, &coarse);
+	}
+	free(coarse1);
+	free(coarse2);
+	if (ret != SUCCESS) {
+		free(coarse);
+		return ret;
+	}
+
+	int coarse_cnt = coarse_len1 + coarse_len2 - 1;
+	int coarse_lag_min = -coarse_len2 + 1;
+	for (int i = 0; i < coarse_cnt; i++) {
+		int centre = (coarse_lag_min + i) * factor;
+		if (centre < lag_min - factor || centre > lag_max + factor) coarse[i] = -INFINITY;
+	}
+	int radius = 2 * factor;
+	SampleSource full1 = array_source(data1, len1);
+	SampleSource full2 = array_source(data2, len2);
+	// Weighted spectra need a fine frequency grid; the minimal blocks of the narrow window would smear them.
+	int fine_block_len = weighting == WEIGHTING_NONE ? 0 : WEIGHTED_FINE_BLOCK_LEN;
+	float best_value = -INFINITY;
+	for (int candidate = 0; candidate < CANDIDATE_CNT && ret == SUCCESS; candidate++) {
+		int peak = find_max_index(coarse, coarse_cnt);
+		if (coarse[peak] == -INFINITY) break;
+		for (int i = peak - 2 < 0 ? 0 : peak - 2; i <= peak + 2 && i < coarse_cnt; i++) {
+			coarse[i] = -INFINITY;
+		}
+		int centre = (coarse_lag_min + peak) * factor;
+		int fine_min = centre - radius > lag_min ? centre - radius : lag_min;
+		int fine_max = centre + radius < lag_max ? centre + radius : lag_max;
+		if (fine_min > fine_max) continue;
+		float *fine = NULL;
+		ret = cross_correlation_blocked_source(&full1, &full2, fine_min, fine_max, fine_block_len, weighting, &fine);
+		if (ret != SUCCESS) break;
+		int window = fine_max - fine_min + 1;
+		int fine_peak = find_max_index(fine, window);
+		if (fine[fine_peak] > best_value) {
+			best_value = fine[fine_peak];
+			*delay = fine_min + fine_peak + parabolic_offset(fine, window, fine_peak);
+			if (peak_value) *peak_value = best_value;
+		}
+		free(fine);
+	}
+	free(coarse);
+	return ret;
+}
+
+double signal_energy(const float *data, int len) {
+	double energy = 0.0;
+	for (int i = 0; i < len; i++) {
+		energy += (double)data[i] * data[i];
+	}
+	return energy;
+}
+
+double source_energy(const SampleSource *source) {
+	if (source->samples) return signal_energy(source->samples, source->len);
+	float chunk[SOURCE_CHUNK_LEN];
+	double energy = 0.0;
+	for (int start = 0; start < source->len; start += SOURCE_CHUNK_LEN) {
+		int cnt = source->len - start < SOURCE_CHUNK_LEN ? source->len - start : SOURCE_CHUNK_LEN;
+		source->read(source->context, start, cnt, chunk);
+		energy += signal_energy(chunk, cnt);
+	}
+	return energy;
+}
+
+// Peak scaled so that a clean, delayed copy scores 1 in every mode: the plain correlation is normalized by the
+// signal energies, PHAT and SCOT peaks already are, and Roth's carries the gain between the signals.
+double correlation_confidence(double peak, double energy1, double energy2, int weighting) {
+	if (weighting == WEIGHTING_PHAT || weighting == WEIGHTING_SCOT) return peak;
+	if (energy1 <= 0.0 || energy2 <= 0.0) return 0.0;
+	if (weighting == WEIGHTING_ROTH) return peak * sqrt(energy1 / energy2);
+	return peak / sqrt(energy1 * energy2);
+}
+
+// Forward r2c transform of data zero-padded to fft_len, suitable for cross_correlation_spectrum.
+int reference_spectrum(const float *data, int len, int fft_len, fftw_complex **spectrum) {
+	int half_len = fft_len / 2 + 1;
+	double *padded = fftw_alloc_real(fft_len);
+	*spectrum = fftw_alloc_complex(half_len);
+	if (!padded || !*spectrum) {
+		fftw_free(padded);
+		fftw_free(*spectrum);
+		*spectrum = NULL;
+		fprintf(stderr, "Failed to allocate memory for reference spectrum\n");
+		return ERROR_NOTENOUGH_MEMORY;
+	}
+	profile_alloc(sizeof(double) * fft_len + sizeof(fftw_complex) * half_len);
+	fftw_plan plan;
+	ProfileMark mark = profile_begin();
+#pragma omp critical(fftw_planner)
+	{
+		plan_with_threads(fft_len, 1);
+		plan = fftw_plan_dft_r2c_1d(fft_len, padded, *spectrum, FFTW_ESTIMATE);
+	}
+	profile_end("fft_plan", mark);
+	kernel_float_to_double(data, padded, len);
+	memset(padded + len, 0, sizeof(double) * (fft_len - len));
+	mark = profile_begin();
+	fftw_execute(plan);
+	profile_end("fft_forward", mark);
+#pragma omp critical(fftw_planner)
+	fftw_destroy_plan(plan);
+	fftw_free(padded);
+	return SUCCESS;
+}
+
+// Same output as cross_correlation(data1, data2, ...), with data1 given by its precomputed reference_spectrum.
+// fft_len must be a power of two not smaller than len1 + len2 - 1.
+int cross_correlation_spectrum(const fftw_complex *spectrum1, int len1, int fft_len, const float *data2, int len2, int weighting, float **correlation) {
+	if (fft_len < len1 + len2 - 1) {
+		fprintf(stderr, "Reference spectrum is too short for correlation\n");
+		return ERROR_ARGUMENTS_INVALID;
+	}
+	int half_len = fft_len / 2 + 1;
+	int len_out = len1 + len2 - 1;
+	double *real_block = fftw_alloc_real(fft_len);
+	fftw_complex *spectrum2 = fftw_alloc_complex(half_len);
+	*correlation = (float*)malloc(sizeof(float) * len_out);
+	if (!real_block || !spectrum2 || !*correlation) {
+		fftw_free(real_block);
+		fftw_free(spectrum2);
+		free(*correlation);
+		*correlation = NULL;
+		fprintf(stderr, "Failed to allocate memory for correlation arrays\n");
+		return ERROR_NOTENOUGH_MEMORY;
+	}
+	profile_alloc(sizeof(double) * fft_len + sizeof(fftw_complex) * half_len + sizeof(float) * len_out);
+	fftw_plan plan_forward;
+	fftw_plan plan_backward;
+	ProfileMark mark = profile_begin();
+#pragma omp critical(fftw_planner)
+	{
+		plan_with_threads(fft_len, 1);
+		plan_forward = fftw_plan_dft_r2c_1d(fft_len, real_block, spectrum2, FFTW_ESTIMATE);
+		plan_backward = fftw_plan_dft_c2r_1d(fft_len, spectrum2, real_block, FFTW_ESTIMATE);
+	}
+	profile_end("fft_plan", mark);
+	kernel_float_to_double(data2, real_block, len2);
+	memset(real_block + len2, 0, sizeof(double) * (fft_len - len2));
+	mark = profile_begin();
+	fftw_execute(plan_forward);
+	profile_end("fft_forward", mark);
+	mark = profile_begin();
+	multiply_weighted(spectrum1, spectrum2, spectrum2, half_len, weighting);
+	profile_end("spectrum_product", mark);
+	mark = profile_begin();
+	fftw_execute(plan_backward);
+	profile_end("fft_backward", mark);
+	// Negative lags wrap around to the end of the circular result.
+	kernel_double_to_float(real_block + fft_len - len2 + 1, 1.0 / fft_len, *correlation, len2 - 1);
+	kernel_double_to_float(real_block, 1.0 / fft_len, *correlation + len2 - 1, len1);
+#pragma omp critical(fftw_planner)
+	{
+		fftw_destroy_plan(plan_forward);
+		fftw_destroy_plan(plan_backward);
+	}
+	fftw_free(real_block);
+	fftw_free(spectrum2);
+	return SUCCESS;
+}
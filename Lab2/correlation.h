@@ -0,0 +1,58 @@
+#pragma once
+
+#include <fftw3.h>
+#include <stdint.h>
+
+// Spectral weighting of the cross-spectrum, applied inside the multiply. With a single (unaveraged) cross-spectrum
+// SCOT reduces to PHAT, so the two differ only in the block correlator, which averages over blocks.
+#define WEIGHTING_NONE 0
+#define WEIGHTING_PHAT 1
+#define WEIGHTING_SCOT 2
+#define WEIGHTING_ROTH 3
+
+// Input of a correlation: either decoded samples, or a read callback that converts them on demand chunk by chunk
+// (read copies count samples starting at start into dst).
+typedef struct {
+	const float *samples;
+	void (*read)(const void *context, int64_t start, int count, float *dst);
+	const void *context;
+	int len;
+} SampleSource;
+
+SampleSource array_source(const float *samples, int len);
+
+int source_to_array(const SampleSource *source, float **samples);
+
+int init_fft_threads(int thread_cnt);
+
+int find_max_index(const float *array, int size);
+
+int next_deg(int len);
+
+int cross_correlation(const float *data1, const float *data2, int len1, int len2, float **correlation);
+
+int cross_correlation_source(const SampleSource *source1, const SampleSource *source2, int weighting, float **correlation);
+
+int cross_correlation_source_lean(const SampleSource *source1, const SampleSource *source2, int weighting, float **correlation);
+
+int cross_correlation_blocked(const float *data1, const float *data2, int len1, int len2, int lag_min, int lag_max, int block_len, float **correlation);
+
+int cross_correlation_blocked_source(const SampleSource *source1, const SampleSource *source2, int lag_min, int lag_max, int block_len, int weighting, float **correlation);
+
+int cross_correlation_matrix(const SampleSource *sources, int channel_cnt, int weighting, int *delays, float *peaks);
+
+int cross_correlation_matrix_blocked(const SampleSource *sources, int channel_cnt, int max_lag, int block_len, int weighting, int *delays, float *peaks);
+
+double parabolic_offset(const float *array, int size, int index);
+
+int find_delay_coarse_to_fine(const float *data1, const float *data2, int len1, int len2, int lag_min, int lag_max, int factor, int weighting, double *delay, double *peak_value);
+
+double signal_energy(const float *data, int len);
+
+double source_energy(const SampleSource *source);
+
+double correlation_confidence(double peak, double energy1, double energy2, int weighting);
+
+int reference_spectrum(const float *data, int len, int fft_len, fftw_complex **spectrum);
+
+int cross_correlation_spectrum(const fftw_complex *spectrum1, int len1, int fft_len, const float *data2, int len2, int weighting, float **correlation);
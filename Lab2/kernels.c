@@ -0,0 +1,467 @@
+#include "kernels.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86
+#include <immintrin.h>
+#endif
+
+typedef struct {
+	const char *name;
+	int (*argmax)(const float *, int);
+	void (*multiply_conj)(const fftw_complex *, const fftw_complex *, fftw_complex *, int);
+	void (*multiply_conj_add)(const fftw_complex *, const fftw_complex *, fftw_complex *, int);
+	void (*multiply_conj_phat)(const fftw_complex *, const fftw_complex *, fftw_complex *, int);
+	void (*multiply_conj_roth)(const fftw_complex *, const fftw_complex *, fftw_complex *, int);
+	void (*float_to_double)(const float *, double *, int);
+	void (*float_to_complex)(const float *, fftw_complex *, int);
+	void (*double_to_float)(const double *, double, float *, int);
+	void (*complex_to_float)(const fftw_complex *, double, float *, int);
+	void (*s16_to_float)(const int16_t *, float *, int);
+	void (*s16_strided_to_float)(const int16_t *, int, float *, int);
+	void (*s24_strided_to_float)(const uint8_t *, int, float *, int);
+} KernelTable;
+
+// Scalar versions: the reference results, the fallback on non-x86 builds and the tail loops of the SIMD versions.
+
+static int argmax_from(const float *array, int start, int size, int max_index) {
+	for (int i = start; i < size; i++) {
+		if (array[i] > array[max_index]) {
+			max_index = i;
+		}
+	}
+	return max_index;
+}
+
+static int argmax_scalar(const float *array, int size) {
+	return argmax_from(array, 1, size, 0);
+}
+
+static void multiply_conj_scalar(const fftw_complex *a, const fftw_complex *b, fftw_complex *out, int size) {
+	for (int i = 0; i < size; i++) {
+		double re = a[i][0] * b[i][0] + a[i][1] * b[i][1];
+		double im = a[i][1] * b[i][0] - a[i][0] * b[i][1];
+		out[i][0] = re;
+		out[i][1] = im;
+	}
+}
+
+static void multiply_conj_add_scalar(const fftw_complex *a, const fftw_complex *b, fftw_complex *acc, int size) {
+	for (int i = 0; i < size; i++) {
+		acc[i][0] += a[i][0] * b[i][0] + a[i][1] * b[i][1];
+		acc[i][1] += a[i][1] * b[i][0] - a[i][0] * b[i][1];
+	}
+}
+
+static double inverse_or_zero(double value) {
+	return value > 0.0 ? 1.0 / value : 0.0;
+}
+
+static void multiply_conj_phat_scalar(const fftw_complex *a, const fftw_complex *b, fftw_complex *out, int size) {
+	for (int i = 0; i < size; i++) {
+		double re = a[i][0] * b[i][0] + a[i][1] * b[i][1];
+		double im = a[i][1] * b[i][0] - a[i][0] * b[i][1];
+		double weight = inverse_or_zero(sqrt(re * re + im * im));
+		out[i][0] = re * weight;
+		out[i][1] = im * weight;
+	}
+}
+
+static void multiply_conj_roth_scalar(const fftw_complex *a, const fftw_complex *b, fftw_complex *out, int size) {
+	for (int i = 0; i < size; i++) {
+		double re = a[i][0] * b[i][0] + a[i][1] * b[i][1];
+		double im = a[i][1] * b[i][0] - a[i][0] * b[i][1];
+		double weight = inverse_or_zero(a[i][0] * a[i][0] + a[i][1] * a[i][1]);
+		out[i][0] = re * weight;
+		out[i][1] = im * weight;
+	}
+}
+
+static void float_to_double_scalar(const float *src, double *dst, int size) {
+	for (int i = 0; i < size; i++) {
+		dst[i] = src[i];
+	}
+}
+
+static void float_to_complex_scalar(const float *src, fftw_complex *dst, int size) {
+	for (int i = 0; i < size; i++) {
+		dst[i][0] = src[i];
+		dst[i][1] = 0.0;
+	}
+}
+
+static void double_to_float_scalar(const double *src, double scale, float *dst, int size) {
+	for (int i = 0; i < size; i++) {
+		dst[i] = (float)(src[i] * scale);
+	}
+}
+
+static void complex_to_float_scalar(const fftw_complex *src, double scale, float *dst, int size) {
+	for (int i = 0; i < size; i++) {
+		dst[i] = (float)(src[i][0] * scale);
+	}
+}
+
+static void s16_to_float_scalar(const int16_t *src, float *dst, int size) {
+	for (int i = 0; i < size; i++) {
+		dst[i] = (float)src[i] / 32768.0f;
+	}
+}
+
+static void s16_strided_to_float_scalar(const int16_t *src, int stride, float *dst, int size) {
+	for (int i = 0; i < size; i++) {
+		dst[i] = (float)src[(ptrdiff_t)i * stride] / 32768.0f;
+	}
+}
+
+static float s24_to_float(const uint8_t *src) {
+	int32_t value = (int32_t)((uint32_t)src[0] << 8 | (uint32_t)src[1] << 16 | (uint32_t)src[2] << 24) >> 8;
+	return (float)value / 8388608.0f;
+}
+
+static void s24_strided_to_float_scalar(const uint8_t *src, int stride, float *dst, int size) {
+	for (int i = 0; i < size; i++) {
+		dst[i] = s24_to_float(src + (ptrdiff_t)i * stride * 3);
+	}
+}
+
+static const KernelTable scalar_kernels = {
+	"scalar",
+	argmax_scalar,
+	multiply_conj_scalar,
+	multiply_conj_add_scalar,
+	multiply_conj_phat_scalar,
+	multiply_conj_roth_scalar,
+	float_to_double_scalar,
+	float_to_complex_scalar,
+	double_to_float_scalar,
+	complex_to_float_scalar,
+	s16_to_float_scalar,
+	s16_strided_to_float_scalar,
+	s24_strided_to_float_scalar,
+};
+
+#ifdef KERNELS_X86
+
+// Picks the first index holding the largest lane value, matching the scalar scan order.
+static int reduce_lanes(const float *values, const int32_t *indices, int lanes) {
+	int best = 0;
+	for (int lane = 1; lane < lanes; lane++) {
+		if (values[lane] > values[best] || (values[lane] == values[best] && indices[lane] < indices[best])) {
+			best = lane;
+		}
+	}
+	return indices[best];
+}
+
+static int argmax_sse2(const float *array, int size) {
+	if (size < 8) return argmax_scalar(array, size);
+	// Every lane starts from array[0] like the scalar scan, so a leading NaN never gets replaced and a NaN
+	// further on never freezes a lane.
+	__m128 max_values = _mm_set1_ps(array[0]);
+	__m128i max_indices = _mm_setzero_si128();
+	__m128i indices = _mm_setr_epi32(0, 1, 2, 3);
+	const __m128i step = _mm_set1_epi32(4);
+	int i = 0;
+	for (; i + 4 <= size; i += 4) {
+		__m128 values = _mm_loadu_ps(array + i);
+		__m128 greater = _mm_cmpgt_ps(values, max_values);
+		max_values = _mm_or_ps(_mm_and_ps(greater, values), _mm_andnot_ps(greater, max_values));
+		__m128i mask = _mm_castps_si128(greater);
+		max_indices = _mm_or_si128(_mm_and_si128(mask, indices), _mm_andnot_si128(mask, max_indices));
+		indices = _mm_add_epi32(indices, step);
+	}
+	float lane_values[4];
+	int32_t lane_indices[4];
+	_mm_storeu_ps(lane_values, max_values);
+	_mm_storeu_si128((__m128i *)lane_indices, max_indices);
+	return argmax_from(array, i, size, reduce_lanes(lane_values, lane_indices, 4));
+}
+
+__attribute__((target("avx2"))) static int argmax_avx2(const float *array, int size) {
+	if (size < 16) return argmax_scalar(array, size);
+	__m256 max_values = _mm256_set1_ps(array[0]);
+	__m256i max_indices = _mm256_setzero_si256();
+	__m256i indices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i step = _mm256_set1_epi32(8);
+	int i = 0;
+	for (; i + 8 <= size; i += 8) {
+		__m256 values = _mm256_loadu_ps(array + i);
+		__m256 greater = _mm256_cmp_ps(values, max_values, _CMP_GT_OQ);
+		max_values = _mm256_blendv_ps(max_values, values, greater);
+		max_indices = _mm256_blendv_epi8(max_indices, indices, _mm256_castps_si256(greater));
+		indices = _mm256_add_epi32(indices, step);
+	}
+	float lane_values[8];
+	int32_t lane_indices[8];
+	_mm256_storeu_ps(lane_values, max_values);
+	_mm256_storeu_si256((__m256i *)lane_indices, max_indices);
+	return argmax_from(array, i, size, reduce_lanes(lane_values, lane_indices, 8));
+}
+
+// a * conj(b) for one complex per register: [ar * br + ai * bi, ai * br - ar * bi], the same operations and order
+// as the scalar loop, so all versions agree bit for bit.
+static inline __m128d multiply_conj_sse2_one(__m128d a, __m128d b) {
+	const __m128d negate_imag = _mm_setr_pd(0.0, -0.0);
+	__m128d b_re = _mm_unpacklo_pd(b, b);
+	__m128d b_im = _mm_unpackhi_pd(b, b);
+	__m128d a_swapped = _mm_shuffle_pd(a, a, 1);
+	return _mm_add_pd(_mm_mul_pd(a, b_re), _mm_xor_pd(_mm_mul_pd(a_swapped, b_im), negate_imag));
+}
+
+static void multiply_conj_sse2(const fftw_complex *a, const fftw_complex *b, fftw_complex *out, int size) {
+	for (int i = 0; i < size; i++) {
+		_mm_storeu_pd(out[i], multiply_conj_sse2_one(_mm_loadu_pd(a[i]), _mm_loadu_pd(b[i])));
+	}
+}
+
+static void multiply_conj_add_sse2(const fftw_complex *a, const fftw_complex *b, fftw_complex *acc, int size) {
+	for (int i = 0; i < size; i++) {
+		__m128d product = multiply_conj_sse2_one(_mm_loadu_pd(a[i]), _mm_loadu_pd(b[i]));
+		_mm_storeu_pd(acc[i], _mm_add_pd(_mm_loadu_pd(acc[i]), product));
+	}
+}
+
+__attribute__((target("avx2"))) static inline __m256d multiply_conj_avx2_two(__m256d a, __m256d b) {
+	const __m256d negate_imag = _mm256_setr_pd(0.0, -0.0, 0.0, -0.0);
+	__m256d b_re = _mm256_movedup_pd(b);
+	__m256d b_im = _mm256_permute_pd(b, 0xF);
+	__m256d a_swapped = _mm256_permute_pd(a, 0x5);
+	return _mm256_add_pd(_mm256_mul_pd(a, b_re), _mm256_xor_pd(_mm256_mul_pd(a_swapped, b_im), negate_imag));
+}
+
+__attribute__((target("avx2"))) static void multiply_conj_avx2(const fftw_complex *a, const fftw_complex *b, fftw_complex *out, int size) {
+	int i = 0;
+	for (; i + 2 <= size; i += 2) {
+		_mm256_storeu_pd(out[i], multiply_conj_avx2_two(_mm256_loadu_pd(a[i]), _mm256_loadu_pd(b[i])));
+	}
+	multiply_conj_scalar(a + i, b + i, out + i, size - i);
+}
+
+__attribute__((target("avx2"))) static void multiply_conj_add_avx2(const fftw_complex *a, const fftw_complex *b, fftw_complex *acc, int size) {
+	int i = 0;
+	for (; i + 2 <= size; i += 2) {
+		__m256d product = multiply_conj_avx2_two(_mm256_loadu_pd(a[i]), _mm256_loadu_pd(b[i]));
+		_mm256_storeu_pd(acc[i], _mm256_add_pd(_mm256_loadu_pd(acc[i]), product));
+	}
+	multiply_conj_add_scalar(a + i, b + i, acc + i, size - i);
+}
+
+// Scales both complexes by 1 / sqrt(norm), norm holding re * re + im * im of each one, or by 0 where norm is 0.
+__attribute__((target("avx2"))) static inline __m256d weight_avx2_two(__m256d product, __m256d squares, bool take_root) {
+	__m256d norm = _mm256_hadd_pd(squares, squares);
+	if (take_root) norm = _mm256_sqrt_pd(norm);
+	__m256d positive = _mm256_cmp_pd(norm, _mm256_setzero_pd(), _CMP_GT_OQ);
+	__m256d weight = _mm256_and_pd(_mm256_div_pd(_mm256_set1_pd(1.0), norm), positive);
+	return _mm256_mul_pd(product, weight);
+}
+
+__attribute__((target("avx2"))) static void multiply_conj_phat_avx2(const fftw_complex *a, const fftw_complex *b, fftw_complex *out, int size) {
+	int i = 0;
+	for (; i + 2 <= size; i += 2) {
+		__m256d product = multiply_conj_avx2_two(_mm256_loadu_pd(a[i]), _mm256_loadu_pd(b[i]));
+		_mm256_storeu_pd(out[i], weight_avx2_two(product, _mm256_mul_pd(product, product), true));
+	}
+	multiply_conj_phat_scalar(a + i, b + i, out + i, size - i);
+}
+
+__attribute__((target("avx2"))) static void multiply_conj_roth_avx2(const fftw_complex *a, const fftw_complex *b, fftw_complex *out, int size) {
+	int i = 0;
+	for (; i + 2 <= size; i += 2) {
+		__m256d values = _mm256_loadu_pd(a[i]);
+		__m256d product = multiply_conj_avx2_two(values, _mm256_loadu_pd(b[i]));
+		_mm256_storeu_pd(out[i], weight_avx2_two(product, _mm256_mul_pd(values, values), false));
+	}
+	multiply_conj_roth_scalar(a + i, b + i, out + i, size - i);
+}
+
+__attribute__((target("avx2"))) static void float_to_double_avx2(const float *src, double *dst, int size) {
+	int i = 0;
+	for (; i + 4 <= size; i += 4) {
+		_mm256_storeu_pd(dst + i, _mm256_cvtps_pd(_mm_loadu_ps(src + i)));
+	}
+	float_to_double_scalar(src + i, dst + i, size - i);
+}
+
+__attribute__((target("avx2"))) static void float_to_complex_avx2(const float *src, fftw_complex *dst, int size) {
+	const __m256d zero = _mm256_setzero_pd();
+	int i = 0;
+	for (; i + 4 <= size; i += 4) {
+		__m256d values = _mm256_cvtps_pd(_mm_loadu_ps(src + i));
+		__m256d low = _mm256_unpacklo_pd(values, zero);
+		__m256d high = _mm256_unpackhi_pd(values, zero);
+		_mm256_storeu_pd(dst[i], _mm256_permute2f128_pd(low, high, 0x20));
+		_mm256_storeu_pd(dst[i + 2], _mm256_permute2f128_pd(low, high, 0x31));
+	}
+	float_to_complex_scalar(src + i, dst + i, size - i);
+}
+
+__attribute__((target("avx2"))) static void double_to_float_avx2(const double *src, double scale, float *dst, int size) {
+	const __m256d factor = _mm256_set1_pd(scale);
+	int i = 0;
+	for (; i + 4 <= size; i += 4) {
+		_mm_storeu_ps(dst + i, _mm256_cvtpd_ps(_mm256_mul_pd(_mm256_loadu_pd(src + i), factor)));
+	}
+	double_to_float_scalar(src + i, scale, dst + i, size - i);
+}
+
+__attribute__((target("avx2"))) static void complex_to_float_avx2(const fftw_complex *src, double scale, float *dst, int size) {
+	const __m256d factor = _mm256_set1_pd(scale);
+	int i = 0;
+	for (; i + 4 <= size; i += 4) {
+		__m256d real = _mm256_unpacklo_pd(_mm256_loadu_pd(src[i]), _mm256_loadu_pd(src[i + 2]));
+		real = _mm256_permute4x64_pd(real, 0xD8);
+		_mm_storeu_ps(dst + i, _mm256_cvtpd_ps(_mm256_mul_pd(real, factor)));
+	}
+	complex_to_float_scalar(src + i, scale, dst + i, size - i);
+}
+
+__attribute__((target("avx2"))) static void s16_to_float_avx2(const int16_t *src, float *dst, int size) {
+	const __m256 factor = _mm256_set1_ps(1.0f / 32768.0f);
+	int i = 0;
+	for (; i + 8 <= size; i += 8) {
+		__m256i wide = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src + i)));
+		_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(wide), factor));
+	}
+	s16_to_float_scalar(src + i, dst + i, size - i);
+}
+
+// The gathers below load 32 bits per sample, i.e. past the end of it; the vector loops stop one sample early so
+// those extra bytes always belong to the following sample or frame and never run off the end of a mapping.
+
+__attribute__((target("avx2"))) static void s16_strided_to_float_avx2(const int16_t *src, int stride, float *dst, int size) {
+	if (stride == 1) {
+		s16_to_float_avx2(src, dst, size);
+		return;
+	}
+	const __m256 factor = _mm256_set1_ps(1.0f / 32768.0f);
+	const __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+	int i = 0;
+	for (; i + 8 < size; i += 8) {
+		__m256i words = _mm256_i32gather_epi32((const int *)(src + (ptrdiff_t)i * stride), offsets, 2);
+		__m256i wide = _mm256_srai_epi32(_mm256_slli_epi32(words, 16), 16);
+		_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(wide), factor));
+	}
+	s16_strided_to_float_scalar(src + (ptrdiff_t)i * stride, stride, dst + i, size - i);
+}
+
+__attribute__((target("avx2"))) static void s24_strided_to_float_avx2(const uint8_t *src, int stride, float *dst, int size) {
+	const __m256 factor = _mm256_set1_ps(1.0f / 8388608.0f);
+	const __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(3 * stride));
+	int i = 0;
+	for (; i + 8 < size; i += 8) {
+		__m256i words = _mm256_i32gather_epi32((const int *)(src + (ptrdiff_t)i * stride * 3), offsets, 1);
+		__m256i wide = _mm256_srai_epi32(_mm256_slli_epi32(words, 8), 8);
+		_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(wide), factor));
+	}
+	s24_strided_to_float_scalar(src + (ptrdiff_t)i * stride * 3, stride, dst + i, size - i);
+}
+
+static const KernelTable sse2_kernels = {
+	"sse2",
+	argmax_sse2,
+	multiply_conj_sse2,
+	multiply_conj_add_sse2,
+	multiply_conj_phat_scalar,
+	multiply_conj_roth_scalar,
+	float_to_double_scalar,
+	float_to_complex_scalar,
+	double_to_float_scalar,
+	complex_to_float_scalar,
+	s16_to_float_scalar,
+	s16_strided_to_float_scalar,
+	s24_strided_to_float_scalar,
+};
+
+static const KernelTable avx2_kernels = {
+	"avx2",
+	argmax_avx2,
+	multiply_conj_avx2,
+	multiply_conj_add_avx2,
+	multiply_conj_phat_avx2,
+	multiply_conj_roth_avx2,
+	float_to_double_avx2,
+	float_to_complex_avx2,
+	double_to_float_avx2,
+	complex_to_float_avx2,
+	s16_to_float_avx2,
+	s16_strided_to_float_avx2,
+	s24_strided_to_float_avx2,
+};
+
+#endif
+
+static const KernelTable *kernels = NULL;
+
+// Selected once from the CPU features; every caller gets the same table, so a racing first call is harmless.
+void init_kernels(void) {
+	const KernelTable *selected = &scalar_kernels;
+#ifdef KERNELS_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		selected = &avx2_kernels;
+	} else if (__builtin_cpu_supports("sse2")) {
+		selected = &sse2_kernels;
+	}
+#endif
+	kernels = selected;
+}
+
+static const KernelTable *table(void) {
+	if (!kernels) init_kernels();
+	return kernels;
+}
+
+const char *kernels_name(void) {
+	return table()->name;
+}
+
+int kernel_argmax(const float *array, int size) {
+	return table()->argmax(array, size);
+}
+
+void kernel_multiply_conj(const fftw_complex *a, const fftw_complex *b, fftw_complex *out, int size) {
+	table()->multiply_conj(a, b, out, size);
+}
+
+void kernel_multiply_conj_add(const fftw_complex *a, const fftw_complex *b, fftw_complex *acc, int size) {
+	table()->multiply_conj_add(a, b, acc, size);
+}
+
+void kernel_multiply_conj_phat(const fftw_complex *a, const fftw_complex *b, fftw_complex *out, int size) {
+	table()->multiply_conj_phat(a, b, out, size);
+}
+
+void kernel_multiply_conj_roth(const fftw_complex *a, const fftw_complex *b, fftw_complex *out, int size) {
+	table()->multiply_conj_roth(a, b, out, size);
+}
+
+void kernel_float_to_double(const float *src, double *dst, int size) {
+	table()->float_to_double(src, dst, size);
+}
+
+void kernel_float_to_complex(const float *src, fftw_complex *dst, int size) {
+	table()->float_to_complex(src, dst, size);
+}
+
+void kernel_double_to_float(const double *src, double scale, float *dst, int size) {
+	table()->double_to_float(src, scale, dst, size);
+}
+
+void kernel_complex_to_float(const fftw_complex *src, double scale, float *dst, int size) {
+	table()->complex_to_float(src, scale, dst, size);
+}
+
+void kernel_s16_to_float(const int16_t *src, float *dst, int size) {
+	table()->s16_to_float(src, dst, size);
+}
+
+void kernel_s16_strided_to_float(const int16_t *src, int stride, float *dst, int size) {
+	table()->s16_strided_to_float(src, stride, dst, size);
+}
+
+void kernel_s24_strided_to_float(const uint8_t *src, int stride, float *dst, int size) {
+	table()->s24_strided_to_float(src, stride, dst, size);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <fftw3.h>
+#include <stdint.h>
+
+void init_kernels(void);
+
+const char *kernels_name(void);
+
+int kernel_argmax(const float *array, int size);
+
+void kernel_multiply_conj(const fftw_complex *a, const fftw_complex *b, fftw_complex *out, int size);
+
+void kernel_multiply_conj_add(const fftw_complex *a, const fftw_complex *b, fftw_complex *acc, int size);
+
+// a * conj(b) divided by its magnitude (PHAT) or by |a|^2 (Roth); bins with a zero divisor become 0.
+void kernel_multiply_conj_phat(const fftw_complex *a, const fftw_complex *b, fftw_complex *out, int size);
+
+void kernel_multiply_conj_roth(const fftw_complex *a, const fftw_complex *b, fftw_complex *out, int size);
+
+void kernel_float_to_double(const float *src, double *dst, int size);
+
+void kernel_float_to_complex(const float *src, fftw_complex *dst, int size);
+
+void kernel_double_to_float(const double *src, double scale, float *dst, int size);
+
+void kernel_complex_to_float(const fftw_complex *src, double scale, float *dst, int size);
+
+void kernel_s16_to_float(const int16_t *src, float *dst, int size);
+
+// Every stride-th sample starting at src, e.g. one channel of interleaved PCM; 24-bit samples are packed little-endian.
+void kernel_s16_strided_to_float(const int16_t *src, int stride, float *dst, int size);
+
+void kernel_s24_strided_to_float(const uint8_t *src, int stride, float *dst, int size);
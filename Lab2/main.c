@@ -1,30 +1,184 @@
 #include "return_codes.h"
 #include "audio_util.h"
+#include "batch.h"
+#include "correlation.h"
+#include "kernels.h"
+#include "matrix.h"
+#include "options.h"
+#include "pcm_map.h"
+#include "profile.h"
+#include "stream.h"
 #include <fftw3.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 
-int main(int argc, char *argv[]) {
+static void print_confidence(const Options *options, const SampleSource *source1, const SampleSource *source2, double peak) {
+    if (!options->normalize) return;
+    double confidence = correlation_confidence(peak, source_energy(source1), source_energy(source2), options->weighting);
+    printf("confidence: %.4f\n", confidence);
+}
+
+// Correlates the two signals and prints the delay of source2 relative to source1, plus the confidence of the
+// peak with --normalize on.
+static int report_delay(const Options *options, const SampleSource *source1, const SampleSource *source2, int sample_rate_total) {
+    if (source1->len <= 0 || source2->len <= 0) return SUCCESS;
+    int lag_min = -source2->len + 1;
+    int lag_max = source1->len - 1;
+    if (options->max_lag >= 0) {
+        int max_lag_samples = (int)fmin(options->max_lag * sample_rate_total, lag_max - lag_min);
+        lag_min = max_lag_samples < -lag_min ? -max_lag_samples : lag_min;
+        lag_max = max_lag_samples < lag_max ? max_lag_samples : lag_max;
+    }
+    int ret = SUCCESS;
+    if (options->coarse_factor > 0) {
+        // Decimation needs the whole signal, so mapped inputs are converted once here.
+        float *data1 = NULL;
+        float *data2 = NULL;
+        if (!source1->samples) ret = source_to_array(source1, &data1);
+        if (ret == SUCCESS && !source2->samples) ret = source_to_array(source2, &data2);
+        double delay = 0.0;
+        double peak = 0.0;
+        if (ret == SUCCESS) {
+            ret = find_delay_coarse_to_fine(data1 ? data1 : source1->samples, data2 ? data2 : source2->samples,
+                                            source1->len, source2->len, lag_min, lag_max, options->coarse_factor, options->weighting, &delay, &peak);
+        }
+        free(data1);
+        free(data2);
+        if (ret != SUCCESS) return ret;
+        double time_delay_ms = delay * 1000.0 / sample_rate_total;
+        printf("delta: %i samples\nsample rate: %i Hz\ndelta time: %i ms\n", (int)lround(delay), sample_rate_total, (int)floor(time_delay_ms));
+        print_confidence(options, source1, source2, peak);
+        return SUCCESS;
+    }
+    int N = lag_max - lag_min + 1;
+    float *correlation = NULL;
+    if (options->max_lag >= 0 || options->block_size > 0) {
+        ret = cross_correlation_blocked_source(source1, source2, lag_min, lag_max, options->block_size, options->weighting, &correlation);
+    } else if (options->lean) {
+        ret = cross_correlation_source_lean(source1, source2, options->weighting, &correlation);
+    } else {
+        ret = cross_correlation_source(source1, source2, options->weighting, &correlation);
+    }
+    if (ret != SUCCESS) return ret;
+    int peak_index = find_max_index(correlation, N);
+    double peak = correlation[peak_index];
+    int time_delay_samples = lag_min + peak_index;
+    free(correlation);
+    double time_delay_ms = (double)time_delay_samples * 1000.0 / sample_rate_total;
+    printf("delta: %i samples\nsample rate: %i Hz\ndelta time: %i ms\n", time_delay_samples, sample_rate_total, (int)floor(time_delay_ms));
+    print_confidence(options, source1, source2, peak);
+    return SUCCESS;
+}
+
+// Fast path for uncompressed inputs: WAV and raw PCM files are memory-mapped and read by the correlation directly,
+// without FFmpeg and without an intermediate samples array. In two-file mode the other file may still be any
+// format FFmpeg decodes. Returns ERROR_UNSUPPORTED, having printed nothing, when no input can be mapped.
+static int run_mapped(const Options *options, int input_cnt) {
+    PcmMap maps[MAX_INPUT_FILES];
+    AudioInfo decoded[MAX_INPUT_FILES];
+    bool mapped[MAX_INPUT_FILES] = {false, false};
+    SampleSource sources[MAX_INPUT_FILES];
+    int rates[MAX_INPUT_FILES];
+    float *resampled = NULL;
+    int file_cnt = input_cnt - 1;
+
+    for (int i = 0; i < file_cnt; i++) {
+        init_audio_info(&decoded[i]);
+    }
+    int ret = SUCCESS;
+    for (int i = 0; i < file_cnt && ret == SUCCESS; i++) {
+        ret = pcm_map_open(options->files[i], options->raw_rate, options->raw_channels, options->pcm_format, &maps[i]);
+        mapped[i] = ret == SUCCESS;
+        if (ret == ERROR_UNSUPPORTED) ret = SUCCESS;
+        if (mapped[i] && options->window_len > 0) {
+            pcm_map_window(&maps[i], llround(options->window_start * maps[i].sample_rate),
+                           llround(options->window_len * maps[i].sample_rate));
+        }
+    }
+    if (ret != SUCCESS || (!mapped[0] && (file_cnt == 1 || !mapped[1]))) {
+        ret = ret == SUCCESS ? ERROR_UNSUPPORTED : ret;
+        goto cleanup;
+    }
 
-    if (argc < 2) {
-        fprintf(stderr, "No files provided");
-        return ERROR_ARGUMENTS_INVALID;
+    if (file_cnt == 1) {
+        if (maps[0].channels != 2) {
+            fprintf(stderr, "Invalid number of channels: %d in file '%s'", maps[0].channels, options->files[0]);
+            ret = ERROR_FORMAT_INVALID;
+            goto cleanup;
+        }
+        sources[0] = pcm_map_source(&maps[0], 0);
+        sources[1] = pcm_map_source(&maps[0], 1);
+        rates[0] = rates[1] = maps[0].sample_rate;
+    } else {
+        for (int i = 0; i < file_cnt && ret == SUCCESS; i++) {
+            if (mapped[i]) {
+                sources[i] = pcm_map_source(&maps[i], 0);
+                rates[i] = maps[i].sample_rate;
+            } else {
+                set_decode_window(&decoded[i], options->window_start, options->window_len);
+                ret = load_audio_file(options->files[i], 0, 0, options->resampler, &decoded[i], &rates[i]);
+                sources[i] = array_source(decoded[i].samples, decoded[i].samples_cnt);
+            }
+        }
+        if (ret == SUCCESS && rates[0] != rates[1]) {
+            int lower = rates[0] < rates[1] ? 0 : 1;
+            int32_t resampled_cnt = 0;
+            ret = resample_source(&sources[lower], rates[lower], rates[1 - lower], options->resampler, &resampled, &resampled_cnt);
+            sources[lower] = array_source(resampled, resampled_cnt);
+            rates[lower] = rates[1 - lower];
+        }
     }
+    if (ret == SUCCESS) ret = report_delay(options, &sources[0], &sources[1], rates[0]);
 
-    if (argc > 3) {
-        fprintf(stderr, "Too many arguments given. Must be 1 or 2");
-        return ERROR_ARGUMENTS_INVALID;
+    cleanup:
+    for (int i = 0; i < file_cnt; i++) {
+        if (mapped[i]) pcm_map_close(&maps[i]);
+        free_resources(decoded[i]);
     }
+    free(resampled);
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+
+    Options options;
+    int ret_options = parse_options(argc, argv, &options);
+    if (ret_options != SUCCESS) return ret_options;
+    if (options.profile) {
+        int ret_profile = profile_enable(options.profile);
+        if (ret_profile != SUCCESS) return ret_profile;
+    }
+    init_kernels();
+    if (options.threads > 0) {
+        int ret_threads = init_fft_threads(options.threads);
+        if (ret_threads != SUCCESS) return ret_threads;
+    }
+    if (options.batch) {
+        av_log_set_level(AV_LOG_QUIET);
+        return run_batch(&options);
+    }
+    if (options.stream_rate) {
+        return run_stream(&options);
+    }
+    if (options.matrix) {
+        av_log_set_level(AV_LOG_QUIET);
+        return run_matrix(&options);
+    }
+    int input_cnt = options.file_count + 1;
+
+    av_log_set_level(AV_LOG_QUIET);
+    int ret_mapped = run_mapped(&options, input_cnt);
+    if (ret_mapped != ERROR_UNSUPPORTED) return ret_mapped;
 
     AudioInfo channel1;
     AudioInfo channel2;
 
     init_audio_info(&channel1);
     init_audio_info(&channel2);
-
-    av_log_set_level(AV_LOG_QUIET);
+    set_decode_window(&channel1, options.window_start, options.window_len);
+    set_decode_window(&channel2, options.window_start, options.window_len);
 
     int32_t channel_1_idx = 0;
     int32_t channel_2_idx = 0;
@@ -32,8 +186,7 @@ int main(int argc, char *argv[]) {
     int audio_stream_idx_1 = -1;
     int audio_stream_idx_2 = -1;
 
-    float *correlation = NULL;
-    const char *file1 = argv[1];
+    const char *file1 = options.files[0];
 
 
     int ret1 = open_and_find_stream_info(file1, &channel1.format_context);
@@ -44,7 +197,7 @@ int main(int argc, char *argv[]) {
         return ERROR_DATA_INVALID;
     }
 
-    if (argc == 2) {
+    if (input_cnt == 2) {
         int num_of_channels = channel1.format_context->streams[audio_stream_idx_1]->codecpar->ch_layout.nb_channels;
         if (num_of_channels != 2) {
             fprintf(stderr, "Invalid number of channels: %d in file '%s'", num_of_channels, file1);
@@ -59,13 +212,13 @@ int main(int argc, char *argv[]) {
             return ret_process;
         }
 
-        int ret_dec = decode_into_samples(&channel1, &channel2, audio_stream_idx_1, audio_stream_idx_1, channel_1_idx, channel_2_idx, argc);
+        int ret_dec = decode_into_samples(&channel1, &channel2, audio_stream_idx_1, audio_stream_idx_1, channel_1_idx, channel_2_idx, input_cnt);
         if (ret_dec != SUCCESS) {
             free_resources(channel1);
             return ret_dec;
         }
     } else {
-        const char *file2 = argv[2];
+        const char *file2 = options.files[1];
         int ret2 = open_and_find_stream_info(file2, &channel2.format_context);
         if (ret2 != SUCCESS) return ret2;
 
@@ -88,47 +241,35 @@ int main(int argc, char *argv[]) {
 	    return ret_process2;
 	}
 
-        int ret_dec = decode_into_samples(&channel1, &channel2, audio_stream_idx_1, audio_stream_idx_2, channel_1_idx, channel_2_idx, argc);
-        if (ret_dec != SUCCESS) return ret_dec;
-    }
-
-    int sample_rate_total = sample_rate(channel1.format_context, audio_stream_idx_1);
-
-    if (argc == 3) {
-        float *resampled = NULL;
         int sample_rate_ch1 = sample_rate(channel1.format_context, audio_stream_idx_1);
         int sample_rate_ch2 = sample_rate(channel2.format_context, audio_stream_idx_2);
         if (sample_rate_ch1 != sample_rate_ch2) {
             bool cond = sample_rate_ch1 > sample_rate_ch2;
-            int ret = resample(cond ? channel2.samples : channel1.samples,
-                               cond ? sample_rate_ch2 : sample_rate_ch1,
-                               cond ? sample_rate_ch1 : sample_rate_ch2,
-                               &resampled, cond ? channel2.samples_cnt : channel1.samples_cnt);
+            int ret = set_target_rate(cond ? &channel2 : &channel1,
+                                      cond ? sample_rate_ch2 : sample_rate_ch1,
+                                      cond ? sample_rate_ch1 : sample_rate_ch2,
+                                      options.resampler);
             if (ret != SUCCESS) {
+                free_resources(channel1);
+                free_resources(channel2);
                 return ret;
             }
-            if (cond) {
-                free_samples_mem(&channel2.samples);
-                channel2.samples = resampled;
-            } else {
-                free_samples_mem(&channel1.samples);
-                channel1.samples = resampled;
-                sample_rate_total = sample_rate_ch2;
-            }
         }
+
+        int ret_dec = decode_into_samples(&channel1, &channel2, audio_stream_idx_1, audio_stream_idx_2, channel_1_idx, channel_2_idx, input_cnt);
+        if (ret_dec != SUCCESS) return ret_dec;
     }
 
-    int ret_corr = SUCCESS;
-    if (channel1.samples_cnt > 0 && channel2.samples_cnt > 0) {
-        int N = channel1.samples_cnt + channel2.samples_cnt - 1;
-        ret_corr = cross_correlation(channel1.samples, channel2.samples, channel1.samples_cnt, channel2.samples_cnt, &correlation);
-        if (ret_corr != SUCCESS) goto cleanup;
-        int time_delay_samples = -channel2.samples_cnt + 1 + find_max_index(correlation, N);
-	free(correlation);
-        double time_delay_ms = (double)time_delay_samples * 1000.0 / sample_rate_total;
-        printf("delta: %i samples\nsample rate: %i Hz\ndelta time: %i ms\n", time_delay_samples, sample_rate_total, (int)floor(time_delay_ms));
+    int sample_rate_total = sample_rate(channel1.format_context, audio_stream_idx_1);
+    if (input_cnt == 3) {
+        int sample_rate_ch2 = sample_rate(channel2.format_context, audio_stream_idx_2);
+        sample_rate_total = sample_rate_ch2 > sample_rate_total ? sample_rate_ch2 : sample_rate_total;
     }
-    cleanup:
+
+    SampleSource source1 = array_source(channel1.samples, channel1.samples_cnt);
+    SampleSource source2 = array_source(channel2.samples, channel2.samples_cnt);
+    int ret_corr = report_delay(&options, &source1, &source2, sample_rate_total);
+
     free_resources(channel1);
     free_resources(channel2);
     return ret_corr;
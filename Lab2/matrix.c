@@ -0,0 +1,165 @@
+#include "matrix.h"
+#include "audio_util.h"
+#include "correlation.h"
+#include "pcm_map.h"
+#include "return_codes.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	int channel_cnt;
+	int rate;
+	int *delays;
+	float *peaks;
+	double *confidence;
+} DelayMatrix;
+
+static void write_rows(FILE *out, const DelayMatrix *matrix, int kind) {
+	int n = matrix->channel_cnt;
+	for (int i = 0; i < n; i++) {
+		fprintf(out, "    [");
+		for (int j = 0; j < n; j++) {
+			int k = i * n + j;
+			if (kind == 0) {
+				fprintf(out, "%d", matrix->delays[k]);
+			} else if (kind == 1) {
+				fprintf(out, "%.3f", (double)matrix->delays[k] * 1000.0 / matrix->rate);
+			} else {
+				fprintf(out, "%.6f", matrix->confidence[k]);
+			}
+			fprintf(out, j + 1 < n ? ", " : "");
+		}
+		fprintf(out, i + 1 < n ? "],\n" : "]\n");
+	}
+}
+
+// CSV is the bare delay matrix in samples; JSON adds the same matrix in milliseconds and the peak confidences.
+// Row i, column j holds the delay of channel j relative to channel i.
+static void write_matrix(FILE *out, int format, const DelayMatrix *matrix) {
+	int n = matrix->channel_cnt;
+	if (format == OUTPUT_JSON) {
+		fprintf(out, "{\n  \"sample_rate\": %d,\n  \"channels\": %d,\n  \"delay_samples\": [\n", matrix->rate, n);
+		write_rows(out, matrix, 0);
+		fprintf(out, "  ],\n  \"delay_ms\": [\n");
+		write_rows(out, matrix, 1);
+		fprintf(out, "  ],\n  \"confidence\": [\n");
+		write_rows(out, matrix, 2);
+		fprintf(out, "  ]\n}\n");
+		return;
+	}
+	fprintf(out, "channel");
+	for (int j = 0; j < n; j++) {
+		fprintf(out, ",%d", j);
+	}
+	fputc('\n', out);
+	for (int i = 0; i < n; i++) {
+		fprintf(out, "%d", i);
+		for (int j = 0; j < n; j++) {
+			fprintf(out, ",%d", matrix->delays[i * n + j]);
+		}
+		fputc('\n', out);
+	}
+}
+
+static int compute_matrix(const Options *options, const SampleSource *sources, DelayMatrix *matrix) {
+	int n = matrix->channel_cnt;
+	matrix->delays = malloc(sizeof(int) * n * n);
+	matrix->peaks = malloc(sizeof(float) * n * n);
+	matrix->confidence = malloc(sizeof(double) * n * n);
+	double *energies = malloc(sizeof(double) * n);
+	if (!matrix->delays || !matrix->peaks || !matrix->confidence || !energies) {
+		free(energies);
+		fprintf(stderr, "Failed to allocate memory for the delay matrix\n");
+		return ERROR_NOTENOUGH_MEMORY;
+	}
+	int ret;
+	if (options->max_lag >= 0 || options->block_size > 0) {
+		int len = sources[0].len;
+		int max_lag = options->max_lag >= 0 ? (int)fmin(options->max_lag * matrix->rate, len - 1) : len - 1;
+		ret = cross_correlation_matrix_blocked(sources, n, max_lag, options->block_size, options->weighting,
+											   matrix->delays, matrix->peaks);
+	} else {
+		ret = cross_correlation_matrix(sources, n, options->weighting, matrix->delays, matrix->peaks);
+	}
+	if (ret == SUCCESS) {
+#pragma omp parallel for schedule(dynamic)
+		for (int i = 0; i < n; i++) {
+			energies[i] = source_energy(&sources[i]);
+		}
+		for (int i = 0; i < n; i++) {
+			matrix->confidence[i * n + i] = 1.0;
+			for (int j = i + 1; j < n; j++) {
+				double confidence = correlation_confidence(matrix->peaks[i * n + j], energies[i], energies[j], options->weighting);
+				matrix->confidence[i * n + j] = matrix->confidence[j * n + i] = confidence;
+			}
+		}
+	}
+	free(energies);
+	return ret;
+}
+
+// Pairwise delays between all channels of one multichannel file. WAV and raw PCM inputs are read through the
+// mapping, anything else is decoded by FFmpeg; only the first audio stream of the file is used.
+int run_matrix(const Options *options) {
+	PcmMap map;
+	AudioInfo decoded;
+	float **channels = NULL;
+	SampleSource *sources = NULL;
+	DelayMatrix matrix;
+	memset(&matrix, 0, sizeof(DelayMatrix));
+	init_audio_info(&decoded);
+
+	int32_t samples_cnt = 0;
+	int ret = pcm_map_open(options->files[0], options->raw_rate, options->raw_channels, options->pcm_format, &map);
+	bool mapped = ret == SUCCESS;
+	if (mapped) {
+		matrix.channel_cnt = map.channels;
+		matrix.rate = map.sample_rate;
+	} else if (ret == ERROR_UNSUPPORTED) {
+		ret = load_audio_channels(options->files[0], &decoded, &channels, &matrix.channel_cnt, &samples_cnt, &matrix.rate);
+	}
+	if (ret == SUCCESS && matrix.channel_cnt < 2) {
+		fprintf(stderr, "Delay matrix needs at least two channels in file '%s'\n", options->files[0]);
+		ret = ERROR_FORMAT_INVALID;
+	}
+	if (ret == SUCCESS) {
+		sources = malloc(sizeof(SampleSource) * matrix.channel_cnt);
+		if (!sources) {
+			fprintf(stderr, "Failed to allocate memory for channels\n");
+			ret = ERROR_NOTENOUGH_MEMORY;
+		}
+	}
+	if (ret == SUCCESS) {
+		for (int i = 0; i < matrix.channel_cnt; i++) {
+			sources[i] = mapped ? pcm_map_source(&map, i) : array_source(channels[i], samples_cnt);
+		}
+		if (sources[0].len == 0) {
+			fprintf(stderr, "No samples in file '%s'\n", options->files[0]);
+			ret = ERROR_DATA_INVALID;
+		}
+	}
+	if (ret == SUCCESS) ret = compute_matrix(options, sources, &matrix);
+	if (ret == SUCCESS) {
+		bool to_stdout = strcmp(options->matrix, "-") == 0;
+		FILE *out = to_stdout ? stdout : fopen(options->matrix, "w");
+		if (!out) {
+			fprintf(stderr, "Cannot open output file '%s'\n", options->matrix);
+			ret = ERROR_CANNOT_OPEN_FILE;
+		} else {
+			write_matrix(out, options->output_format, &matrix);
+			if (!to_stdout) fclose(out);
+		}
+	}
+
+	if (mapped) pcm_map_close(&map);
+	free_channels(channels, matrix.channel_cnt);
+	free_resources(decoded);
+	free(sources);
+	free(matrix.delays);
+	free(matrix.peaks);
+	free(matrix.confidence);
+	return ret;
+}
@@ -0,0 +1,188 @@
+#include "options.h"
+#include "correlation.h"
+#include "resampler.h"
+#include "return_codes.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int parse_double(const char *name, const char *value, double *result) {
+	char *end = NULL;
+	*result = strtod(value, &end);
+	if (end == value || *end != '\0' || *result < 0) {
+		fprintf(stderr, "Invalid value for %s: '%s'\n", name, value);
+		return ERROR_ARGUMENTS_INVALID;
+	}
+	return SUCCESS;
+}
+
+static int parse_int(const char *name, const char *value, int *result) {
+	char *end = NULL;
+	long parsed = strtol(value, &end, 10);
+	if (end == value || *end != '\0' || parsed <= 0 || parsed > (1 << 30)) {
+		fprintf(stderr, "Invalid value for %s: '%s'\n", name, value);
+		return ERROR_ARGUMENTS_INVALID;
+	}
+	*result = (int)parsed;
+	return SUCCESS;
+}
+
+// start:len in seconds, len > 0.
+static int parse_window(const char *value, Options *options) {
+	char *end = NULL;
+	options->window_start = strtod(value, &end);
+	if (end != value && *end == ':') {
+		const char *len = end + 1;
+		options->window_len = strtod(len, &end);
+		if (end != len && *end == '\0' && options->window_start >= 0 && options->window_len > 0) return SUCCESS;
+	}
+	fprintf(stderr, "Invalid value for --window: '%s', expected start:len in seconds\n", value);
+	return ERROR_ARGUMENTS_INVALID;
+}
+
+int parse_options(int argc, char *argv[], Options *options) {
+	memset(options, 0, sizeof(Options));
+	options->max_lag = -1;
+	options->stream_window = 1.0;
+	options->hop = 0.25;
+	options->raw_channels = 1;
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		if (strncmp(arg, "--", 2) != 0) {
+			if (options->file_count == MAX_INPUT_FILES) {
+				fprintf(stderr, "Too many arguments given. Must be 1 or 2");
+				return ERROR_ARGUMENTS_INVALID;
+			}
+			options->files[options->file_count++] = arg;
+			continue;
+		}
+		if (i + 1 == argc) {
+			fprintf(stderr, "Missing value for option %s\n", arg);
+			return ERROR_ARGUMENTS_INVALID;
+		}
+		const char *value = argv[++i];
+		int ret = SUCCESS;
+		if (strcmp(arg, "--max-lag") == 0) {
+			ret = parse_double(arg, value, &options->max_lag);
+		} else if (strcmp(arg, "--window") == 0) {
+			ret = parse_window(value, options);
+		} else if (strcmp(arg, "--block") == 0) {
+			ret = parse_int(arg, value, &options->block_size);
+		} else if (strcmp(arg, "--coarse") == 0) {
+			ret = parse_int(arg, value, &options->coarse_factor);
+			if (ret == SUCCESS && options->coarse_factor < 2) {
+				fprintf(stderr, "Decimation factor for --coarse must be at least 2\n");
+				ret = ERROR_ARGUMENTS_INVALID;
+			}
+		} else if (strcmp(arg, "--batch") == 0) {
+			options->batch = value;
+		} else if (strcmp(arg, "--matrix") == 0) {
+			options->matrix = value;
+		} else if (strcmp(arg, "--output") == 0) {
+			options->output = value;
+		} else if (strcmp(arg, "--format") == 0) {
+			if (strcmp(value, "csv") == 0) {
+				options->output_format = OUTPUT_CSV;
+			} else if (strcmp(value, "json") == 0) {
+				options->output_format = OUTPUT_JSON;
+			} else {
+				fprintf(stderr, "Unsupported output format: %s\n", value);
+				ret = ERROR_ARGUMENTS_INVALID;
+			}
+		} else if (strcmp(arg, "--stream") == 0) {
+			ret = parse_int(arg, value, &options->stream_rate);
+		} else if (strcmp(arg, "--stream-window") == 0) {
+			ret = parse_double(arg, value, &options->stream_window);
+		} else if (strcmp(arg, "--hop") == 0) {
+			ret = parse_double(arg, value, &options->hop);
+		} else if (strcmp(arg, "--pcm") == 0) {
+			if (strcmp(value, "s16") == 0) {
+				options->pcm_format = PCM_S16;
+			} else if (strcmp(value, "f32") == 0) {
+				options->pcm_format = PCM_F32;
+			} else if (strcmp(value, "s24") == 0) {
+				options->pcm_format = PCM_S24;
+			} else {
+				fprintf(stderr, "Unsupported PCM sample format: %s\n", value);
+				ret = ERROR_ARGUMENTS_INVALID;
+			}
+		} else if (strcmp(arg, "--raw-rate") == 0) {
+			ret = parse_int(arg, value, &options->raw_rate);
+		} else if (strcmp(arg, "--raw-channels") == 0) {
+			ret = parse_int(arg, value, &options->raw_channels);
+		} else if (strcmp(arg, "--profile") == 0) {
+			options->profile = value;
+		} else if (strcmp(arg, "--threads") == 0) {
+			ret = parse_int(arg, value, &options->threads);
+		} else if (strcmp(arg, "--weighting") == 0) {
+			if (strcmp(value, "none") == 0) {
+				options->weighting = WEIGHTING_NONE;
+			} else if (strcmp(value, "phat") == 0) {
+				options->weighting = WEIGHTING_PHAT;
+			} else if (strcmp(value, "scot") == 0) {
+				options->weighting = WEIGHTING_SCOT;
+			} else if (strcmp(value, "roth") == 0) {
+				options->weighting = WEIGHTING_ROTH;
+			} else {
+				fprintf(stderr, "Unsupported weighting: %s\n", value);
+				ret = ERROR_ARGUMENTS_INVALID;
+			}
+		} else if (strcmp(arg, "--normalize") == 0) {
+			if (strcmp(value, "on") == 0 || strcmp(value, "off") == 0) {
+				options->normalize = strcmp(value, "on") == 0;
+			} else {
+				fprintf(stderr, "Value for --normalize must be on or off\n");
+				ret = ERROR_ARGUMENTS_INVALID;
+			}
+		} else if (strcmp(arg, "--lean") == 0) {
+			if (strcmp(value, "on") == 0 || strcmp(value, "off") == 0) {
+				options->lean = strcmp(value, "on") == 0;
+			} else {
+				fprintf(stderr, "Value for --lean must be on or off\n");
+				ret = ERROR_ARGUMENTS_INVALID;
+			}
+		} else if (strcmp(arg, "--resampler") == 0) {
+			if (strcmp(value, "polyphase") == 0) {
+				options->resampler = RESAMPLER_POLYPHASE;
+			} else if (strcmp(value, "swr") == 0) {
+				options->resampler = RESAMPLER_SWR;
+			} else {
+				fprintf(stderr, "Unsupported resampler: %s\n", value);
+				ret = ERROR_ARGUMENTS_INVALID;
+			}
+		} else {
+			fprintf(stderr, "Unknown option: %s\n", arg);
+			ret = ERROR_ARGUMENTS_INVALID;
+		}
+		if (ret != SUCCESS) return ret;
+	}
+	if (options->file_count == 0) {
+		fprintf(stderr, "No files provided");
+		return ERROR_ARGUMENTS_INVALID;
+	}
+	if (options->stream_rate && options->file_count != 2) {
+		fprintf(stderr, "Streaming mode takes exactly two PCM inputs\n");
+		return ERROR_ARGUMENTS_INVALID;
+	}
+	if (options->stream_rate && options->pcm_format == PCM_S24) {
+		fprintf(stderr, "Streaming mode takes s16 or f32 samples\n");
+		return ERROR_ARGUMENTS_INVALID;
+	}
+	if (options->batch && options->file_count != 1) {
+		fprintf(stderr, "Batch mode takes exactly one reference file\n");
+		return ERROR_ARGUMENTS_INVALID;
+	}
+	if (options->matrix && (options->file_count != 1 || options->batch || options->stream_rate)) {
+		fprintf(stderr, "Matrix mode takes exactly one multichannel file\n");
+		return ERROR_ARGUMENTS_INVALID;
+	}
+	if (options->coarse_factor > 0 && (options->block_size > 0 || options->lean)) {
+		fprintf(stderr, "--coarse picks its own refinement blocks and cannot be combined with --block or --lean\n");
+		return ERROR_ARGUMENTS_INVALID;
+	}
+	if (options->window_len > 0 && (options->batch || options->stream_rate || options->matrix)) {
+		fprintf(stderr, "--window applies to the two-signal mode only\n");
+		return ERROR_ARGUMENTS_INVALID;
+	}
+	return SUCCESS;
+}
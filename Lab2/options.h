@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+
+#define MAX_INPUT_FILES 2
+
+#define OUTPUT_CSV 0
+#define OUTPUT_JSON 1
+
+#define PCM_S16 0
+#define PCM_F32 1
+#define PCM_S24 2
+
+typedef struct {
+	const char *files[MAX_INPUT_FILES];
+	int file_count;
+	double max_lag;
+	double window_start;
+	double window_len;
+	int block_size;
+	int coarse_factor;
+	const char *batch;
+	const char *matrix;
+	const char *output;
+	int output_format;
+	int stream_rate;
+	double stream_window;
+	double hop;
+	int pcm_format;
+	int raw_rate;
+	int raw_channels;
+	int resampler;
+	int weighting;
+	bool normalize;
+	bool lean;
+	int threads;
+	const char *profile;
+} Options;
+
+int parse_options(int argc, char *argv[], Options *options);
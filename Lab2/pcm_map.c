@@ -0,0 +1,232 @@
+#include "pcm_map.h"
+#include "kernels.h"
+#include "options.h"
+#include "return_codes.h"
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_IEEE_FLOAT 3
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+static uint32_t read_u32(const unsigned char *bytes) {
+	return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static uint16_t read_u16(const unsigned char *bytes) {
+	return (uint16_t)(bytes[0] | bytes[1] << 8);
+}
+
+static int sample_size(int pcm_format) {
+	return pcm_format == PCM_S16 ? 2 : pcm_format == PCM_S24 ? 3 : 4;
+}
+
+static bool has_raw_extension(const char *path) {
+	const char *dot = strrchr(path, '.');
+	return dot && (strcmp(dot, ".raw") == 0 || strcmp(dot, ".pcm") == 0);
+}
+
+static bool has_wav_header(const char *path) {
+	unsigned char header[12];
+	FILE *file = fopen(path, "rb");
+	if (!file) return false;
+	bool is_wav = fread(header, 1, sizeof(header), file) == sizeof(header)
+			&& memcmp(header, "RIFF", 4) == 0 && memcmp(header + 8, "WAVE", 4) == 0;
+	fclose(file);
+	return is_wav;
+}
+
+static int map_file(const char *path, PcmMap *map) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		fprintf(stderr, "Cannot open file: %s\n", path);
+		return ERROR_CANNOT_OPEN_FILE;
+	}
+	LARGE_INTEGER size;
+	HANDLE mapping = NULL;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	}
+	if (mapping) {
+		map->mapping = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+	if (!map->mapping) {
+		fprintf(stderr, "Cannot map file: %s\n", path);
+		return ERROR_CANNOT_OPEN_FILE;
+	}
+	map->mapping_len = (size_t)size.QuadPart;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot open file: %s\n", path);
+		return ERROR_CANNOT_OPEN_FILE;
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0) {
+		close(fd);
+		fprintf(stderr, "Cannot map empty file: %s\n", path);
+		return ERROR_DATA_INVALID;
+	}
+	void *mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		fprintf(stderr, "Cannot map file: %s\n", path);
+		return ERROR_CANNOT_OPEN_FILE;
+	}
+	// Correlations read every sample once from start to end, so let the kernel read ahead aggressively.
+	madvise(mapping, (size_t)info.st_size, MADV_SEQUENTIAL);
+	map->mapping = mapping;
+	map->mapping_len = (size_t)info.st_size;
+#endif
+	return SUCCESS;
+}
+
+static void unmap_file(PcmMap *map) {
+	if (!map->mapping) return;
+#ifdef _WIN32
+	UnmapViewOfFile(map->mapping);
+#else
+	munmap(map->mapping, map->mapping_len);
+#endif
+	map->mapping = NULL;
+}
+
+// Walks the RIFF chunks for fmt and data; anything but 16/24-bit integer or 32-bit float PCM is left to FFmpeg.
+static int parse_wav(PcmMap *map) {
+	const unsigned char *bytes = map->mapping;
+	size_t len = map->mapping_len;
+	size_t pos = 12;
+	bool has_format = false;
+	while (pos + 8 <= len) {
+		uint32_t chunk_size = read_u32(bytes + pos + 4);
+		const unsigned char *chunk = bytes + pos + 8;
+		size_t available = len - pos - 8;
+		if (memcmp(bytes + pos, "fmt ", 4) == 0) {
+			if (chunk_size < 16 || available < 16) return ERROR_FORMAT_INVALID;
+			int tag = read_u16(chunk);
+			if (tag == WAVE_FORMAT_EXTENSIBLE && chunk_size >= 26 && available >= 26) {
+				tag = read_u16(chunk + 24);
+			}
+			map->channels = read_u16(chunk + 2);
+			map->sample_rate = (int)read_u32(chunk + 4);
+			// the data chunk divides by the channel count, so reject an empty layout before it gets there
+			if (map->channels <= 0 || map->sample_rate <= 0) return ERROR_FORMAT_INVALID;
+			int bits = read_u16(chunk + 14);
+			if (tag == WAVE_FORMAT_PCM && bits == 16) {
+				map->pcm_format = PCM_S16;
+			} else if (tag == WAVE_FORMAT_PCM && bits == 24) {
+				map->pcm_format = PCM_S24;
+			} else if (tag == WAVE_FORMAT_IEEE_FLOAT && bits == 32) {
+				map->pcm_format = PCM_F32;
+			} else {
+				return ERROR_UNSUPPORTED;
+			}
+			has_format = true;
+		} else if (memcmp(bytes + pos, "data", 4) == 0) {
+			if (!has_format) return ERROR_FORMAT_INVALID;
+			// Writers that stream WAV leave the size as 0 or 0xFFFFFFFF; the data then runs to the end of the file.
+			size_t data_len = chunk_size == 0 || chunk_size > available ? available : chunk_size;
+			map->data = chunk;
+			map->frames = (int64_t)(data_len / ((size_t)sample_size(map->pcm_format) * map->channels));
+			return SUCCESS;
+		}
+		pos += 8 + (size_t)chunk_size + (chunk_size & 1);
+	}
+	return ERROR_FORMAT_INVALID;
+}
+
+int pcm_map_open(const char *path, int raw_rate, int raw_channels, int raw_format, PcmMap *map) {
+	memset(map, 0, sizeof(PcmMap));
+	bool is_raw = has_raw_extension(path);
+	if (!is_raw && !has_wav_header(path)) return ERROR_UNSUPPORTED;
+	if (is_raw && raw_rate <= 0) {
+		fprintf(stderr, "Raw PCM input '%s' needs --raw-rate\n", path);
+		return ERROR_ARGUMENTS_INVALID;
+	}
+
+	int ret = map_file(path, map);
+	if (ret != SUCCESS) return ret;
+	if (is_raw) {
+		map->data = map->mapping;
+		map->channels = raw_channels;
+		map->sample_rate = raw_rate;
+		map->pcm_format = raw_format;
+		map->frames = (int64_t)(map->mapping_len / ((size_t)sample_size(raw_format) * raw_channels));
+	} else {
+		ret = parse_wav(map);
+		if (ret == ERROR_FORMAT_INVALID) {
+			fprintf(stderr, "Invalid WAV file: %s\n", path);
+		}
+	}
+	if (ret == SUCCESS && (map->channels <= 0 || map->sample_rate <= 0 || map->frames > INT_MAX)) {
+		fprintf(stderr, "Unsupported PCM layout in '%s'\n", path);
+		ret = ERROR_UNSUPPORTED;
+	}
+	if (ret == SUCCESS) {
+		map->channel_views = malloc(sizeof(PcmChannel) * map->channels);
+		if (!map->channel_views) {
+			fprintf(stderr, "Not enough memory");
+			ret = ERROR_NOTENOUGH_MEMORY;
+		}
+	}
+	if (ret != SUCCESS) {
+		unmap_file(map);
+		return ret;
+	}
+	for (int channel = 0; channel < map->channels; channel++) {
+		map->channel_views[channel].map = map;
+		map->channel_views[channel].channel = channel;
+	}
+	return SUCCESS;
+}
+
+void pcm_map_close(PcmMap *map) {
+	unmap_file(map);
+	free(map->channel_views);
+	map->channel_views = NULL;
+}
+
+void pcm_map_window(PcmMap *map, int64_t first_frame, int64_t frame_cnt) {
+	if (first_frame > map->frames) first_frame = map->frames;
+	if (frame_cnt > map->frames - first_frame) frame_cnt = map->frames - first_frame;
+	map->data += (size_t)first_frame * map->channels * sample_size(map->pcm_format);
+	map->frames = frame_cnt;
+}
+
+static void read_channel(const void *context, int64_t start, int count, float *dst) {
+	const PcmChannel *view = context;
+	const PcmMap *map = view->map;
+	const unsigned char *src = map->data + (size_t)(start * map->channels + view->channel) * sample_size(map->pcm_format);
+	if (map->pcm_format == PCM_S16) {
+		kernel_s16_strided_to_float((const int16_t *)src, map->channels, dst, count);
+	} else if (map->pcm_format == PCM_S24) {
+		kernel_s24_strided_to_float(src, map->channels, dst, count);
+	} else {
+		for (int i = 0; i < count; i++) {
+			memcpy(dst + i, src + (size_t)i * map->channels * sizeof(float), sizeof(float));
+		}
+	}
+}
+
+SampleSource pcm_map_source(const PcmMap *map, int channel) {
+	SampleSource source = {NULL, read_channel, &map->channel_views[channel], (int)map->frames};
+	// Mono float data is already what the correlation reads: use the mapping itself, no conversion at all.
+	if (map->pcm_format == PCM_F32 && map->channels == 1 && ((uintptr_t)map->data & (sizeof(float) - 1)) == 0) {
+		source.samples = (const float *)map->data;
+	}
+	return source;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "correlation.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Uncompressed input mapped into memory instead of going through FFmpeg: a PCM or IEEE float WAV file, or headerless
+// raw PCM (.raw/.pcm) described by --raw-rate, --raw-channels and --pcm. Samples stay in the mapping and are
+// converted to float only when a correlation reads them.
+typedef struct PcmMap PcmMap;
+
+typedef struct {
+	const PcmMap *map;
+	int channel;
+} PcmChannel;
+
+struct PcmMap {
+	void *mapping;
+	size_t mapping_len;
+	const unsigned char *data;
+	int64_t frames;
+	int channels;
+	int sample_rate;
+	int pcm_format;
+	PcmChannel *channel_views;
+};
+
+int pcm_map_open(const char *path, int raw_rate, int raw_channels, int raw_format, PcmMap *map);
+
+void pcm_map_close(PcmMap *map);
+
+// Restricts the map to frame_cnt frames starting at first_frame; pages outside them are never touched.
+void pcm_map_window(PcmMap *map, int64_t first_frame, int64_t frame_cnt);
+
+// Source reading one channel of the mapped file; it points into map, so map must outlive it and stay in place.
+SampleSource pcm_map_source(const PcmMap *map, int channel);
@@ -0,0 +1,137 @@
+#include "profile.h"
+#include "return_codes.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#define MAX_STAGES 32
+
+typedef struct {
+	const char *name;
+	long long calls;
+	double wall;
+	double cpu;
+} Stage;
+
+// Stage totals for --profile. Stages may nest (resampling runs inside decoding), so they do not add up to the
+// total; cpu is process time and includes every thread working during the stage.
+static struct {
+	bool enabled;
+	const char *path;
+	ProfileMark started;
+	Stage stages[MAX_STAGES];
+	int stage_cnt;
+	size_t bytes_allocated;
+} profile;
+
+static double wall_seconds(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static double cpu_seconds(void) {
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+	ULARGE_INTEGER k = { .LowPart = kernel.dwLowDateTime, .HighPart = kernel.dwHighDateTime };
+	ULARGE_INTEGER u = { .LowPart = user.dwLowDateTime, .HighPart = user.dwHighDateTime };
+	return (double)(k.QuadPart + u.QuadPart) / 1e7;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+#endif
+}
+
+static long long peak_rss_bytes(void) {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+	return (long long)counters.PeakWorkingSetSize;
+#elif defined(__APPLE__)
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (long long)usage.ru_maxrss;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (long long)usage.ru_maxrss * 1024;
+#endif
+}
+
+static void profile_write(void) {
+	FILE *out = strcmp(profile.path, "-") == 0 ? stderr : fopen(profile.path, "w");
+	if (!out) {
+		fprintf(stderr, "Cannot open profile output '%s'\n", profile.path);
+		return;
+	}
+	fprintf(out, "{\n  \"wall_s\": %.6f,\n  \"cpu_s\": %.6f,\n", wall_seconds() - profile.started.wall, cpu_seconds() - profile.started.cpu);
+	fprintf(out, "  \"peak_rss_bytes\": %lld,\n  \"bytes_allocated\": %zu,\n  \"stages\": [", peak_rss_bytes(), profile.bytes_allocated);
+	for (int i = 0; i < profile.stage_cnt; i++) {
+		const Stage *stage = &profile.stages[i];
+		fprintf(out, "%s\n    {\"name\": \"%s\", \"calls\": %lld, \"wall_s\": %.6f, \"cpu_s\": %.6f}",
+				i ? "," : "", stage->name, stage->calls, stage->wall, stage->cpu);
+	}
+	fprintf(out, "\n  ]\n}\n");
+	if (out != stderr) fclose(out);
+}
+
+// The report is written at exit, so every return path of main is covered.
+int profile_enable(const char *path) {
+	profile.enabled = true;
+	profile.path = path;
+	profile.started = profile_begin();
+	if (atexit(profile_write) != 0) {
+		fprintf(stderr, "Could not register profile report\n");
+		return ERROR_UNKNOWN;
+	}
+	return SUCCESS;
+}
+
+bool profile_enabled(void) {
+	return profile.enabled;
+}
+
+ProfileMark profile_begin(void) {
+	ProfileMark mark = { 0.0, 0.0 };
+	if (profile.enabled) {
+		mark.wall = wall_seconds();
+		mark.cpu = cpu_seconds();
+	}
+	return mark;
+}
+
+void profile_end(const char *stage, ProfileMark mark) {
+	if (!profile.enabled) return;
+	double wall = wall_seconds() - mark.wall;
+	double cpu = cpu_seconds() - mark.cpu;
+#pragma omp critical(profile)
+	{
+		int i = 0;
+		while (i < profile.stage_cnt && strcmp(profile.stages[i].name, stage) != 0) {
+			i++;
+		}
+		if (i < MAX_STAGES) {
+			if (i == profile.stage_cnt) {
+				profile.stages[profile.stage_cnt++].name = stage;
+			}
+			profile.stages[i].calls++;
+			profile.stages[i].wall += wall;
+			profile.stages[i].cpu += cpu;
+		}
+	}
+}
+
+void profile_alloc(size_t bytes) {
+	if (!profile.enabled) return;
+#pragma omp atomic
+	profile.bytes_allocated += bytes;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+	double wall;
+	double cpu;
+} ProfileMark;
+
+int profile_enable(const char *path);
+
+bool profile_enabled(void);
+
+ProfileMark profile_begin(void);
+
+void profile_end(const char *stage, ProfileMark mark);
+
+void profile_alloc(size_t bytes);
@@ -0,0 +1,209 @@
+#include "resampler.h"
+#include "profile.h"
+#include "return_codes.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TAPS_PER_PHASE 64
+#define MAX_PHASES 4096
+#define KAISER_BETA 8.6
+#define PASSBAND 0.9
+
+static int gcd(int a, int b) {
+	while (b) {
+		int tmp = a % b;
+		a = b;
+		b = tmp;
+	}
+	return a;
+}
+
+static double bessel_i0(double x) {
+	double sum = 1.0;
+	double term = 1.0;
+	for (int k = 1; k < 64 && term > sum * 1e-12; k++) {
+		double half = x / (2.0 * k);
+		term *= half * half;
+		sum += term;
+	}
+	return sum;
+}
+
+// Kaiser-windowed sinc prototype at the upsampled rate, split into up phases of TAPS_PER_PHASE coefficients.
+// Each phase is stored reversed so an output is a plain dot product with consecutive input samples.
+static int build_coeffs(Resampler *resampler) {
+	int up = resampler->up;
+	int taps = resampler->taps;
+	int len = up * taps;
+	double cutoff = PASSBAND * 0.5 / (up > resampler->down ? up : resampler->down);
+	double centre = len / 2;
+	double norm = bessel_i0(KAISER_BETA);
+	resampler->coeffs = malloc(sizeof(float) * len);
+	if (!resampler->coeffs) {
+		fprintf(stderr, "Failed to allocate memory for resampler coefficients\n");
+		return ERROR_NOTENOUGH_MEMORY;
+	}
+	for (int k = 0; k < len; k++) {
+		double x = k - centre;
+		double sinc = x == 0.0 ? 1.0 : sin(2.0 * M_PI * cutoff * x) / (2.0 * M_PI * cutoff * x);
+		double ratio = x / centre;
+		double window = bessel_i0(KAISER_BETA * sqrt(fmax(0.0, 1.0 - ratio * ratio))) / norm;
+		int phase = k % up;
+		int tap = k / up;
+		resampler->coeffs[phase * taps + (taps - 1 - tap)] = (float)(up * 2.0 * cutoff * sinc * window);
+	}
+	resampler->delay = (int64_t)centre;
+	return SUCCESS;
+}
+
+static int init_swr(Resampler *resampler, int in_rate, int out_rate) {
+	AVChannelLayout mono = AV_CHANNEL_LAYOUT_MONO;
+	if (swr_alloc_set_opts2(&resampler->swr, &mono, AV_SAMPLE_FMT_FLT, out_rate, &mono, AV_SAMPLE_FMT_FLT, in_rate, 0, NULL) < 0
+		|| swr_init(resampler->swr) < 0) {
+		swr_free(&resampler->swr);
+		fprintf(stderr, "Could not initialize swresample context\n");
+		return ERROR_UNKNOWN;
+	}
+	return SUCCESS;
+}
+
+int resampler_init(Resampler *resampler, int in_rate, int out_rate, int backend) {
+	memset(resampler, 0, sizeof(Resampler));
+	if (in_rate <= 0 || out_rate <= 0) {
+		fprintf(stderr, "Invalid sample rates for resampling: %d -> %d\n", in_rate, out_rate);
+		return ERROR_DATA_INVALID;
+	}
+	int divisor = gcd(in_rate, out_rate);
+	resampler->backend = backend;
+	resampler->up = out_rate / divisor;
+	resampler->down = in_rate / divisor;
+	if (backend == RESAMPLER_SWR) {
+		return init_swr(resampler, in_rate, out_rate);
+	}
+	if (resampler->up > MAX_PHASES) {
+		fprintf(stderr, "Resampling ratio %d/%d needs too many filter phases, use --resampler swr\n", resampler->up, resampler->down);
+		return ERROR_UNSUPPORTED;
+	}
+	resampler->taps = TAPS_PER_PHASE;
+	int ret = build_coeffs(resampler);
+	if (ret != SUCCESS) return ret;
+	resampler->capacity = 4 * resampler->taps;
+	resampler->buffer = calloc(resampler->capacity, sizeof(float));
+	if (!resampler->buffer) {
+		resampler_free(resampler);
+		fprintf(stderr, "Failed to allocate memory for resampler history\n");
+		return ERROR_NOTENOUGH_MEMORY;
+	}
+	resampler->buffered = resampler->taps - 1;
+	resampler->buffer_start = -(resampler->taps - 1);
+	return SUCCESS;
+}
+
+int resampler_max_output(const Resampler *resampler, int in_cnt) {
+	if (resampler->backend == RESAMPLER_SWR) {
+		return swr_get_out_samples(resampler->swr, in_cnt);
+	}
+	return (int)((int64_t)in_cnt * resampler->up / resampler->down + 2);
+}
+
+static int append_input(Resampler *resampler, const float *input, int in_cnt) {
+	if (resampler->buffered + in_cnt > resampler->capacity) {
+		int new_capacity = (resampler->buffered + in_cnt) * 2;
+		float *resized = realloc(resampler->buffer, sizeof(float) * new_capacity);
+		if (!resized) {
+			fprintf(stderr, "Failed to allocate memory for resampler history\n");
+			return ERROR_NOTENOUGH_MEMORY;
+		}
+		resampler->buffer = resized;
+		resampler->capacity = new_capacity;
+	}
+	if (input) {
+		memcpy(resampler->buffer + resampler->buffered, input, sizeof(float) * in_cnt);
+	} else {
+		memset(resampler->buffer + resampler->buffered, 0, sizeof(float) * in_cnt);
+	}
+	resampler->buffered += in_cnt;
+	return SUCCESS;
+}
+
+// Emits outputs while their newest input sample is buffered and fewer than limit outputs were produced in total,
+// then drops the history no later output can reach.
+static int run_filter(Resampler *resampler, int64_t limit, float *output) {
+	int taps = resampler->taps;
+	int64_t available = resampler->buffer_start + resampler->buffered;
+	int produced = 0;
+	while (resampler->produced < limit) {
+		int64_t time = resampler->produced * resampler->down + resampler->delay;
+		int64_t newest = time / resampler->up;
+		if (newest >= available) break;
+		const float *coeffs = resampler->coeffs + (time % resampler->up) * taps;
+		const float *samples = resampler->buffer + (newest - taps + 1 - resampler->buffer_start);
+		float acc = 0.0f;
+#pragma omp simd reduction(+ : acc)
+		for (int i = 0; i < taps; i++) {
+			acc += coeffs[i] * samples[i];
+		}
+		output[produced++] = acc;
+		resampler->produced++;
+	}
+	int64_t next_newest = (resampler->produced * resampler->down + resampler->delay) / resampler->up;
+	int64_t drop = next_newest - taps + 1 - resampler->buffer_start;
+	if (drop > resampler->buffered) drop = resampler->buffered;
+	if (drop > 0) {
+		memmove(resampler->buffer, resampler->buffer + drop, sizeof(float) * (resampler->buffered - drop));
+		resampler->buffered -= (int)drop;
+		resampler->buffer_start += drop;
+	}
+	return produced;
+}
+
+static int process_chunk(Resampler *resampler, const float *input, int in_cnt, float *output, int *out_cnt) {
+	if (resampler->backend == RESAMPLER_SWR) {
+		*out_cnt = swr_convert(resampler->swr, (uint8_t **)&output, resampler_max_output(resampler, in_cnt),
+							   (const uint8_t **)&input, in_cnt);
+		if (*out_cnt < 0) {
+			fprintf(stderr, "Error while resampling with swresample\n");
+			return ERROR_UNKNOWN;
+		}
+		return SUCCESS;
+	}
+	int ret = append_input(resampler, input, in_cnt);
+	if (ret != SUCCESS) return ret;
+	resampler->consumed += in_cnt;
+	*out_cnt = run_filter(resampler, INT64_MAX, output);
+	return SUCCESS;
+}
+
+int resampler_process(Resampler *resampler, const float *input, int in_cnt, float *output, int *out_cnt) {
+	ProfileMark mark = profile_begin();
+	int ret = process_chunk(resampler, input, in_cnt, output, out_cnt);
+	profile_end("resample", mark);
+	return ret;
+}
+
+// Produces the tail so the total output length is floor(consumed * out_rate / in_rate);
+// output must hold resampler_max_output(resampler, resampler->taps) samples.
+int resampler_flush(Resampler *resampler, float *output, int *out_cnt) {
+	if (resampler->backend == RESAMPLER_SWR) {
+		*out_cnt = swr_convert(resampler->swr, (uint8_t **)&output, resampler_max_output(resampler, resampler->taps), NULL, 0);
+		if (*out_cnt < 0) {
+			fprintf(stderr, "Error while flushing swresample\n");
+			return ERROR_UNKNOWN;
+		}
+		return SUCCESS;
+	}
+	int ret = append_input(resampler, NULL, resampler->taps + (int)(resampler->delay / resampler->up) + 1);
+	if (ret != SUCCESS) return ret;
+	*out_cnt = run_filter(resampler, resampler->consumed * resampler->up / resampler->down, output);
+	return SUCCESS;
+}
+
+void resampler_free(Resampler *resampler) {
+	free(resampler->coeffs);
+	free(resampler->buffer);
+	swr_free(&resampler->swr);
+	resampler->coeffs = NULL;
+	resampler->buffer = NULL;
+}
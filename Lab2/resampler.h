@@ -0,0 +1,35 @@
+#pragma once
+
+#include <libswresample/swresample.h>
+#include <stdint.h>
+
+#define RESAMPLER_POLYPHASE 0
+#define RESAMPLER_SWR 1
+
+// Streaming rational-ratio resampler: chunks of input go in, every output whose filter support is complete comes
+// out. The first output is aligned with the first input sample, so resampling does not shift the measured delay.
+typedef struct {
+	int backend;
+	int up;
+	int down;
+	int taps;
+	int64_t delay;
+	float *coeffs;
+	float *buffer;
+	int buffered;
+	int capacity;
+	int64_t buffer_start;
+	int64_t consumed;
+	int64_t produced;
+	SwrContext *swr;
+} Resampler;
+
+int resampler_init(Resampler *resampler, int in_rate, int out_rate, int backend);
+
+int resampler_max_output(const Resampler *resampler, int in_cnt);
+
+int resampler_process(Resampler *resampler, const float *input, int in_cnt, float *output, int *out_cnt);
+
+int resampler_flush(Resampler *resampler, float *output, int *out_cnt);
+
+void resampler_free(Resampler *resampler);
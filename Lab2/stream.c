@@ -0,0 +1,204 @@
+#include "stream.h"
+#include "correlation.h"
+#include "kernels.h"
+#include "return_codes.h"
+#include <fftw3.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+// Weight of the previous cross-spectrum in the recursive average; higher values trade reaction time for stability.
+#define STREAM_SMOOTHING 0.8
+#define FOLLOW_POLL_MS 10
+
+typedef struct {
+	FILE *file;
+	bool follow;
+	int pcm_format;
+	int16_t *scratch;
+} PcmStream;
+
+static void sleep_ms(int ms) {
+#ifdef _WIN32
+	Sleep(ms);
+#else
+	usleep(ms * 1000);
+#endif
+}
+
+static double now_us(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+static int open_stream(const char *path, int pcm_format, int max_count, PcmStream *stream) {
+	struct stat info;
+	memset(stream, 0, sizeof(PcmStream));
+	stream->pcm_format = pcm_format;
+	if (strcmp(path, "-") == 0) {
+		stream->file = stdin;
+	} else {
+		stream->file = fopen(path, "rb");
+		if (!stream->file) {
+			fprintf(stderr, "Cannot open stream '%s'\n", path);
+			return ERROR_CANNOT_OPEN_FILE;
+		}
+		// Regular files are followed like tail -f, pipes and FIFOs end when the writer closes them.
+		stream->follow = stat(path, &info) == 0 && S_ISREG(info.st_mode);
+	}
+	if (pcm_format == PCM_S16) {
+		stream->scratch = malloc(sizeof(int16_t) * max_count);
+		if (!stream->scratch) {
+			fprintf(stderr, "Failed to allocate memory for stream buffer\n");
+			return ERROR_NOTENOUGH_MEMORY;
+		}
+	}
+	return SUCCESS;
+}
+
+static void close_stream(PcmStream *stream) {
+	if (stream->file && stream->file != stdin) {
+		fclose(stream->file);
+	}
+	free(stream->scratch);
+}
+
+// Blocks until count samples are read; returns false once a non-followed stream runs out.
+static bool read_samples(PcmStream *stream, float *dst, int count) {
+	size_t sample_size = stream->pcm_format == PCM_S16 ? sizeof(int16_t) : sizeof(float);
+	char *raw = stream->pcm_format == PCM_S16 ? (char*)stream->scratch : (char*)dst;
+	size_t done = 0;
+	while (done < (size_t)count) {
+		done += fread(raw + done * sample_size, sample_size, count - done, stream->file);
+		if (done == (size_t)count) break;
+		if (ferror(stream->file) || !stream->follow) return false;
+		clearerr(stream->file);
+		sleep_ms(FOLLOW_POLL_MS);
+	}
+	if (stream->pcm_format == PCM_S16) {
+		kernel_s16_to_float(stream->scratch, dst, count);
+	}
+	return true;
+}
+
+int run_stream(const Options *options) {
+	int rate = options->stream_rate;
+	int window = (int)(options->stream_window * rate);
+	int hop = (int)(options->hop * rate);
+	if (window <= 0 || hop <= 0 || hop > window) {
+		fprintf(stderr, "Stream window and hop must be positive, with hop not exceeding the window\n");
+		return ERROR_ARGUMENTS_INVALID;
+	}
+	int max_lag = options->max_lag >= 0 ? (int)(options->max_lag * rate) : window / 2;
+	if (max_lag >= window) {
+		max_lag = window - 1;
+	}
+	int fft_len = next_deg(2 * window - 1);
+	int half_len = fft_len / 2 + 1;
+	int lag_cnt = 2 * max_lag + 1;
+
+	PcmStream stream1;
+	PcmStream stream2;
+	int ret = open_stream(options->files[0], options->pcm_format, window, &stream1);
+	if (ret == SUCCESS) ret = open_stream(options->files[1], options->pcm_format, window, &stream2);
+	else memset(&stream2, 0, sizeof(PcmStream));
+
+	float *window1 = calloc(2 * window + lag_cnt, sizeof(float));
+	float *window2 = window1 ? window1 + window : NULL;
+	float *lags = window1 ? window1 + 2 * window : NULL;
+	double *real_block = fftw_alloc_real(fft_len);
+	fftw_complex *spectrum_block = fftw_alloc_complex(3 * half_len);
+	if (ret == SUCCESS && (!window1 || !real_block || !spectrum_block)) {
+		fprintf(stderr, "Failed to allocate memory for stream buffers\n");
+		ret = ERROR_NOTENOUGH_MEMORY;
+	}
+	if (ret != SUCCESS) {
+		free(window1);
+		fftw_free(real_block);
+		fftw_free(spectrum_block);
+		close_stream(&stream1);
+		close_stream(&stream2);
+		return ret;
+	}
+
+	fftw_complex *spectrum1 = spectrum_block;
+	fftw_complex *spectrum2 = spectrum_block + half_len;
+	fftw_complex *averaged = spectrum_block + 2 * half_len;
+	memset(averaged, 0, sizeof(fftw_complex) * half_len);
+	fftw_plan plan_forward = fftw_plan_dft_r2c_1d(fft_len, real_block, spectrum1, FFTW_MEASURE);
+	fftw_plan plan_backward = fftw_plan_dft_c2r_1d(fft_len, spectrum1, real_block, FFTW_MEASURE);
+	if (!plan_forward || !plan_backward) {
+		fprintf(stderr, "Failed to create FFT plans for stream\n");
+		if (plan_forward) fftw_destroy_plan(plan_forward);
+		if (plan_backward) fftw_destroy_plan(plan_backward);
+		free(window1);
+		fftw_free(real_block);
+		fftw_free(spectrum_block);
+		close_stream(&stream1);
+		close_stream(&stream2);
+		return ERROR_UNKNOWN;
+	}
+
+	printf("time_s,delay_samples,delay_ms,peak,latency_us\n");
+	fflush(stdout);
+	long long consumed = 0;
+	bool primed = false;
+	int step = window;
+	while (read_samples(&stream1, window1 + window - step, step) && read_samples(&stream2, window2 + window - step, step)) {
+		double started = now_us();
+		consumed += step;
+
+		memset(real_block + window, 0, sizeof(double) * (fft_len - window));
+		kernel_float_to_double(window1, real_block, window);
+		fftw_execute_dft_r2c(plan_forward, real_block, spectrum1);
+		kernel_float_to_double(window2, real_block, window);
+		fftw_execute_dft_r2c(plan_forward, real_block, spectrum2);
+
+		// GCC-PHAT on the recursively averaged cross-spectrum: only the phase of each bin is kept.
+		double history = primed ? STREAM_SMOOTHING : 0.0;
+		for (int i = 0; i < half_len; i++) {
+			double re = spectrum1[i][0] * spectrum2[i][0] + spectrum1[i][1] * spectrum2[i][1];
+			double im = spectrum1[i][1] * spectrum2[i][0] - spectrum1[i][0] * spectrum2[i][1];
+			averaged[i][0] = history * averaged[i][0] + (1.0 - history) * re;
+			averaged[i][1] = history * averaged[i][1] + (1.0 - history) * im;
+			double magnitude = hypot(averaged[i][0], averaged[i][1]);
+			spectrum1[i][0] = magnitude > 0.0 ? averaged[i][0] / magnitude : 0.0;
+			spectrum1[i][1] = magnitude > 0.0 ? averaged[i][1] / magnitude : 0.0;
+		}
+		fftw_execute_dft_c2r(plan_backward, spectrum1, real_block);
+		for (int i = 0; i < lag_cnt; i++) {
+			int lag = i - max_lag;
+			lags[i] = (float)(real_block[lag < 0 ? lag + fft_len : lag] / fft_len);
+		}
+		int peak = find_max_index(lags, lag_cnt);
+		double delay = peak - max_lag + parabolic_offset(lags, lag_cnt, peak);
+		primed = true;
+
+		double latency = now_us() - started;
+		printf("%.3f,%.2f,%.3f,%g,%.0f\n", (double)consumed / rate, delay, delay * 1000.0 / rate, lags[peak], latency);
+		fflush(stdout);
+
+		memmove(window1, window1 + hop, sizeof(float) * (window - hop));
+		memmove(window2, window2 + hop, sizeof(float) * (window - hop));
+		step = hop;
+	}
+
+	fftw_destroy_plan(plan_forward);
+	fftw_destroy_plan(plan_backward);
+	free(window1);
+	fftw_free(real_block);
+	fftw_free(spectrum_block);
+	close_stream(&stream1);
+	close_stream(&stream2);
+	return SUCCESS;
+}
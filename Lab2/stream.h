@@ -0,0 +1,5 @@
+#pragma once
+
+#include "options.h"
+
+int run_stream(const Options *options);